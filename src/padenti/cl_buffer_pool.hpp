@@ -0,0 +1,161 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __CL_BUFFER_POOL_HPP
+#define __CL_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <vector>
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+
+/*!
+ * \brief Pool of OpenCL memory objects reused across successive trainings.
+ *
+ * Buffers are keyed by their flags and size: a request is served by the smallest free
+ * buffer with the same flags and a size in [size, 2*size]. Images are keyed by flags,
+ * format and dimensions. Pinned (i.e. host allocated and mapped) buffers are mapped once
+ * and stay mapped while pooled, hence neither the allocation nor the pinning cost is paid
+ * again by a training with compatible shapes.
+ *
+ * Objects are handed out until release() is called, i.e. at the end of a training. At
+ * that point, pooled objects not acquired since the previous release are destroyed, so
+ * that the pool only keeps the working set of the last training.
+ */
+class CLBufferPool
+{
+private:
+  struct Entry
+  {
+    cl_mem_flags flags;
+    size_t size;
+    // Image format and dimensions (images only, width 0 for buffers)
+    cl_image_format format;
+    size_t width, height, depth;
+    cl::Buffer buffer;
+    cl::Image2D image2D;
+    cl::Image3D image3D;
+    // Pinned buffers: mapping flags, queue and host pointer (NULL if not mapped)
+    cl_map_flags mapFlags;
+    cl::CommandQueue mapQueue;
+    void *mapped;
+    bool acquired;
+  };
+
+  cl::Context m_context;
+  std::vector<Entry> m_entries;
+
+  Entry *_findBuffer(cl_mem_flags flags, size_t size, bool pinned, cl_map_flags mapFlags);
+  Entry *_findImage(cl_mem_flags flags, const cl::ImageFormat &format, size_t width,
+		    size_t height, size_t depth);
+  Entry &_addEntry(cl_mem_flags flags, size_t size);
+  static void _destroy(Entry &entry);
+
+  CLBufferPool(const CLBufferPool &);
+  CLBufferPool &operator=(const CLBufferPool &);
+public:
+  /*!
+   * Create an empty pool, see setContext().
+   */
+  CLBufferPool();
+
+  /*!
+   * Destroy all the pooled objects.
+   */
+  ~CLBufferPool();
+
+  /*!
+   * Set the context the pooled objects belong to. Objects of a previous context are
+   * destroyed.
+   *
+   * \param context The OpenCL context
+   */
+  void setContext(const cl::Context &context);
+
+  /*!
+   * Get a buffer of at least size bytes.
+   *
+   * \param flags Buffer memory flags (host pointer flags are not supported)
+   * \param size Requested size in bytes
+   * \return The buffer, with undefined content
+   */
+  cl::Buffer acquireBuffer(cl_mem_flags flags, size_t size);
+
+  /*!
+   * Get a pinned buffer of at least size bytes, mapped on the host.
+   *
+   * \param queue Queue used for mapping (and, when the buffer is destroyed, unmapping)
+   * \param flags Buffer memory flags (CL_MEM_ALLOC_HOST_PTR is added)
+   * \param mapFlags Mapping flags
+   * \param size Requested size in bytes
+   * \param mapped Output host pointer of the mapped buffer
+   * \return The buffer, with undefined content
+   */
+  cl::Buffer acquirePinnedBuffer(cl::CommandQueue &queue, cl_mem_flags flags,
+				 cl_map_flags mapFlags, size_t size, void *&mapped);
+
+  /*!
+   * Get a 2D image.
+   *
+   * \param flags Image memory flags
+   * \param format Image format
+   * \param width Image width
+   * \param height Image height
+   * \return The image, with undefined content
+   */
+  cl::Image2D acquireImage2D(cl_mem_flags flags, const cl::ImageFormat &format,
+			     size_t width, size_t height);
+
+  /*!
+   * Get a 3D image.
+   *
+   * \param flags Image memory flags
+   * \param format Image format
+   * \param width Image width
+   * \param height Image height
+   * \param depth Image depth
+   * \return The image, with undefined content
+   */
+  cl::Image3D acquireImage3D(cl_mem_flags flags, const cl::ImageFormat &format,
+			     size_t width, size_t height, size_t depth);
+
+  /*!
+   * Give all the acquired objects back to the pool and destroy the ones not acquired
+   * since the previous release. Objects still referenced by the caller must not be used
+   * afterwards.
+   */
+  void release();
+
+  /*!
+   * Destroy all the pooled objects.
+   */
+  void clear();
+
+  /*!
+   * Get the total size of the pooled buffers (images excluded).
+   *
+   * \return The size in bytes
+   */
+  size_t getBuffersSize() const;
+};
+
+#include <padenti/cl_buffer_pool_impl.hpp>
+
+#endif // __CL_BUFFER_POOL_HPP
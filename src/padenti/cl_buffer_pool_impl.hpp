@@ -0,0 +1,209 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <padenti/cl_buffer_pool.hpp>
+
+
+inline CLBufferPool::CLBufferPool()
+{}
+
+
+inline CLBufferPool::~CLBufferPool()
+{
+  clear();
+}
+
+
+inline void CLBufferPool::setContext(const cl::Context &context)
+{
+  clear();
+  m_context = context;
+}
+
+
+inline CLBufferPool::Entry *CLBufferPool::_findBuffer(cl_mem_flags flags, size_t size,
+						      bool pinned, cl_map_flags mapFlags)
+{
+  Entry *bestEntry = NULL;
+  for (unsigned int i=0; i<m_entries.size(); i++)
+  {
+    Entry &entry = m_entries[i];
+    if (entry.acquired || entry.width || entry.flags!=flags) continue;
+    if ((entry.mapped!=NULL)!=pinned || (pinned && entry.mapFlags!=mapFlags)) continue;
+    if (entry.size<size || entry.size>2*size) continue;
+    if (!bestEntry || entry.size<bestEntry->size) bestEntry = &entry;
+  }
+  return bestEntry;
+}
+
+
+inline CLBufferPool::Entry *CLBufferPool::_findImage(cl_mem_flags flags,
+						     const cl::ImageFormat &format,
+						     size_t width, size_t height, size_t depth)
+{
+  for (unsigned int i=0; i<m_entries.size(); i++)
+  {
+    Entry &entry = m_entries[i];
+    if (entry.acquired || entry.flags!=flags) continue;
+    if (entry.width!=width || entry.height!=height || entry.depth!=depth) continue;
+    if (entry.format.image_channel_order!=format.image_channel_order ||
+	entry.format.image_channel_data_type!=format.image_channel_data_type) continue;
+    return &entry;
+  }
+  return NULL;
+}
+
+
+inline CLBufferPool::Entry &CLBufferPool::_addEntry(cl_mem_flags flags, size_t size)
+{
+  m_entries.push_back(Entry());
+  Entry &entry = m_entries.back();
+  entry.flags = flags;
+  entry.size = size;
+  entry.width = 0;
+  entry.height = 0;
+  entry.depth = 0;
+  entry.mapFlags = 0;
+  entry.mapped = NULL;
+  entry.acquired = true;
+  return entry;
+}
+
+
+inline void CLBufferPool::_destroy(Entry &entry)
+{
+  if (entry.mapped)
+  {
+    entry.mapQueue.enqueueUnmapMemObject(entry.buffer, entry.mapped);
+    entry.mapQueue.finish();
+    entry.mapped = NULL;
+  }
+}
+
+
+inline cl::Buffer CLBufferPool::acquireBuffer(cl_mem_flags flags, size_t size)
+{
+  Entry *entry = _findBuffer(flags, size, false, 0);
+  if (entry)
+  {
+    entry->acquired = true;
+    return entry->buffer;
+  }
+
+  Entry &newEntry = _addEntry(flags, size);
+  newEntry.buffer = cl::Buffer(m_context, flags, size);
+  return newEntry.buffer;
+}
+
+
+inline cl::Buffer CLBufferPool::acquirePinnedBuffer(cl::CommandQueue &queue, cl_mem_flags flags,
+						    cl_map_flags mapFlags, size_t size,
+						    void *&mapped)
+{
+  flags |= CL_MEM_ALLOC_HOST_PTR;
+  Entry *entry = _findBuffer(flags, size, true, mapFlags);
+  if (entry)
+  {
+    entry->acquired = true;
+    mapped = entry->mapped;
+    return entry->buffer;
+  }
+
+  Entry &newEntry = _addEntry(flags, size);
+  newEntry.buffer = cl::Buffer(m_context, flags, size);
+  newEntry.mapFlags = mapFlags;
+  newEntry.mapQueue = queue;
+  newEntry.mapped = queue.enqueueMapBuffer(newEntry.buffer, CL_TRUE, mapFlags, 0, size);
+  mapped = newEntry.mapped;
+  return newEntry.buffer;
+}
+
+
+inline cl::Image2D CLBufferPool::acquireImage2D(cl_mem_flags flags,
+						const cl::ImageFormat &format,
+						size_t width, size_t height)
+{
+  Entry *entry = _findImage(flags, format, width, height, 0);
+  if (entry)
+  {
+    entry->acquired = true;
+    return entry->image2D;
+  }
+
+  Entry &newEntry = _addEntry(flags, 0);
+  newEntry.format = format;
+  newEntry.width = width;
+  newEntry.height = height;
+  newEntry.image2D = cl::Image2D(m_context, flags, format, width, height);
+  return newEntry.image2D;
+}
+
+
+inline cl::Image3D CLBufferPool::acquireImage3D(cl_mem_flags flags,
+						const cl::ImageFormat &format,
+						size_t width, size_t height, size_t depth)
+{
+  Entry *entry = _findImage(flags, format, width, height, depth);
+  if (entry)
+  {
+    entry->acquired = true;
+    return entry->image3D;
+  }
+
+  Entry &newEntry = _addEntry(flags, 0);
+  newEntry.format = format;
+  newEntry.width = width;
+  newEntry.height = height;
+  newEntry.depth = depth;
+  newEntry.image3D = cl::Image3D(m_context, flags, format, width, height, depth);
+  return newEntry.image3D;
+}
+
+
+inline void CLBufferPool::release()
+{
+  unsigned int nKept = 0;
+  for (unsigned int i=0; i<m_entries.size(); i++)
+  {
+    if (!m_entries[i].acquired)
+    {
+      _destroy(m_entries[i]);
+      continue;
+    }
+    if (nKept!=i) m_entries[nKept] = m_entries[i];
+    m_entries[nKept].acquired = false;
+    nKept++;
+  }
+  m_entries.resize(nKept);
+}
+
+
+inline void CLBufferPool::clear()
+{
+  for (unsigned int i=0; i<m_entries.size(); i++) _destroy(m_entries[i]);
+  m_entries.clear();
+}
+
+
+inline size_t CLBufferPool::getBuffersSize() const
+{
+  size_t size = 0;
+  for (unsigned int i=0; i<m_entries.size(); i++) size += m_entries[i].size;
+  return size;
+}
@@ -26,6 +26,8 @@
 #include <CL/cl.hpp>
 #include <padenti/tree.hpp>
 #include <padenti/classifier.hpp>
+#include <padenti/cl_device_selector.hpp>
+#include <padenti/perf_stats.hpp>
 
 
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
@@ -73,12 +75,35 @@ private:
   size_t m_internalImgWidth;
   size_t m_internalImgHeight;
 
+  // Performance statistics accumulated since the last reset
+  PredictionStats m_stats;
+
+  void _init(const std::string &featureKernelPath);
   void _initImgObjects(size_t, size_t, bool);
 
 public:
   //CLClassifier(const Tree<FeatType, FeatDim, nClasses> &tree,
   //	       const std::string &featureKernelPath, bool useCPU);
   CLClassifier(const std::string &featureKernelPath, bool useCPU=false);
+
+  /*!
+   * Create a classifier on the first device chosen by a selector, e.g. a specific platform
+   * or a sub-device of a many-core CPU.
+   *
+   * \param featureKernelPath Path of the feature kernel sources
+   * \param selector The platform/device selector
+   */
+  CLClassifier(const std::string &featureKernelPath, const CLDeviceSelector &selector);
+
+  /*!
+   * Create a classifier on a device of an existing context.
+   *
+   * \param featureKernelPath Path of the feature kernel sources
+   * \param context The OpenCL context
+   * \param device The device of the context to use
+   */
+  CLClassifier(const std::string &featureKernelPath, const cl::Context &context,
+	       const cl::Device &device);
   ~CLClassifier();
 
   CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>&
@@ -92,6 +117,20 @@ public:
   void predict(const Image<ImgType, nChannels> &image, Image<float, nClasses> &prediction);
   void predict(const Image<ImgType, nChannels> &image, Image<float, nClasses> &prediction,
 	       Image<unsigned char, 1> &mask);
+
+  /*!
+   * Get the performance statistics (times, transferred bytes, predicted images and pixels)
+   * accumulated by the predict() calls since the classifier creation or the last
+   * resetStats() call.
+   *
+   * \return The statistics
+   */
+  const PredictionStats &getStats() const;
+
+  /*!
+   * Reset the performance statistics.
+   */
+  void resetStats();
 };
 
 
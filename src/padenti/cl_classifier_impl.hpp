@@ -24,6 +24,7 @@
 #include <fstream>
 #include <sstream>
 #include <iterator>
+#include <boost/chrono/chrono.hpp>
 #include <padenti/cl_feat_fmt_traits.hpp>
 #include <padenti/cl_img_fmt_traits.hpp>
 #include <padenti/classifier.hpp>
@@ -36,6 +37,15 @@
 #define INIT_WIDTH (320)
 #define INIT_HEIGHT (240)
 
+
+// Device time (in seconds) elapsed from the start of the first command to the end of the
+// last one
+inline double _profiledTime(const cl::Event &first, const cl::Event &last)
+{
+  return static_cast<double>(last.getProfilingInfo<CL_PROFILING_COMMAND_END>()-
+			     first.getProfilingInfo<CL_PROFILING_COMMAND_START>())*1.e-9;
+}
+
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
 CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLClassifier(
@@ -47,7 +57,42 @@ CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLClassifier(
 {
   m_clContext = cl::Context(useCPU ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU);
   m_clDevice = m_clContext.getInfo<CL_CONTEXT_DEVICES>()[0];
-  m_clQueue = cl::CommandQueue(m_clContext, m_clDevice, 0);
+  _init(featureKernelPath);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLClassifier(
+  const std::string &featureKernelPath,
+  const CLDeviceSelector &selector):
+  m_nTrees(0)
+{
+  std::vector<cl::Device> devices;
+  selector.select(m_clContext, devices);
+  m_clDevice = devices[0];
+  _init(featureKernelPath);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLClassifier(
+  const std::string &featureKernelPath,
+  const cl::Context &context,
+  const cl::Device &device):
+  m_clContext(context), m_clDevice(device), m_nTrees(0)
+{
+  _init(featureKernelPath);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::_init(
+  const std::string &featureKernelPath)
+{
+  m_clQueue = cl::CommandQueue(m_clContext, m_clDevice, CL_QUEUE_PROFILING_ENABLE);
 
   std::string clPredictStr(reinterpret_cast<const char*>(const_cast<const unsigned char*>(predict_cl)),
 			   predict_cl_len);
@@ -214,6 +259,8 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
   Image<int, 1> &prediction,
   Image<unsigned char, 1> &mask)
 {
+  boost::chrono::steady_clock::time_point predictStart = boost::chrono::steady_clock::now();
+  cl::Event startWrite, endWrite, startCompute, endCompute, endRead;
   cl::size_t<3> origin, region;
   size_t fillWidth, fillHeight;
   
@@ -280,7 +327,7 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
     //				CL_FALSE, origin, region, 0, 0, (void*)image.getData());
     m_clQueue.enqueueWriteImage(*reinterpret_cast<cl::Image2D*>(m_clImg),
 				CL_FALSE, origin, region, 0, 0,
-				(void*)m_clImgPinnPtr);
+				(void*)m_clImgPinnPtr, NULL, &startWrite);
   }
   else
   {
@@ -288,13 +335,14 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
     //				CL_FALSE, origin, region, 0, 0, (void*)image.getData());
     m_clQueue.enqueueWriteImage(*reinterpret_cast<cl::Image3D*>(m_clImg),
 				CL_FALSE, origin, region, 0, 0,
-				(void*)m_clImgPinnPtr);
+				(void*)m_clImgPinnPtr, NULL, &startWrite);
   }
  
   region[2]=1;
   std::copy(mask.getData(), mask.getData()+region[0]*region[1], m_clMaskPinnPtr);
   //m_clQueue.enqueueWriteImage(m_clMask, CL_FALSE, origin, region, 0, 0, (void*)mask.getData());
-  m_clQueue.enqueueWriteImage(m_clMask, CL_FALSE, origin, region, 0, 0, (void*)m_clMaskPinnPtr);
+  m_clQueue.enqueueWriteImage(m_clMask, CL_FALSE, origin, region, 0, 0, (void*)m_clMaskPinnPtr,
+			      NULL, &endWrite);
 
   // Set parameters and start prediction
   if (nChannels<=4)
@@ -324,7 +372,9 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
 				   cl::NullRange,
 				   cl::NDRange(image.getWidth()+fillWidth,
 					       image.getHeight()+fillHeight),
-				   cl::NDRange(WG_WIDTH, WG_HEIGHT));
+				   cl::NDRange(WG_WIDTH, WG_HEIGHT),
+				   NULL, &endCompute);
+    if (d==1) startCompute = endCompute;
     if (d<m_treeDepth.at(treeID)-1)
       m_clQueue.enqueueCopyImage(m_clPredictImg, m_clNodesIDImg, origin, origin, region);
   }
@@ -332,10 +382,23 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
   // Read results
   //m_clQueue.enqueueReadImage(m_clPredictImg, CL_TRUE, origin, region, 0, 0, (void*)prediction.getData());
   m_clQueue.enqueueReadImage(m_clPredictImg, CL_TRUE, origin, region, 0, 0, 
-			     (void*)m_clPredictImgPinnPtr);
+			     (void*)m_clPredictImgPinnPtr, NULL, &endRead);
   std::copy(m_clPredictImgPinnPtr, m_clPredictImgPinnPtr+region[0]*region[1],
 	    prediction.getData());
 
+  // Update statistics: the blocking read completed all the profiled commands
+  size_t nPixels = image.getWidth()*image.getHeight();
+  m_stats.nImages++;
+  m_stats.nPixels += nPixels;
+  m_stats.writeTime += _profiledTime(startWrite, endWrite);
+  if (m_treeDepth.at(treeID)>1) m_stats.computeTime += _profiledTime(startCompute, endCompute);
+  m_stats.readTime += _profiledTime(endRead, endRead);
+  m_stats.bytesWritten += nPixels*(nChannels*sizeof(ImgType)+sizeof(cl_uchar));
+  m_stats.bytesRead += nPixels*sizeof(cl_int);
+  m_stats.time +=
+    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-
+								 predictStart).count();
+
   // Done
   //delete m_clImg;
 }
@@ -358,6 +421,8 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
   Image<float, nClasses> &posterior,
   Image<unsigned char, 1> &mask)
 {
+  boost::chrono::steady_clock::time_point predictStart = boost::chrono::steady_clock::now();
+  cl::Event startWrite, endWrite, startCompute, endCompute, endRead;
   cl::size_t<3> origin, region;
   size_t fillWidth, fillHeight;
   
@@ -430,7 +495,7 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
     //				CL_FALSE, origin, region, 0, 0, (void*)image.getData());
     m_clQueue.enqueueWriteImage(*reinterpret_cast<cl::Image2D*>(m_clImg),
 				CL_FALSE, origin, region, 0, 0,
-				(void*)m_clImgPinnPtr);
+				(void*)m_clImgPinnPtr, NULL, &startWrite);
   }
   else
   {
@@ -438,13 +503,14 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
     //				CL_FALSE, origin, region, 0, 0, (void*)image.getData());
     m_clQueue.enqueueWriteImage(*reinterpret_cast<cl::Image3D*>(m_clImg),
 				CL_FALSE, origin, region, 0, 0,
-				(void*)m_clImgPinnPtr);
+				(void*)m_clImgPinnPtr, NULL, &startWrite);
   }
 
   region[2]=1;
   std::copy(mask.getData(), mask.getData()+region[0]*region[1], m_clMaskPinnPtr);
   //m_clQueue.enqueueWriteImage(m_clMask, CL_FALSE, origin, region, 0, 0, (void*)mask.getData());
-  m_clQueue.enqueueWriteImage(m_clMask, CL_FALSE, origin, region, 0, 0, (void*)m_clMaskPinnPtr);
+  m_clQueue.enqueueWriteImage(m_clMask, CL_FALSE, origin, region, 0, 0, (void*)m_clMaskPinnPtr,
+			      NULL, &endWrite);
   
   // Init posterior image (stores leaves posterior for current tree)
   //float *currPosteriorBuff = new float[image.getWidth()*image.getHeight()*nClasses];
@@ -506,7 +572,8 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
 				     cl::NullRange,
 				     cl::NDRange(image.getWidth()+fillWidth,
 						 image.getHeight()+fillHeight),
-				     cl::NDRange(WG_WIDTH, WG_HEIGHT));
+				     cl::NDRange(WG_WIDTH, WG_HEIGHT),
+				     NULL, (d==1) ? &startCompute : NULL);
       if (d<m_treeDepth.at(t)-1)
 	m_clQueue.enqueueCopyImage(m_clPredictImg, m_clNodesIDImg, origin, origin, region);
     }
@@ -516,7 +583,9 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
 				   cl::NullRange,
 				   cl::NDRange(image.getWidth()+fillWidth,
 					       image.getHeight()+fillHeight),
-				   cl::NDRange(WG_WIDTH, WG_HEIGHT));
+				   cl::NDRange(WG_WIDTH, WG_HEIGHT),
+				   NULL, &endCompute);
+    if (m_treeDepth.at(t)<=1) startCompute = endCompute;
 
     // Read results
     //m_clQueue.enqueueReadBuffer(m_clPosteriorBuff, CL_TRUE,
@@ -524,7 +593,9 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
     //				(void*)currPosteriorBuff);
     m_clQueue.enqueueReadBuffer(m_clPosteriorBuff, CL_TRUE,
 				0, image.getWidth()*image.getHeight()*nClasses*sizeof(cl_float),
-				(void*)m_clPosteriorPinnPtr);
+				(void*)m_clPosteriorPinnPtr, NULL, &endRead);
+    m_stats.computeTime += _profiledTime(startCompute, endCompute);
+    m_stats.readTime += _profiledTime(endRead, endRead);
     
 
     // Sum current posterior to total posterior
@@ -551,6 +622,17 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::predict(
   for (int i=0; i<image.getWidth()*image.getHeight()*nClasses; i++) 
     posterior.getData()[i] /= m_nTrees;
 
+  // Update statistics (device times of the trees have been collected after each read)
+  size_t nPixels = image.getWidth()*image.getHeight();
+  m_stats.nImages++;
+  m_stats.nPixels += nPixels;
+  m_stats.writeTime += _profiledTime(startWrite, endWrite);
+  m_stats.bytesWritten += nPixels*(nChannels*sizeof(ImgType)+sizeof(cl_uchar));
+  m_stats.bytesRead += m_nTrees*nPixels*nClasses*sizeof(cl_float);
+  m_stats.time +=
+    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-
+								 predictStart).count();
+
   // Done
   //delete m_clImg;
   //delete []currPosteriorBuff;
@@ -643,3 +725,19 @@ void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initImgObje
   
   // Done
 }
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+const PredictionStats &CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::getStats() const
+{
+  return m_stats;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLClassifier<ImgType, nChannels, FeatType, FeatDim, nClasses>::resetStats()
+{
+  m_stats = PredictionStats();
+}
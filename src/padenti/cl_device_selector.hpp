@@ -0,0 +1,90 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __CL_DEVICE_SELECTOR_HPP
+#define __CL_DEVICE_SELECTOR_HPP
+
+#include <string>
+#include <vector>
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+
+/*!
+ * \brief How the selected OpenCL devices are partitioned into sub-devices (see
+ * CLDeviceSelector::partition)
+ */
+enum DevicePartitionType
+{
+  DEVICE_PARTITION_NONE,              /*!< Use the root devices */
+  DEVICE_PARTITION_EQUALLY,           /*!< Sub-devices with the same number of compute
+					units */
+  DEVICE_PARTITION_BY_COUNTS,         /*!< One sub-device for each requested number of
+					compute units */
+  DEVICE_PARTITION_BY_AFFINITY_DOMAIN /*!< One sub-device for each affinity domain
+					(e.g. NUMA node) */
+};
+
+
+/*!
+ * \brief Selection of the OpenCL platform and devices used by CLTreeTrainer and
+ * CLClassifier.
+ *
+ * Devices of the requested type are taken from the first platform matching the platform
+ * name. Each device may be partitioned into sub-devices (device fission, OpenCL 1.2),
+ * e.g. to run several workloads on disjoint sets of cores of a many-core host: a workload
+ * selecting sub-device 0 and another one selecting sub-device 1 of the same partitioning
+ * do not share compute units. Finally, a subset of the (sub-)devices is selected by index.
+ */
+class CLDeviceSelector
+{
+public:
+  std::string platformName;        /*!< Case sensitive substring of the platform name or
+				     vendor (e.g. "Intel"). If empty, the first platform with
+				     a device of the requested type is used */
+  cl_device_type deviceType;       /*!< Type of the devices (e.g. CL_DEVICE_TYPE_CPU) */
+  DevicePartitionType partition;   /*!< Sub-devices partitioning of each device */
+  std::vector<unsigned int> partitionCounts; /*!< Compute units of each sub-device: with
+					       DEVICE_PARTITION_EQUALLY, the first element
+					       only is used */
+  cl_device_affinity_domain affinityDomain; /*!< Affinity domain used with
+					      DEVICE_PARTITION_BY_AFFINITY_DOMAIN */
+  std::vector<unsigned int> devices; /*!< Indices of the selected (sub-)devices, in the
+				       order they are used. If empty, all the devices are used */
+
+  /*!
+   * Select all the devices of the given type of the first platform, without partitioning.
+   *
+   * \param deviceType Type of the devices
+   */
+  explicit CLDeviceSelector(cl_device_type deviceType=CL_DEVICE_TYPE_GPU);
+
+  /*!
+   * Perform the selection and create a context with the selected devices.
+   *
+   * \param context The new context
+   * \param selectedDevices The selected devices, in the order they must be used
+   */
+  void select(cl::Context &context, std::vector<cl::Device> &selectedDevices) const;
+};
+
+
+#include <padenti/cl_device_selector_impl.hpp>
+
+#endif // __CL_DEVICE_SELECTOR_HPP
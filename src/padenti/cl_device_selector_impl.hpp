@@ -0,0 +1,132 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <padenti/cl_device_selector.hpp>
+
+
+inline CLDeviceSelector::CLDeviceSelector(cl_device_type deviceType):
+  deviceType(deviceType),
+  partition(DEVICE_PARTITION_NONE),
+#ifdef CL_VERSION_1_2
+  affinityDomain(CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE)
+#else
+  affinityDomain(0)
+#endif // CL_VERSION_1_2
+{}
+
+
+inline void CLDeviceSelector::select(cl::Context &context,
+				     std::vector<cl::Device> &selectedDevices) const
+{
+  // Find the first matching platform with at least one device of the requested type
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+  std::vector<cl::Device> rootDevices;
+  unsigned int p;
+  for (p=0; p<platforms.size(); p++)
+  {
+    if (!platformName.empty() &&
+	platforms[p].getInfo<CL_PLATFORM_NAME>().find(platformName)==std::string::npos &&
+	platforms[p].getInfo<CL_PLATFORM_VENDOR>().find(platformName)==std::string::npos)
+    {
+      continue;
+    }
+
+    // Note: with exceptions enabled, a platform without devices of the requested type
+    // throws CL_DEVICE_NOT_FOUND
+    try
+    {
+      platforms[p].getDevices(deviceType, &rootDevices);
+    }
+    catch (cl::Error e)
+    {
+      rootDevices.clear();
+    }
+    if (!rootDevices.empty()) break;
+  }
+  if (rootDevices.empty()) throw "No OpenCL device matches the selection";
+
+  // Partition each device into sub-devices
+  std::vector<cl::Device> allDevices;
+  if (partition==DEVICE_PARTITION_NONE)
+  {
+    allDevices = rootDevices;
+  }
+  else
+  {
+#ifdef CL_VERSION_1_2
+    std::vector<cl_device_partition_property> partitionProps;
+    switch (partition)
+    {
+    case DEVICE_PARTITION_EQUALLY:
+      if (partitionCounts.empty() || !partitionCounts[0])
+      {
+	throw "Equal partitioning requires a non-zero number of compute units";
+      }
+      partitionProps.push_back(CL_DEVICE_PARTITION_EQUALLY);
+      partitionProps.push_back(partitionCounts[0]);
+      partitionProps.push_back(0);
+      break;
+    case DEVICE_PARTITION_BY_COUNTS:
+      if (partitionCounts.empty()) throw "Partitioning by counts requires at least one count";
+      partitionProps.push_back(CL_DEVICE_PARTITION_BY_COUNTS);
+      for (unsigned int c=0; c<partitionCounts.size(); c++)
+      {
+	partitionProps.push_back(partitionCounts[c]);
+      }
+      partitionProps.push_back(CL_DEVICE_PARTITION_BY_COUNTS_LIST_END);
+      partitionProps.push_back(0);
+      break;
+    default:
+      partitionProps.push_back(CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN);
+      partitionProps.push_back(affinityDomain);
+      partitionProps.push_back(0);
+      break;
+    }
+
+    for (unsigned int d=0; d<rootDevices.size(); d++)
+    {
+      std::vector<cl::Device> subDevices;
+      rootDevices[d].createSubDevices(&partitionProps[0], &subDevices);
+      allDevices.insert(allDevices.end(), subDevices.begin(), subDevices.end());
+    }
+#else
+    throw "Device partitioning requires OpenCL 1.2";
+#endif // CL_VERSION_1_2
+  }
+
+  // Select the devices by index
+  if (devices.empty())
+  {
+    selectedDevices = allDevices;
+  }
+  else
+  {
+    selectedDevices.clear();
+    for (unsigned int d=0; d<devices.size(); d++)
+    {
+      if (devices[d]>=allDevices.size()) throw "Selected device index out of range";
+      selectedDevices.push_back(allDevices[devices[d]]);
+    }
+  }
+
+  cl_context_properties contextProps[] =
+    {CL_CONTEXT_PLATFORM, (cl_context_properties)(platforms[p])(), 0};
+  context = cl::Context(selectedDevices, contextProps);
+}
@@ -21,10 +21,82 @@
 #define __CL_TREE_TRAINER_HPP
 
 #include <string>
+#include <vector>
 #include <boost/unordered_map.hpp>
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 #include <padenti/tree_trainer.hpp>
+#include <padenti/histogram_arena.hpp>
+#include <padenti/prng.hpp>
+#include <padenti/host_feature.hpp>
+#include <padenti/work_stealing_pool.hpp>
+#include <padenti/shm_communicator.hpp>
+#include <padenti/cl_buffer_pool.hpp>
+#include <padenti/cl_device_selector.hpp>
+#include <padenti/perf_stats.hpp>
+#include <padenti/tracer.hpp>
+
+
+/*!
+ * \brief Where the best feature/threshold pairs are searched when thresholds are randomly
+ * sampled (see TreeTrainerParameters::randomThrSampling)
+ */
+enum SplitSearchType
+{
+  SPLIT_SEARCH_AUTO,   /*!< On the host if the OpenCL device is a CPU or the frontier is
+			 large, on the device otherwise */
+  SPLIT_SEARCH_DEVICE, /*!< On the OpenCL device, uploading node histograms */
+  SPLIT_SEARCH_HOST    /*!< On the host, directly on the global histogram */
+};
+
+
+/*!
+ * \brief Class representing CLTreeTrainer internal (i.e. implementation specific)
+ * parameters
+ * Internal parameters tune the trainer performances and do not affect the trained tree.
+ * The default constructor sets each parameter to a sensible default value.
+ */
+class CLTreeTrainerInternalParameters
+{
+public:
+  unsigned int histogramFifoSize; /*!< Depth of the fifo queue between the OpenCL producer and
+				    the global histogram update consumer (i.e. number of
+				    per-image histograms simultaneously kept in pinned memory) */
+  unsigned int pipelineDepth;     /*!< Number of training set images simultaneously processed
+				    by each OpenCL device, each one with its own command queue,
+				    device objects and pinned staging memory */
+  unsigned int nDevices;          /*!< Number of OpenCL devices of the context the training
+				    set images are sharded across (0 means all the devices).
+				    Ignored when the CPU is partitioned (see cpuSubDevices) or
+				    the devices are given to the trainer constructor.
+				    Per-image histograms of all the devices are merged into the
+				    global one on the host, hence histogramFifoSize should not be
+				    lower than nDevices*pipelineDepth */
+  unsigned int cpuSubDevices;     /*!< If greater than 1 and the OpenCL device is a CPU,
+				    partition it into this number of sub-devices (device
+				    fission, OpenCL 1.2), each one used as a separate device.
+				    The training set images are sharded across all of them.
+				    Only supported by the CPU/GPU trainer constructor */
+  PRNGType prng;                  /*!< Pseudo-random generator used for features and
+				    thresholds sampling */
+  SplitSearchType splitSearch;    /*!< Best feature/threshold pairs search location.
+				    Note: host and device gains are computed with different
+				    floating point operations, hence nearly equal candidates
+				    may be ranked differently */
+  unsigned int cpuSubtreeMaxSamples; /*!< Nodes reached by at most this number of samples
+				       are handed off, with their whole subtree, to CPU threads
+				       (see CLTreeTrainer::setHostFeature). If 0, all the nodes
+				       are trained on the OpenCL device */
+  unsigned int cpuSubtreeThreads; /*!< Number of CPU threads training the handed off
+				    subtrees. If 0, one thread per online CPU is used */
+
+  CLTreeTrainerInternalParameters();
+};
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+struct CPUSubtreeContext;
 
 
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
@@ -35,27 +107,39 @@ private:
   //cl::Platform m_clPlatform;
   cl::Context m_clContext;
   cl::Device m_clDevice;
+  // Devices training set images are sharded across (m_clDevice, i.e. the one used for
+  // learning, is the first one)
+  std::vector<cl::Device> m_clDevices;
+  bool m_cpuDevice;
   cl::CommandQueue m_clQueue1, m_clQueue2;
+  // One queue per pipeline slot, slots are assigned round-robin to devices
+  std::vector<cl::CommandQueue> m_clPipelineQueues;
+  // Training device objects, reused across train() calls with compatible shapes
+  CLBufferPool m_clBufferPool;
 
   cl::Program m_clHistUpdateProg;
   cl::Program m_clPredictProg;
   cl::Program m_clLearnBestFeatProg;
+  std::string m_clBuildOpts;
+  int m_learnSplitCriterion;
+  cl::Kernel m_clFeatThrTablesKern;
   cl::Kernel m_clPerImgHistKern;
   cl::Kernel m_clPredictKern;
   cl::Kernel m_clLearnBestFeatKern;
+  cl::Kernel m_clReduceBestFeatKern;
   
   cl::Buffer m_clTreeLeftChildBuff;
   cl::Buffer m_clTreeFeaturesBuff;
   cl::Buffer m_clTreeThrsBuff;
   cl::Buffer m_clTreePosteriorsBuff;
 
-  //cl::Image2D m_clTsImg1,          m_clTsImg2;
-  cl::Image   *m_clTsImg1,         *m_clTsImg2;
-  cl::Image2D m_clTsLabelsImg1,    m_clTsLabelsImg2;
-  cl::Image2D m_clTsNodesIDImg1,   m_clTsNodesIDImg2;
-  cl::Buffer  m_clTsSamplesBuff1,  m_clTsSamplesBuff2;
-  cl::Image2D m_clPredictImg1,     m_clPredictImg2;
-  cl::Buffer  m_clPerImgHistBuff1, m_clPerImgHistBuff2;
+  // Per pipeline slot device objects
+  std::vector<cl::Image*>  m_clTsImg;
+  std::vector<cl::Image2D> m_clTsLabelsImg;
+  std::vector<cl::Image2D> m_clTsNodesIDImg;
+  std::vector<cl::Buffer>  m_clTsSamplesBuff;
+  std::vector<cl::Image2D> m_clPredictImg;
+  std::vector<cl::Buffer>  m_clPerImgHistBuff;
   cl::Buffer m_clTsImgPinn;
   cl::Buffer m_clTsLabelsImgPinn;
   cl::Buffer m_clTsNodesIDImgPinn;
@@ -73,29 +157,79 @@ private:
   unsigned int m_maxTsImgSamples;
   bool *m_skippedTsImg;
   bool *m_toSkipTsImg;
+  // Per-image histogram slices index: flags, for each image, the global histogram slices
+  // reached by its samples (built while traversing the first slice)
+  bool *m_tsImgSlices;
+  bool *m_sliceSkippedTsImg;
+  unsigned int m_maxSlices;
 
   cl::Buffer m_clFeatLowBoundsBuff;
   cl::Buffer m_clFeatUpBoundsBuff;
+  // Per-slice feature/threshold tables, generated once per slice and shared by all the
+  // training set images
+  cl::Buffer m_clSliceNodesBuff;
+  cl::Buffer m_clNodeRowMapBuff;
+  cl::Buffer m_clFeatTableBuff;
+  cl::Buffer m_clThrTableBuff;
+  int *m_nodeRowMap;
   unsigned int *m_perNodeTotSamples;
   unsigned int *m_perClassTotSamples;
   int *m_frontier;
   boost::unordered_map<int, int> m_frontierIdxMap;
+  // Frontier offset of each slice of the current depth, plus the frontier size
+  std::vector<unsigned int> m_sliceOffsets;
+  // Exact split search: per-slice node samples responses ([sample][feature]) and labels
+  std::vector<std::vector<FeatType> > m_nodeResponses;
+  std::vector<std::vector<unsigned char> > m_nodeLabels;
 
-  cl::Buffer m_clHistogramBuff;
+  // Double-buffered per-batch node histograms, uploaded while the previous batch is learnt
+  std::vector<cl::Buffer> m_clHistogramBuff;
   size_t m_histogramSize;
+  HistogramArena m_histogramArena;
   unsigned int **m_histogram;
 
-  cl::Buffer m_clBestFeaturesBuff;
-  cl::Buffer m_clBestThresholdsBuff;
-  cl::Buffer m_clBestEntropiesBuff;
-  cl::Buffer m_clPerClassTotSamplesBuff;
+  std::vector<cl::Buffer> m_clPerClassTotSamplesBuff;
+  cl::Buffer m_clGroupBestPairsBuff;
+  cl::Buffer m_clGroupBestEntropiesBuff;
+  // Double-buffered per-batch results, read back while the next batch is learnt
+  std::vector<cl::Buffer> m_clBestFeaturesBuff;
+  std::vector<cl::Buffer> m_clBestThresholdsBuff;
+  std::vector<cl::Buffer> m_clBestEntropiesBuff;
+  unsigned int *m_batchPerClassTotSamples;
   unsigned int *m_bestFeatures;
   unsigned int *m_bestThresholds;
   float *m_bestEntropies;
+  // Host split scores: n*log2(n) values up to the number of samples at the root node
+  std::vector<float> m_nLog2nTable;
+
+  // Subtrees handed off to CPU threads: roots selected at the current depth, roots handed
+  // off and not committed yet (saved by checkpoints), host feature and pool training them
+  // while the OpenCL device trains the larger nodes
+  std::vector<int> m_cpuSubtreeRoots;
+  std::vector<int> m_pendingCPUSubtreeRoots;
+  const HostFeature<ImgType, nChannels, FeatType, FeatDim> *m_hostFeature;
+  WorkStealingPool *m_cpuPool;
+  CPUSubtreeContext<ImgType, nChannels, FeatType, FeatDim, nClasses> *m_cpuContext;
+
+  // Per-level checkpoint file (disabled if empty)
+  std::string m_checkpointPath;
+
+  // Data-parallel training: communicator among the processes owning the training set
+  // shards (NULL for single process training)
+  ShmCommunicator *m_communicator;
+
+  // Performance statistics of the last training
+  TrainingStats m_stats;
+  Tracer *m_tracer;
 
   unsigned int m_seed;
 
+  CLTreeTrainerInternalParameters m_internalParams;
+
 private:
+  void _init(const std::string &featureKernelPath, const cl::Context &context,
+	     const std::vector<cl::Device> &contextDevices, bool explicitDevices);
+  void _buildLearnProgram(SplitCriterion criterion);
   void _initTrain(Tree<FeatType, FeatDim, nClasses> &tree,
 		  const TrainingSet<ImgType, nChannels> &trainingSet,
 		  const TreeTrainerParameters<FeatType, FeatDim> &params,
@@ -109,11 +243,148 @@ private:
   void _learnBestFeatThr(Tree<FeatType, FeatDim, nClasses> &tree,
 			 const TreeTrainerParameters<FeatType, FeatDim> &params,
 			 unsigned int currDepth, unsigned int currSlice);
+  void _writeTreeBuffers(const Tree<FeatType, FeatDim, nClasses> &tree,
+			 unsigned int startNode, unsigned int endNode);
+  void _enqueueLearnBatch(const TreeTrainerParameters<FeatType, FeatDim> &params,
+			  unsigned int currSlice, unsigned int toTrainNodes, unsigned int batch,
+			  cl::Event &readEvent);
+  template <SplitCriterion criterion>
+  void _searchExactSplits(const TreeTrainerParameters<FeatType, FeatDim> &params,
+			  unsigned int currSlice, unsigned int *bestFeatures,
+			  FeatType *bestThresholds, float *bestGains,
+			  unsigned int *leftHistograms);
+  void _handOffCPUSubtrees(Tree<FeatType, FeatDim, nClasses> &tree,
+			   const TrainingSet<ImgType, nChannels> &trainingSet,
+			   const std::vector<int> &roots, bool useSkippedTsImg);
+  void _commitCPUSubtrees(Tree<FeatType, FeatDim, nClasses> &tree);
+  std::string _checkpointFilePath() const;
+  void _saveCheckpoint(const Tree<FeatType, FeatDim, nClasses> &tree,
+		       const TrainingSet<ImgType, nChannels> &trainingSet,
+		       unsigned int trainedDepth);
+  bool _loadCheckpoint(Tree<FeatType, FeatDim, nClasses> &tree,
+		       const TrainingSet<ImgType, nChannels> &trainingSet,
+		       unsigned int startDepth);
+  void _computeNodeStatistics(const TrainingSet<ImgType, nChannels> &trainingSet,
+			      unsigned int startDepth);
+  void _reduceHistogram(Tree<FeatType, FeatDim, nClasses> &tree,
+			const TreeTrainerParameters<FeatType, FeatDim> &params,
+			unsigned int currDepth, unsigned int currSlice);
+  void _broadcastTreeNodes(Tree<FeatType, FeatDim, nClasses> &tree, unsigned int currSlice);
   void _cleanTrain();
 
 public:
-  CLTreeTrainer(const std::string &featureKernelPath, bool useCPU);
+  CLTreeTrainer(const std::string &featureKernelPath, bool useCPU,
+		const CLTreeTrainerInternalParameters &internalParams=CLTreeTrainerInternalParameters());
+
+  /*!
+   * Create a trainer on the devices chosen by a selector, e.g. a specific platform or a
+   * partition of a many-core CPU.
+   *
+   * \param featureKernelPath Path of the feature kernel sources
+   * \param selector The platform/device selector
+   * \param internalParams Internal parameters. Note: all the selected devices are used
+   * (CLTreeTrainerInternalParameters::nDevices is ignored) and
+   * CLTreeTrainerInternalParameters::cpuSubDevices must not be greater than 1 (use the
+   * selector partitioning instead)
+   */
+  CLTreeTrainer(const std::string &featureKernelPath, const CLDeviceSelector &selector,
+		const CLTreeTrainerInternalParameters &internalParams=CLTreeTrainerInternalParameters());
+
+  /*!
+   * Create a trainer on an existing context, e.g. shared with the application.
+   *
+   * \param featureKernelPath Path of the feature kernel sources
+   * \param context The OpenCL context
+   * \param devices The devices of the context to use, the first one is used for learning
+   * \param internalParams Internal parameters (see above for nDevices and cpuSubDevices)
+   */
+  CLTreeTrainer(const std::string &featureKernelPath, const cl::Context &context,
+		const std::vector<cl::Device> &devices,
+		const CLTreeTrainerInternalParameters &internalParams=CLTreeTrainerInternalParameters());
   ~CLTreeTrainer();
+
+  /*!
+   * Set the host implementation of the feature function, enabling the training of small
+   * subtrees on CPU threads (see CLTreeTrainerInternalParameters::cpuSubtreeMaxSamples).
+   *
+   * \param hostFeature The host feature, or NULL to train all the nodes on the OpenCL
+   * device. The trainer does not take its ownership
+   */
+  void setHostFeature(const HostFeature<ImgType, nChannels, FeatType, FeatDim> *hostFeature);
+
+  /*!
+   * Enable per-level checkpoints: after each trained depth, the partial tree and the
+   * per-node training statistics are saved to a binary file. A training started with
+   * startDepth>1 resumes from the checkpoint if it stores the tree trained up to
+   * startDepth-1; otherwise, statistics are recomputed from the input tree (e.g. to
+   * deepen a previously trained tree, see Tree::setDepth). Subtrees handed off to CPU
+   * threads are not saved until the end of the training: the checkpoint stores their
+   * roots, trained again when resuming (the host feature must be set).
+   *
+   * \param checkpointPath The checkpoint file path, or an empty string to disable
+   * checkpoints. With a communicator, the ".rank<N>" suffix is appended (N being the
+   * process rank), hence processes sharing the path never overwrite each other's files
+   */
+  void setCheckpointPath(const std::string &checkpointPath);
+
+  /*!
+   * Enable data-parallel training among the processes of the communicator: each process
+   * calls train() with the same tree, parameters, seed and depths, but with its own shard
+   * of the training set. Partial node histograms are summed across the processes after
+   * each traversal; rank 0 then searches the best splits and broadcasts the updated nodes.
+   * On return, all the processes store the same tree.
+   *
+   * Note: only supported with random thresholds sampling and without CPU subtrees.
+   * Checkpoints are saved by each process for its own shard, in its own file (see
+   * setCheckpointPath()).
+   *
+   * \param communicator The communicator, or NULL for single process training. The
+   * trainer does not take its ownership
+   */
+  void setCommunicator(ShmCommunicator *communicator);
+
+  /*!
+   * Release the device memory kept by the trainer between successive train() calls.
+   * Buffers and pinned mappings are pooled and reused by trainings with compatible shapes
+   * (i.e. same parameters and training set image sizes); the pool only keeps the objects
+   * used by the last training, call this method to free them as well.
+   */
+  void releaseBuffers();
+
+  /*!
+   * Get the performance statistics (per-depth and per-stage times, transferred bytes,
+   * skipped images, memory usage) of the last train() call.
+   *
+   * \return The statistics
+   */
+  const TrainingStats &getStats() const;
+
+  /*!
+   * Record the training timeline: host stages (training steps, staging, fifo waits,
+   * global histogram updates, each one on its own thread) and all the OpenCL commands of
+   * the training set traversal, on their pipeline queue. Save the tracer once train()
+   * returns to get a Chrome trace-event file.
+   *
+   * \param tracer The tracer, or NULL to disable tracing. The trainer does not take its
+   * ownership
+   */
+  void setTracer(Tracer *tracer);
+
+  /*!
+   * Refit the tree posteriors: push the training set pixels through the trained tree (a
+   * single launch per image traverses the whole tree) and replace each node posterior with
+   * the distribution of the pixels reaching it. Nodes not reached by any pixel keep their
+   * posterior. The refit training set may use far more (e.g. all the labeled) pixels than
+   * the one used for training.
+   *
+   * \param tree The tree to refit
+   * \param trainingSet The refit training set
+   * \param allLabeledPixels If true, all the labeled pixels of the training set images are
+   * used, otherwise only the sampled ones
+   */
+  void refit(Tree<FeatType, FeatDim, nClasses> &tree,
+	     const TrainingSet<ImgType, nChannels> &trainingSet,
+	     bool allLabeledPixels=true);
   void train(Tree<FeatType, FeatDim, nClasses> &tree,
 	     const TrainingSet<ImgType, nChannels> &trainingSet,
 	     const TreeTrainerParameters<FeatType, FeatDim> &params,
@@ -33,7 +33,9 @@
 #include <padenti/cl_tree_trainer.hpp>
 #include <padenti/cl_img_fmt_traits.hpp>
 #include <padenti/cl_feat_fmt_traits.hpp>
-#include <padenti/prng.hpp>
+#include <padenti/histogram_update.hpp>
+#include <padenti/split_search.hpp>
+#include <padenti/node_training.hpp>
 
 // TODO: delete
 #include <cstring>
@@ -55,10 +57,18 @@
 /** \todo "automagically" compute this value or parameterize it */
 #define PARALLEL_LEARNT_NODES (8)
 
-// Size of the fifo queue used to parallelize global histogram updates
-/** \todo parameterize */
-//#define GLOBAL_HISTOGRAM_FIFO_SIZE (8)
-#define GLOBAL_HISTOGRAM_FIFO_SIZE (2)
+// Minimum number of nodes of a global histogram slice for which the best feature/threshold
+// pairs are searched on the host (see SPLIT_SEARCH_AUTO)
+/** \todo "automagically" compute this value, e.g. from the device transfer bandwidth */
+#define HOST_SPLIT_SEARCH_MIN_NODES (64)
+
+// Default size of the fifo queue used to parallelize global histogram updates
+// (see CLTreeTrainerInternalParameters)
+#define GLOBAL_HISTOGRAM_FIFO_SIZE (4)
+
+// Default number of images simultaneously processed by the OpenCL device
+// (see CLTreeTrainerInternalParameters)
+#define TRAINING_PIPELINE_DEPTH (2)
 
 // Workgroup size for prediction and local histogram update
 /** \todo parameterize workgroup sizes */
@@ -66,43 +76,162 @@
 #define WG_PREDICT_WIDTH (16)
 #define WG_LHIST_UPDATE_HEIGHT (1)
 #define WG_LHIST_UPDATE_WIDTH (256)
+#define WG_LEARN_BEST_FEAT (32)
+
+
+inline CLTreeTrainerInternalParameters::CLTreeTrainerInternalParameters():
+  histogramFifoSize(GLOBAL_HISTOGRAM_FIFO_SIZE),
+  pipelineDepth(TRAINING_PIPELINE_DEPTH),
+  nDevices(1),
+  cpuSubDevices(0),
+  prng(PRNG_MD5),
+  splitSearch(SPLIT_SEARCH_AUTO),
+  cpuSubtreeMaxSamples(0),
+  cpuSubtreeThreads(0)
+{}
 
 
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
 CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLTreeTrainer(const std::string &featureKernelPath,
-									      bool useCPU)
+									      bool useCPU,
+									      const CLTreeTrainerInternalParameters &internalParams):
+  m_hostFeature(NULL), m_cpuPool(NULL), m_cpuContext(NULL), m_communicator(NULL),
+  m_tracer(NULL), m_internalParams(internalParams)
 {
-  // Get a OpenCL context using the first platform with a device of the specified type
-  /** \todo provide API for platform and devices quering */
-  m_clContext = cl::Context(useCPU ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU);
-  
-  // Get the first device of the specified type found
-  /** \todo provide API for devices selection */
-  m_clDevice = m_clContext.getInfo<CL_CONTEXT_DEVICES>()[0];
+  // Get a OpenCL context using the default platform with a device of the specified type
+  cl::Context context(useCPU ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU);
+  _init(featureKernelPath, context, context.getInfo<CL_CONTEXT_DEVICES>(), false);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLTreeTrainer(const std::string &featureKernelPath,
+									      const CLDeviceSelector &selector,
+									      const CLTreeTrainerInternalParameters &internalParams):
+  m_hostFeature(NULL), m_cpuPool(NULL), m_cpuContext(NULL), m_communicator(NULL),
+  m_tracer(NULL), m_internalParams(internalParams)
+{
+  cl::Context context;
+  std::vector<cl::Device> devices;
+  selector.select(context, devices);
+  _init(featureKernelPath, context, devices, true);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLTreeTrainer(const std::string &featureKernelPath,
+									      const cl::Context &context,
+									      const std::vector<cl::Device> &devices,
+									      const CLTreeTrainerInternalParameters &internalParams):
+  m_hostFeature(NULL), m_cpuPool(NULL), m_cpuContext(NULL), m_communicator(NULL),
+  m_tracer(NULL), m_internalParams(internalParams)
+{
+  _init(featureKernelPath, context, devices, true);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_init(
+  const std::string &featureKernelPath,
+  const cl::Context &context,
+  const std::vector<cl::Device> &contextDevices,
+  bool explicitDevices)
+{
+  if (!m_internalParams.histogramFifoSize) throw "Histogram fifo size must be greater than 0";
+  if (!m_internalParams.pipelineDepth) throw "Pipeline depth must be greater than 0";
+  if (contextDevices.empty()) throw "At least one OpenCL device is required";
+  if (explicitDevices && m_internalParams.cpuSubDevices>1)
+  {
+    throw "CPU sub-devices not supported with explicitly given devices (partition them "
+      "with the device selector)";
+  }
+
+  m_clContext = context;
+  std::vector<cl::Device> devices(contextDevices);
+  bool partitioned = false;
+
+#ifdef CL_VERSION_1_2
+  // Device fission: split the CPU device into sub-devices with the same number of compute
+  // units, each one used as a separate device (sub-devices require a new context). All
+  // the sub-devices are used, whatever nDevices
+  if (m_internalParams.cpuSubDevices>1 &&
+      (devices[0].getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU))
+  {
+    unsigned int computeUnits = devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    cl_device_partition_property partitionProps[] =
+      {CL_DEVICE_PARTITION_EQUALLY,
+       std::max(computeUnits/m_internalParams.cpuSubDevices, 1u), 0};
+    std::vector<cl::Device> subDevices;
+    devices[0].createSubDevices(partitionProps, &subDevices);
+    // Note: rounding may leave more sub-devices than requested
+    if (subDevices.size()>m_internalParams.cpuSubDevices)
+    {
+      subDevices.resize(m_internalParams.cpuSubDevices);
+    }
+    m_clContext = cl::Context(subDevices);
+    devices = subDevices;
+    partitioned = true;
+  }
+#endif // CL_VERSION_1_2
+
+  // Use the given or partitioned devices, otherwise the first nDevices ones. The first
+  // device is used for learning as well
+  unsigned int nDevices = (m_internalParams.nDevices && !explicitDevices && !partitioned) ?
+    std::min<size_t>(m_internalParams.nDevices, devices.size()) : devices.size();
+  m_clDevices.assign(devices.begin(), devices.begin()+nDevices);
+  m_clDevice = m_clDevices[0];
+  m_cpuDevice = (m_clDevice.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU)!=0;
+  m_clBufferPool.setContext(m_clContext);
 
   //m_clQueue = cl::CommandQueue(m_clContext, m_clDevice, 0);
   m_clQueue1 = cl::CommandQueue(m_clContext, m_clDevice, CL_QUEUE_PROFILING_ENABLE);
   m_clQueue2 = cl::CommandQueue(m_clContext, m_clDevice, CL_QUEUE_PROFILING_ENABLE);
 
+  // One command queue for each training pipeline slot: slots are assigned round-robin to
+  // the devices, i.e. consecutive images are processed by different devices (the first two
+  // slots of the first device are shared with the learning stage)
+  unsigned int nPipelineSlots = m_internalParams.pipelineDepth*nDevices;
+  for (unsigned int p=0; p<nPipelineSlots; p++)
+  {
+    unsigned int devSlot = p/nDevices;
+    if (p%nDevices==0 && devSlot<2)
+    {
+      m_clPipelineQueues.push_back((devSlot==0) ? m_clQueue1 : m_clQueue2);
+    }
+    else
+    {
+      m_clPipelineQueues.push_back(cl::CommandQueue(m_clContext, m_clDevices[p%nDevices],
+						    CL_QUEUE_PROFILING_ENABLE));
+    }
+  }
+  if (nDevices>1)
+  {
+    BOOST_LOG_TRIVIAL(info) << "Training set images sharded across " << nDevices
+			    << " OpenCL devices";
+  }
+  if (m_internalParams.histogramFifoSize<nPipelineSlots)
+  {
+    BOOST_LOG_TRIVIAL(warning) << "Histogram fifo size lower than the number of pipeline "
+			       << "slots (" << nPipelineSlots << "): devices may stall";
+  }
+
   // Compile training specific kernels
   std::string clHistUpdateStr(reinterpret_cast<const char*>(const_cast<const unsigned char*>(hist_update_cl)),
 			      hist_update_cl_len);
   std::string clPredictStr(reinterpret_cast<const char*>(const_cast<const unsigned char*>(predict_cl)),
 			   predict_cl_len);
-  std::string clLearnBestFeatStr(reinterpret_cast<const char*>(const_cast<const unsigned char*>(learn_best_feature_cl)),
-				 learn_best_feature_cl_len);
 
   cl::Program::Sources clHistUpdateSrc(1, std::make_pair(clHistUpdateStr.c_str(),
 							 clHistUpdateStr.length()+1));  
   cl::Program::Sources clPredictSrc(1, std::make_pair(clPredictStr.c_str(),
 						      clPredictStr.length()+1));
-  cl::Program::Sources clLearnBestFeatSrc(1, std::make_pair(clLearnBestFeatStr.c_str(),
-							    clLearnBestFeatStr.length()+1));
 
   m_clHistUpdateProg = cl::Program(m_clContext, clHistUpdateSrc);
   m_clPredictProg = cl::Program(m_clContext, clPredictSrc);
-  m_clLearnBestFeatProg = cl::Program(m_clContext, clLearnBestFeatSrc);
   
 
   // Generic feature type trick:
@@ -152,9 +281,19 @@ CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLTreeTrainer(co
   opts << "-I/tmp -I" << featureKernelPath;
 #endif // WIN32
 
+  // Note: the learning program is built on training, specialized for the split criterion
+  m_clBuildOpts = opts.str();
+  m_learnSplitCriterion = -1;
+
+  // Select the features/thresholds sampling generator (must match the host one used
+  // during learning)
+  std::stringstream histUpdateOpts;
+  histUpdateOpts << opts.str();
+  if (m_internalParams.prng==PRNG_PHILOX) histUpdateOpts << " -DPRNG_PHILOX";
+
   try
   {
-    m_clHistUpdateProg.build(opts.str().c_str());
+    m_clHistUpdateProg.build(histUpdateOpts.str().c_str());
   }
   catch (cl::Error e)
   {
@@ -178,23 +317,16 @@ CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::CLTreeTrainer(co
     throw buildLog;
   }
 
-  try
-  {
-    m_clLearnBestFeatProg.build(opts.str().c_str());
-  }
-  catch (cl::Error e)
-  {
-    std::string buildLog;
-    m_clLearnBestFeatProg.getBuildInfo(m_clDevice, CL_PROGRAM_BUILD_LOG, &buildLog);
-
-    std::cerr << buildLog << std::endl;
-    throw buildLog;
-  }
-
   /** \todo avoid kernels name hardcoding? */
+  m_clFeatThrTablesKern = cl::Kernel(m_clHistUpdateProg, "generateFeatThrTables");
   m_clPerImgHistKern = cl::Kernel(m_clHistUpdateProg, "computePerImageHistogram");
   m_clPredictKern = cl::Kernel(m_clPredictProg, "predict");
-  m_clLearnBestFeatKern = cl::Kernel(m_clLearnBestFeatProg, "learnBestFeature");
+
+  // Select the global histogram update implementation for the host CPU
+  const char *histAccumulateName;
+  getHistogramAccumulateFunc(&histAccumulateName);
+  BOOST_LOG_TRIVIAL(info) << "Global histogram update using " << histAccumulateName
+			  << " instructions";
 }
 
 
@@ -206,20 +338,38 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::train(
   const TreeTrainerParameters<FeatType, FeatDim> &params,
   unsigned int startDepth, unsigned int endDepth)
 {
-  /** \todo support a starting depth different from 1 */
-  if (startDepth!=1) throw "Starting depth must be equal to 1";
+  if (startDepth<1 || startDepth>=endDepth) throw "Starting depth must be in [1, endDepth)";
+  if (tree.getDepth()<endDepth) throw "Tree depth must not be lower than the ending depth";
+
+  boost::chrono::steady_clock::time_point trainStart = boost::chrono::steady_clock::now();
+  m_stats = TrainingStats();
+  if (m_tracer) m_tracer->setThreadName("Trainer");
+  TraceScope trainScope(m_tracer, "train", "train");
 
   _initTrain(tree, trainingSet, params, startDepth, endDepth);
+  m_stats.initTime =
+    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-
+								 trainStart).count();
   
 
   for (unsigned int currDepth=startDepth; currDepth<endDepth; currDepth++)
   {
     boost::chrono::steady_clock::time_point perLevelTrainStart = 
       boost::chrono::steady_clock::now(); 
+    TraceScope depthScope(m_tracer, "depth", "train");
 
     unsigned int frontierSize = _initFrontier(tree, params, currDepth);
     unsigned int nSlices = _initHistogram(params);
 
+    m_stats.depths.push_back(TrainingDepthStats());
+    TrainingDepthStats &depthStats = m_stats.depths.back();
+    depthStats.depth = currDepth;
+    depthStats.frontierSize = frontierSize;
+    depthStats.nSlices = nSlices;
+
+    // Small nodes subtrees are trained on CPU threads while the device trains the others
+    _handOffCPUSubtrees(tree, trainingSet, m_cpuSubtreeRoots, currDepth>1);
+
     
     if (nSlices>1)
     {
@@ -235,23 +385,139 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::train(
     for (unsigned int i=0; i<nSlices; i++)
     {
       _traverseTrainingSet(trainingSet, params, currDepth, i);
-      _learnBestFeatThr(tree, params, currDepth, i);
+      if (!m_communicator)
+      {
+	_learnBestFeatThr(tree, params, currDepth, i);
+      }
+      else
+      {
+	// Data-parallel training: sum the shards histograms, learn on rank 0 and
+	// broadcast the learnt nodes
+	_reduceHistogram(tree, params, currDepth, i);
+	if (!m_communicator->getRank()) _learnBestFeatThr(tree, params, currDepth, i);
+	_broadcastTreeNodes(tree, i);
+      }
     }
 
     // Update skipped images flags
     std::copy(m_toSkipTsImg, m_toSkipTsImg+trainingSet.getImages().size(), m_skippedTsImg);
+
+    // Checkpoint the levels trained by the device: CPU subtrees are still being trained,
+    // hence only their roots are saved (see _saveCheckpoint())
+    if (!m_checkpointPath.empty()) _saveCheckpoint(tree, trainingSet, currDepth);
   
 
     boost::chrono::duration<double> perLevelTrainTime =
       boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now() - 
 								   perLevelTrainStart);
+    m_stats.depths.back().time = perLevelTrainTime.count();
     
     BOOST_LOG_TRIVIAL(info) << "Depth " << currDepth << " trained in "
 			    << perLevelTrainTime.count() << " seconds";
     
   }
 
+  // Wait for the CPU subtrees and add them to the tree
+  _commitCPUSubtrees(tree);
+
+  m_stats.histogramSize = m_histogramArena.getSize()*sizeof(unsigned int);
+  m_stats.deviceBuffersSize = m_clBufferPool.getBuffersSize();
   _cleanTrain();
+
+  m_stats.peakResidentSize = getPeakResidentSize();
+  m_stats.time =
+    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-
+								 trainStart).count();
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::setHostFeature(
+  const HostFeature<ImgType, nChannels, FeatType, FeatDim> *hostFeature)
+{
+  m_hostFeature = hostFeature;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::setCheckpointPath(
+  const std::string &checkpointPath)
+{
+  m_checkpointPath = checkpointPath;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::setCommunicator(
+  ShmCommunicator *communicator)
+{
+  m_communicator = communicator;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::releaseBuffers()
+{
+  m_clBufferPool.clear();
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+const TrainingStats &CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::getStats() const
+{
+  return m_stats;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::setTracer(Tracer *tracer)
+{
+  m_tracer = tracer;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_buildLearnProgram(
+  SplitCriterion criterion)
+{
+  // The split score is compiled into the learning kernel, hence the program is rebuilt
+  // only when the criterion changes between two trainings
+  if (m_learnSplitCriterion==criterion) return;
+
+  std::string clLearnBestFeatStr(reinterpret_cast<const char*>(const_cast<const unsigned char*>(learn_best_feature_cl)),
+				 learn_best_feature_cl_len);
+  cl::Program::Sources clLearnBestFeatSrc(1, std::make_pair(clLearnBestFeatStr.c_str(),
+							    clLearnBestFeatStr.length()+1));
+  m_clLearnBestFeatProg = cl::Program(m_clContext, clLearnBestFeatSrc);
+
+  std::stringstream opts;
+  opts << m_clBuildOpts;
+  if (criterion==SPLIT_CRITERION_GINI) opts << " -DSPLIT_CRITERION_GINI";
+  else if (criterion==SPLIT_CRITERION_GAIN_RATIO) opts << " -DSPLIT_CRITERION_GAIN_RATIO";
+
+  try
+  {
+    m_clLearnBestFeatProg.build(opts.str().c_str());
+  }
+  catch (cl::Error e)
+  {
+    std::string buildLog;
+    m_clLearnBestFeatProg.getBuildInfo(m_clDevice, CL_PROGRAM_BUILD_LOG, &buildLog);
+
+    std::cerr << buildLog << std::endl;
+    throw buildLog;
+  }
+
+  m_clLearnBestFeatKern = cl::Kernel(m_clLearnBestFeatProg, "learnBestFeature");
+  m_clReduceBestFeatKern = cl::Kernel(m_clLearnBestFeatProg, "reduceBestFeature");
+  m_learnSplitCriterion = criterion;
 }
 
 
@@ -264,3 +530,7 @@ CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::~CLTreeTrainer()
 #include <padenti/cl_tree_trainer_impl_init.hpp>
 #include <padenti/cl_tree_trainer_impl_traverse_ts.hpp>
 #include <padenti/cl_tree_trainer_impl_learn_best_featthr.hpp>
+#include <padenti/cl_tree_trainer_impl_cpu_subtree.hpp>
+#include <padenti/cl_tree_trainer_impl_checkpoint.hpp>
+#include <padenti/cl_tree_trainer_impl_refit.hpp>
+#include <padenti/cl_tree_trainer_impl_multiproc.hpp>
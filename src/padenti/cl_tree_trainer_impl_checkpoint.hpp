@@ -0,0 +1,275 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#define CHECKPOINT_MAGIC "PDTCKPT"
+#define CHECKPOINT_VERSION (2)
+
+
+// Checkpoint file header, followed by the tree nodes and the per-node statistics up to the
+// first untrained level, by the per-image skip flags and by the roots of the CPU subtrees
+// not committed yet. Subtrees are committed at the end of the training only, hence saved
+// levels hold the nodes trained by the device and the roots are plain leaves
+struct CheckpointHeader
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int treeID;
+  unsigned int trainedDepth;    // Last trained depth
+  unsigned int featSize;
+  unsigned int featDim;
+  unsigned int nClasses;
+  unsigned int nImages;
+  unsigned int nRootSamples;    // Used to detect training set changes
+  unsigned int nCPUSubtrees;
+};
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+std::string CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_checkpointFilePath()
+  const
+{
+  // Each process of a communicator saves its own shard statistics
+  if (!m_communicator) return m_checkpointPath;
+  std::ostringstream path;
+  path << m_checkpointPath << ".rank" << m_communicator->getRank();
+  return path.str();
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_saveCheckpoint(
+  const Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  unsigned int trainedDepth)
+{
+  TraceScope traceScope(m_tracer, "saveCheckpoint", "train");
+  unsigned int nNodes = (2<<trainedDepth)-1;
+  unsigned int nImages = trainingSet.getImages().size();
+
+  CheckpointHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::strcpy(header.magic, CHECKPOINT_MAGIC);
+  header.version = CHECKPOINT_VERSION;
+  header.treeID = tree.getID();
+  header.trainedDepth = trainedDepth;
+  header.featSize = sizeof(FeatType);
+  header.featDim = FeatDim;
+  header.nClasses = nClasses;
+  header.nImages = nImages;
+  header.nRootSamples = m_perNodeTotSamples[0];
+  header.nCPUSubtrees = m_pendingCPUSubtreeRoots.size();
+
+  // Write a temporary file and rename it, so that a crash while saving never leaves a
+  // truncated checkpoint
+  std::string checkpointPath = _checkpointFilePath();
+  std::string tmpPath = checkpointPath+".tmp";
+  std::ofstream out(tmpPath.c_str(), std::ios::binary|std::ios::trunc);
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)tree.getLeftChildren(), nNodes*sizeof(int));
+  out.write((const char*)tree.getFeatures(), nNodes*FeatDim*sizeof(FeatType));
+  out.write((const char*)tree.getThresholds(), nNodes*sizeof(FeatType));
+  out.write((const char*)tree.getPosteriors(), nNodes*nClasses*sizeof(float));
+  out.write((const char*)m_perNodeTotSamples, nNodes*sizeof(unsigned int));
+  out.write((const char*)m_perClassTotSamples, nNodes*nClasses*sizeof(unsigned int));
+  out.write((const char*)m_skippedTsImg, nImages*sizeof(bool));
+  if (header.nCPUSubtrees)
+  {
+    out.write((const char*)&m_pendingCPUSubtreeRoots[0], header.nCPUSubtrees*sizeof(int));
+  }
+  out.close();
+  if (!out) throw "Unable to write the training checkpoint";
+
+#ifdef WIN32
+  std::remove(checkpointPath.c_str());
+#endif // WIN32
+  if (std::rename(tmpPath.c_str(), checkpointPath.c_str()))
+  {
+    throw "Unable to write the training checkpoint";
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+bool CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_loadCheckpoint(
+  Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  unsigned int startDepth)
+{
+  std::ifstream in(_checkpointFilePath().c_str(), std::ios::binary);
+  if (!in) return false;
+
+  CheckpointHeader header;
+  in.read((char*)&header, sizeof(header));
+  if (!in || std::strncmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) ||
+      header.version!=CHECKPOINT_VERSION)
+  {
+    throw "Invalid training checkpoint";
+  }
+  if (header.treeID!=tree.getID() || header.featSize!=sizeof(FeatType) ||
+      header.featDim!=FeatDim || header.nClasses!=nClasses ||
+      header.nImages!=trainingSet.getImages().size() ||
+      header.nRootSamples!=m_perNodeTotSamples[0])
+  {
+    throw "Training checkpoint does not match the tree or the training set";
+  }
+  if (header.trainedDepth+1!=startDepth)
+  {
+    BOOST_LOG_TRIVIAL(info) << "Checkpoint trained up to depth " << header.trainedDepth
+			    << ", not used to resume from depth " << startDepth;
+    return false;
+  }
+
+  // Restore the trained levels, the untrained ones are left uninitialized
+  unsigned int nNodes = (2<<header.trainedDepth)-1;
+  unsigned int nTreeNodes = (2<<(tree.getDepth()-1))-1;
+  in.read((char*)tree.getLeftChildren(), nNodes*sizeof(int));
+  in.read((char*)tree.getFeatures(), nNodes*FeatDim*sizeof(FeatType));
+  in.read((char*)tree.getThresholds(), nNodes*sizeof(FeatType));
+  in.read((char*)tree.getPosteriors(), nNodes*nClasses*sizeof(float));
+  in.read((char*)m_perNodeTotSamples, nNodes*sizeof(unsigned int));
+  in.read((char*)m_perClassTotSamples, nNodes*nClasses*sizeof(unsigned int));
+  in.read((char*)m_skippedTsImg, header.nImages*sizeof(bool));
+  m_pendingCPUSubtreeRoots.resize(header.nCPUSubtrees);
+  if (header.nCPUSubtrees)
+  {
+    in.read((char*)&m_pendingCPUSubtreeRoots[0], header.nCPUSubtrees*sizeof(int));
+  }
+  if (!in) throw "Truncated training checkpoint";
+
+  std::fill(tree.getLeftChildren()+nNodes, tree.getLeftChildren()+nTreeNodes, -2);
+  std::fill(tree.getFeatures()+nNodes*FeatDim, tree.getFeatures()+nTreeNodes*FeatDim,
+	    (FeatType)0);
+  std::fill(tree.getThresholds()+nNodes, tree.getThresholds()+nTreeNodes, (FeatType)0);
+  std::fill(tree.getPosteriors()+nNodes*nClasses, tree.getPosteriors()+nTreeNodes*nClasses,
+	    0.0f);
+
+  // The tree buffers have been initialized from the tree passed to train
+  m_clQueue1.enqueueWriteBuffer(m_clTreeLeftChildBuff, CL_FALSE, 0, nNodes*sizeof(cl_int),
+				(void*)tree.getLeftChildren());
+  m_clQueue1.enqueueWriteBuffer(m_clTreeFeaturesBuff, CL_FALSE, 0,
+				nNodes*FeatDim*sizeof(FeatType), (void*)tree.getFeatures());
+  m_clQueue1.enqueueWriteBuffer(m_clTreeThrsBuff, CL_FALSE, 0, nNodes*sizeof(FeatType),
+				(void*)tree.getThresholds());
+  m_clQueue1.enqueueWriteBuffer(m_clTreePosteriorsBuff, CL_TRUE, 0,
+				nNodes*nClasses*sizeof(cl_float), (void*)tree.getPosteriors());
+
+  return true;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_computeNodeStatistics(
+  const TrainingSet<ImgType, nChannels> &trainingSet, unsigned int startDepth)
+{
+  cl::Image &clTsImg = *m_clTsImg[0];
+  cl::Image2D &clTsLabelsImg = m_clTsLabelsImg[0];
+  cl::Image2D &clTsNodesIDImg = m_clTsNodesIDImg[0];
+  cl::Image2D &clPredictImg = m_clPredictImg[0];
+  cl::size_t<3> origin, region;
+  origin[0]=0; origin[1]=0; origin[2]=0;
+  int startNode = (2<<(startDepth-2))-1;
+  std::vector<int> nodesID(m_maxTsImgWidth*m_maxTsImgHeight);
+
+  if (nChannels<=4) m_clPredictKern.setArg(0, *reinterpret_cast<cl::Image2D*>(&clTsImg));
+  else m_clPredictKern.setArg(0, *reinterpret_cast<cl::Image3D*>(&clTsImg));
+  m_clPredictKern.setArg(1, clTsLabelsImg);
+  m_clPredictKern.setArg(10, clTsNodesIDImg);
+  m_clPredictKern.setArg(11, clPredictImg);
+
+  // Route each image samples down to the starting depth and count them on reached nodes
+  // (same prediction steps of _traverseTrainingSet)
+  std::fill_n(m_perNodeTotSamples+1, startNode*2, 0);
+  std::fill_n(m_perClassTotSamples, (startNode*2+1)*nClasses, 0);
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &tsImages = trainingSet.getImages();
+  for (unsigned int i=0; i<tsImages.size(); i++)
+  {
+    const TrainingSetImage<ImgType, nChannels> &currImage = tsImages[i];
+    unsigned int fillWidth = (currImage.getWidth()%WG_PREDICT_WIDTH) ?
+      WG_PREDICT_WIDTH-(currImage.getWidth()%WG_PREDICT_WIDTH) : 0;
+    unsigned int fillHeight = (currImage.getHeight()%WG_PREDICT_HEIGHT) ?
+      WG_PREDICT_HEIGHT-(currImage.getHeight()%WG_PREDICT_HEIGHT) : 0;
+
+    region[0]=m_maxTsImgWidth; region[1]=m_maxTsImgHeight; region[2]=1;
+    std::fill(nodesID.begin(), nodesID.end(), 0);
+    m_clQueue1.enqueueWriteImage(clTsNodesIDImg, CL_FALSE, origin, region, 0, 0,
+				 (void*)&nodesID[0]);
+
+    region[0]=currImage.getWidth(); region[1]=currImage.getHeight();
+    region[2] = (nChannels<=4) ? 1 : nChannels;
+    if (nChannels<=4)
+    {
+      m_clQueue1.enqueueWriteImage(*reinterpret_cast<cl::Image2D*>(&clTsImg), CL_FALSE,
+				   origin, region, 0, 0, (void*)currImage.getData());
+    }
+    else
+    {
+      m_clQueue1.enqueueWriteImage(*reinterpret_cast<cl::Image3D*>(&clTsImg), CL_FALSE,
+				   origin, region, 0, 0, (void*)currImage.getData());
+    }
+    region[2] = 1;
+    m_clQueue1.enqueueWriteImage(clTsLabelsImg, CL_FALSE, origin, region, 0, 0,
+				 (void*)currImage.getLabels());
+
+    m_clPredictKern.setArg(3, currImage.getWidth());
+    m_clPredictKern.setArg(4, currImage.getHeight());
+    for (unsigned int d=0; d<startDepth-1; d++)
+    {
+      m_clQueue1.enqueueNDRangeKernel(m_clPredictKern,
+				      cl::NullRange,
+				      cl::NDRange(currImage.getWidth()+fillWidth,
+						  currImage.getHeight()+fillHeight),
+				      cl::NDRange(WG_PREDICT_WIDTH, WG_PREDICT_HEIGHT));
+      m_clQueue1.enqueueCopyImage(clPredictImg, clTsNodesIDImg, origin, origin, region);
+    }
+    m_clQueue1.enqueueReadImage(clTsNodesIDImg, CL_TRUE, origin, region, 0, 0,
+				(void*)&nodesID[0]);
+
+    // Images without samples at the starting depth are skipped, as done by the traversal
+    bool skipImg = true;
+    for (unsigned int s=0; s<currImage.getNSamples(); s++)
+    {
+      unsigned int id = currImage.getSamples()[s];
+      int nodeID = nodesID[id];
+      unsigned int label = (unsigned int)currImage.getLabels()[id]-1;
+
+      if (nodeID<startNode) continue;
+      m_perNodeTotSamples[nodeID]++;
+      m_perClassTotSamples[nodeID*nClasses+label]++;
+      skipImg = false;
+    }
+    m_skippedTsImg[i] = skipImg;
+  }
+
+  // Data-parallel training: sum the statistics of all the training set shards
+  if (m_communicator)
+  {
+    m_communicator->allReduceSum(m_perNodeTotSamples+startNode, startNode+1);
+    m_communicator->allReduceSum(m_perClassTotSamples+startNode*nClasses, (startNode+1)*nClasses);
+  }
+}
@@ -0,0 +1,435 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <boost/unordered_map.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif // _OPENMP
+
+
+// Training sample of a node handed off to the CPU subtrees path
+struct CPUSubtreeSample
+{
+  unsigned int image;
+  unsigned int pixel;
+  unsigned char label;
+};
+
+
+// Split of a node trained on the CPU, applied to the tree once all the subtrees are done
+template <typename FeatType, unsigned int FeatDim, unsigned int nClasses>
+struct CPUSubtreeSplit
+{
+  unsigned int nodeID;
+  FeatType feature[FeatDim];
+  FeatType threshold;
+  float leftPosterior[nClasses];
+  float rightPosterior[nClasses];
+};
+
+
+// Data shared by all the CPU subtree tasks of a training
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+struct CPUSubtreeContext
+{
+  const TrainingSet<ImgType, nChannels> *trainingSet;
+  const HostFeature<ImgType, nChannels, FeatType, FeatDim> *hostFeature;
+  TreeTrainerParameters<FeatType, FeatDim> params;
+  unsigned int treeID;
+  unsigned int endDepth;
+  PRNGFunc prngRand;
+  SplitGainRowFunc splitGainRow;
+  const float *nLog2n;
+  // Per-worker splits, i.e. no synchronization is needed while training
+  std::vector<std::vector<CPUSubtreeSplit<FeatType, FeatDim, nClasses> > > splits;
+};
+
+
+/*!
+ * \brief Train a node, and recursively its subtree, on the host.
+ * The node samples are kept in memory: features are computed with the host feature, the
+ * best feature/threshold pair is searched as done by the OpenCL path and the samples are
+ * partitioned among two child tasks.
+ */
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+class CPUSubtreeTask: public WorkStealingTask
+{
+private:
+  CPUSubtreeContext<ImgType, nChannels, FeatType, FeatDim, nClasses> *m_context;
+  unsigned int m_nodeID;
+  unsigned int m_depth;
+  std::vector<CPUSubtreeSample> m_samples;
+
+  void _computeResponses(const FeatType *feature, FeatType *responses) const;
+  void _searchRandomThresholds(const unsigned int *totHistogram, unsigned int &bestFeature,
+			       FeatType &bestThreshold, float &bestGain,
+			       unsigned int *bestLeftHistogram) const;
+  template <SplitCriterion criterion>
+  void _searchExact(const unsigned int *totHistogram, unsigned int &bestFeature,
+		    FeatType &bestThreshold, float &bestGain,
+		    unsigned int *bestLeftHistogram) const;
+public:
+  /*!
+   * \param context Data shared by all the tasks
+   * \param nodeID The node to train
+   * \param depth The node depth
+   * \param samples The node samples (swapped into the task)
+   */
+  CPUSubtreeTask(CPUSubtreeContext<ImgType, nChannels, FeatType, FeatDim, nClasses> *context,
+		 unsigned int nodeID, unsigned int depth, std::vector<CPUSubtreeSample> &samples);
+  void run(WorkStealingPool &pool, unsigned int workerID);
+};
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+CPUSubtreeTask<ImgType, nChannels, FeatType, FeatDim, nClasses>::CPUSubtreeTask(
+  CPUSubtreeContext<ImgType, nChannels, FeatType, FeatDim, nClasses> *context,
+  unsigned int nodeID, unsigned int depth, std::vector<CPUSubtreeSample> &samples):
+  m_context(context), m_nodeID(nodeID), m_depth(depth)
+{
+  m_samples.swap(samples);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUSubtreeTask<ImgType, nChannels, FeatType, FeatDim, nClasses>::_computeResponses(
+  const FeatType *feature, FeatType *responses) const
+{
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &images =
+    m_context->trainingSet->getImages();
+
+  for (unsigned int s=0; s<m_samples.size(); s++)
+  {
+    const TrainingSetImage<ImgType, nChannels> &image = images[m_samples[s].image];
+    unsigned int pixel = m_samples[s].pixel;
+    responses[s] = m_context->hostFeature->compute(image, pixel%image.getWidth(),
+						   pixel/image.getWidth(), feature);
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUSubtreeTask<ImgType, nChannels, FeatType, FeatDim, nClasses>::_searchRandomThresholds(
+  const unsigned int *totHistogram, unsigned int &bestFeature, FeatType &bestThreshold,
+  float &bestGain, unsigned int *bestLeftHistogram) const
+{
+  const TreeTrainerParameters<FeatType, FeatDim> &params = m_context->params;
+  unsigned int nSamples = m_samples.size();
+  unsigned int bestPair = UINT_MAX;
+  std::vector<FeatType> responses(nSamples), thresholds(params.nThresholds);
+  std::vector<unsigned int> histogram(nClasses*params.nThresholds), nLeft(params.nThresholds);
+  std::vector<float> gains(params.nThresholds);
+  const unsigned int *leftRows[nClasses];
+  FeatType feature[FeatDim];
+
+  for (unsigned int l=0; l<nClasses; l++) leftRows[l] = &histogram[l*params.nThresholds];
+
+  for (unsigned int f=0; f<params.nFeatures; f++)
+  {
+    _generateNodeFeature(m_context->prngRand, params, m_context->treeID, m_nodeID, f, feature);
+    _generateNodeThresholds(m_context->prngRand, params, m_context->treeID, m_nodeID, f,
+			    &thresholds[0]);
+    _computeResponses(feature, &responses[0]);
+
+    // Per-bin counts, then per-threshold left child counts by prefix sum (as the OpenCL
+    // path does), i.e. histogram[l][t] samples of class l with response <= thresholds[t]
+    std::fill(histogram.begin(), histogram.end(), 0);
+    for (unsigned int s=0; s<nSamples; s++)
+    {
+      unsigned int bin = std::lower_bound(thresholds.begin(), thresholds.end(), responses[s]) -
+	thresholds.begin();
+      if (bin<params.nThresholds) histogram[m_samples[s].label*params.nThresholds+bin]++;
+    }
+    for (unsigned int l=0; l<nClasses; l++)
+    {
+      for (unsigned int t=1; t<params.nThresholds; t++)
+      {
+	histogram[l*params.nThresholds+t] += histogram[l*params.nThresholds+t-1];
+      }
+    }
+
+    m_context->splitGainRow(leftRows, totHistogram, nClasses, nSamples, m_context->nLog2n,
+			    &nLeft[0], &gains[0], params.nThresholds);
+    maskSmallChildSplits(&nLeft[0], nSamples, params.minChildSamples, &gains[0],
+			 params.nThresholds);
+
+    // Ties are broken in favour of the lowest pair index (thrID*nFeatures+featureID), as
+    // in the learnBestFeature kernel
+    for (unsigned int t=0; t<params.nThresholds; t++)
+    {
+      unsigned int pair = t*params.nFeatures+f;
+      if (gains[t]>bestGain || (gains[t]==bestGain && pair<bestPair))
+      {
+	bestGain = gains[t];
+	bestPair = pair;
+	bestFeature = f;
+	bestThreshold = thresholds[t];
+	for (unsigned int l=0; l<nClasses; l++) bestLeftHistogram[l] = leftRows[l][t];
+      }
+    }
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+template <SplitCriterion criterion>
+void CPUSubtreeTask<ImgType, nChannels, FeatType, FeatDim, nClasses>::_searchExact(
+  const unsigned int *totHistogram, unsigned int &bestFeature, FeatType &bestThreshold,
+  float &bestGain, unsigned int *bestLeftHistogram) const
+{
+  const TreeTrainerParameters<FeatType, FeatDim> &params = m_context->params;
+  unsigned int nSamples = m_samples.size();
+  std::vector<FeatType> responses(nSamples);
+  std::vector<std::pair<FeatType, unsigned char> > sortedResponses(nSamples);
+  FeatType feature[FeatDim];
+
+  for (unsigned int f=0; f<params.nFeatures; f++)
+  {
+    _generateNodeFeature(m_context->prngRand, params, m_context->treeID, m_nodeID, f, feature);
+    _computeResponses(feature, &responses[0]);
+    for (unsigned int s=0; s<nSamples; s++)
+    {
+      sortedResponses[s] = std::make_pair(responses[s], m_samples[s].label);
+    }
+    searchExactSplit<criterion>(sortedResponses, totHistogram, nClasses, m_context->nLog2n,
+				params.minChildSamples, f, bestGain, bestFeature, bestThreshold,
+				bestLeftHistogram);
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUSubtreeTask<ImgType, nChannels, FeatType, FeatDim, nClasses>::run(
+  WorkStealingPool &pool, unsigned int workerID)
+{
+  const TreeTrainerParameters<FeatType, FeatDim> &params = m_context->params;
+  unsigned int nSamples = m_samples.size();
+  unsigned int totHistogram[nClasses];
+
+  std::fill_n(totHistogram, nClasses, 0);
+  for (unsigned int s=0; s<nSamples; s++) totHistogram[m_samples[s].label]++;
+
+  // Stop criteria shared with the other paths (see node_training.hpp)
+  if (m_depth>=m_context->endDepth || nSamples<=params.perLeafSamplesThr) return;
+  if (_isPureNode(params, nClasses, &nSamples, totHistogram, 0)) return;
+
+  unsigned int bestFeature = 0;
+  FeatType bestThreshold = 0;
+  float bestGain = -1.0f;
+  unsigned int leftHistogram[nClasses];
+  if (params.randomThrSampling)
+  {
+    _searchRandomThresholds(totHistogram, bestFeature, bestThreshold, bestGain, leftHistogram);
+  }
+  else
+  {
+    switch (params.splitCriterion)
+    {
+    case SPLIT_CRITERION_GINI:
+      _searchExact<SPLIT_CRITERION_GINI>(totHistogram, bestFeature, bestThreshold, bestGain,
+					 leftHistogram);
+      break;
+    case SPLIT_CRITERION_GAIN_RATIO:
+      _searchExact<SPLIT_CRITERION_GAIN_RATIO>(totHistogram, bestFeature, bestThreshold,
+					       bestGain, leftHistogram);
+      break;
+    default:
+      _searchExact<SPLIT_CRITERION_ENTROPY>(totHistogram, bestFeature, bestThreshold, bestGain,
+					    leftHistogram);
+      break;
+    }
+  }
+  if (bestGain<0.0f) return;
+
+  unsigned int lSum=0, rSum=0;
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    lSum += leftHistogram[l];
+    rSum += totHistogram[l]-leftHistogram[l];
+  }
+  if (!_isValidSplit(params, lSum, rSum, bestGain)) return;
+
+  // Record the split
+  CPUSubtreeSplit<FeatType, FeatDim, nClasses> split;
+  split.nodeID = m_nodeID;
+  _generateNodeFeature(m_context->prngRand, params, m_context->treeID, m_nodeID, bestFeature,
+		       split.feature);
+  split.threshold = bestThreshold;
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    split.leftPosterior[l] = ((float)leftHistogram[l])/lSum;
+    split.rightPosterior[l] = ((float)(totHistogram[l]-leftHistogram[l]))/rSum;
+  }
+  m_context->splits[workerID].push_back(split);
+
+  // Partition the samples and train the children (left child is popped first by this
+  // worker, right child may be stolen)
+  std::vector<FeatType> responses(nSamples);
+  std::vector<CPUSubtreeSample> leftSamples, rightSamples;
+  _computeResponses(split.feature, &responses[0]);
+  leftSamples.reserve(lSum);
+  rightSamples.reserve(rSum);
+  for (unsigned int s=0; s<nSamples; s++)
+  {
+    if (responses[s]<=bestThreshold) leftSamples.push_back(m_samples[s]);
+    else rightSamples.push_back(m_samples[s]);
+  }
+  std::vector<CPUSubtreeSample>().swap(m_samples);
+
+  if (m_depth+1<m_context->endDepth)
+  {
+    if (rightSamples.size()>params.perLeafSamplesThr)
+    {
+      pool.submit(new CPUSubtreeTask(m_context, m_nodeID*2+2, m_depth+1, rightSamples),
+		  workerID);
+    }
+    if (leftSamples.size()>params.perLeafSamplesThr)
+    {
+      pool.submit(new CPUSubtreeTask(m_context, m_nodeID*2+1, m_depth+1, leftSamples),
+		  workerID);
+    }
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_handOffCPUSubtrees(
+  Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  const std::vector<int> &roots, bool useSkippedTsImg)
+{
+  if (roots.empty()) return;
+
+  boost::unordered_map<int, unsigned int> rootIdxMap;
+  for (unsigned int r=0; r<roots.size(); r++) rootIdxMap[roots[r]] = r;
+
+  // Route the training set samples down to the roots on the host: handed off nodes are
+  // leaves of the tree trained so far, hence samples stop there
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &images = trainingSet.getImages();
+  std::vector<std::vector<std::vector<CPUSubtreeSample> > > perThreadSamples;
+  #pragma omp parallel
+  {
+    #pragma omp single
+    {
+#ifdef _OPENMP
+      perThreadSamples.resize(omp_get_num_threads());
+#else
+      perThreadSamples.resize(1);
+#endif // _OPENMP
+    }
+#ifdef _OPENMP
+    std::vector<std::vector<CPUSubtreeSample> > &samples = perThreadSamples[omp_get_thread_num()];
+#else
+    std::vector<std::vector<CPUSubtreeSample> > &samples = perThreadSamples[0];
+#endif // _OPENMP
+    samples.resize(roots.size());
+
+    #pragma omp for schedule(dynamic)
+    for (int i=0; i<(int)images.size(); i++)
+    {
+      // Images skipped at the previous depth have all their samples in leaves
+      if (useSkippedTsImg && m_skippedTsImg[i]) continue;
+
+      const TrainingSetImage<ImgType, nChannels> &image = images[i];
+      for (unsigned int s=0; s<image.getNSamples(); s++)
+      {
+	CPUSubtreeSample sample;
+	sample.image = i;
+	sample.pixel = image.getSamples()[s];
+	sample.label = image.getLabels()[sample.pixel]-1;
+
+	unsigned int x = sample.pixel%image.getWidth(), y = sample.pixel/image.getWidth();
+	int nodeID = 0;
+	while (*tree.getNode(nodeID).m_leftChild!=-1)
+	{
+	  const TreeNode<FeatType, FeatDim> &node = tree.getNode(nodeID);
+	  FeatType response = m_hostFeature->compute(image, x, y, node.m_feature);
+	  nodeID = *node.m_leftChild + ((response<=*node.m_threshold) ? 0 : 1);
+	}
+
+	boost::unordered_map<int, unsigned int>::const_iterator it = rootIdxMap.find(nodeID);
+	if (it!=rootIdxMap.end()) samples[it->second].push_back(sample);
+      }
+    }
+  }
+
+  // Merge per-thread samples and start the subtrees (node IDs at depth d are in
+  // [2^(d-1)-1, 2^d-2])
+  for (unsigned int r=0; r<roots.size(); r++)
+  {
+    unsigned int rootDepth = 1;
+    while ((2<<(rootDepth-1))-1<=roots[r]) rootDepth++;
+
+    std::vector<CPUSubtreeSample> rootSamples;
+    for (unsigned int t=0; t<perThreadSamples.size(); t++)
+    {
+      rootSamples.insert(rootSamples.end(), perThreadSamples[t][r].begin(),
+			 perThreadSamples[t][r].end());
+      std::vector<CPUSubtreeSample>().swap(perThreadSamples[t][r]);
+    }
+    m_cpuPool->submit(new CPUSubtreeTask<ImgType, nChannels, FeatType, FeatDim, nClasses>(
+			m_cpuContext, roots[r], rootDepth, rootSamples));
+    m_pendingCPUSubtreeRoots.push_back(roots[r]);
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_commitCPUSubtrees(
+  Tree<FeatType, FeatDim, nClasses> &tree)
+{
+  TraceScope traceScope(m_tracer, "commitCPUSubtrees", "train");
+  if (!m_cpuPool) return;
+  m_cpuPool->wait();
+
+  for (unsigned int w=0; w<m_cpuContext->splits.size(); w++)
+  {
+    const std::vector<CPUSubtreeSplit<FeatType, FeatDim, nClasses> > &splits =
+      m_cpuContext->splits[w];
+    for (unsigned int i=0; i<splits.size(); i++)
+    {
+      const CPUSubtreeSplit<FeatType, FeatDim, nClasses> &split = splits[i];
+      const TreeNode<FeatType, FeatDim> &currNode = tree.getNode(split.nodeID);
+      const TreeNode<FeatType, FeatDim> &leftChildNode = tree.getNode(split.nodeID*2+1);
+      const TreeNode<FeatType, FeatDim> &rightChildNode = tree.getNode(split.nodeID*2+2);
+
+      std::copy(split.feature, split.feature+FeatDim, currNode.m_feature);
+      *currNode.m_threshold = split.threshold;
+      *currNode.m_leftChild = split.nodeID*2+1;
+      std::copy(split.leftPosterior, split.leftPosterior+nClasses, leftChildNode.m_posterior);
+      std::copy(split.rightPosterior, split.rightPosterior+nClasses, rightChildNode.m_posterior);
+      *leftChildNode.m_leftChild = -1;
+      *rightChildNode.m_leftChild = -1;
+    }
+    m_cpuContext->splits[w].clear();
+  }
+  m_pendingCPUSubtreeRoots.clear();
+}
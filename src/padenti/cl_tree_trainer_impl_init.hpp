@@ -16,6 +16,8 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  ******************************************************************************/
+#include <algorithm>
+#include <utility>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 
@@ -27,26 +29,48 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
   const TreeTrainerParameters<FeatType, FeatDim> &params,
   unsigned int startDepth, unsigned int endDepth)
 {
+  TraceScope traceScope(m_tracer, "initTrain", "train");
   unsigned int nNodes = (2<<(endDepth-1))-1;
   cl_int errCode;
 
+  // Per-image histograms store a (byte) threshold bin index per sample/feature
+  if (params.randomThrSampling && params.nThresholds>UCHAR_MAX)
+  {
+    throw "Number of thresholds must be lower than 256";
+  }
+
+  // Data-parallel training reduces node histograms, hence thresholds must be sampled (exact
+  // split search works on per-sample responses) and all the nodes trained by the processes
+  if (m_communicator)
+  {
+    if (!params.randomThrSampling)
+    {
+      throw "Data-parallel training requires random thresholds sampling";
+    }
+    if (m_hostFeature && m_internalParams.cpuSubtreeMaxSamples)
+    {
+      throw "Data-parallel training does not support CPU subtrees";
+    }
+  }
+
   // Init OpenCL tree buffers and load corresponding data
-  m_clTreeLeftChildBuff = cl::Buffer(m_clContext,
-				     CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-				     nNodes*sizeof(cl_uint),
-				     (void*)tree.getLeftChildren());
-  m_clTreeFeaturesBuff = cl::Buffer(m_clContext,
-				    CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-				    nNodes*sizeof(FeatType)*FeatDim,
-				    (void*)tree.getFeatures());
-  m_clTreeThrsBuff = cl::Buffer(m_clContext,
-				CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-				nNodes*sizeof(FeatType),
+  // Note: device objects come from the buffer pool, i.e. they are reused across trainings
+  // with compatible shapes. Writes are serialized by the in-order queue, the last one is
+  // blocking since buffers are used by the other pipeline queues as well
+  m_clTreeLeftChildBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY, nNodes*sizeof(cl_uint));
+  m_clTreeFeaturesBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY,
+						      nNodes*sizeof(FeatType)*FeatDim);
+  m_clTreeThrsBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY, nNodes*sizeof(FeatType));
+  m_clTreePosteriorsBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY,
+							nNodes*sizeof(cl_float)*nClasses);
+  m_clQueue1.enqueueWriteBuffer(m_clTreeLeftChildBuff, CL_FALSE, 0, nNodes*sizeof(cl_uint),
+				(void*)tree.getLeftChildren());
+  m_clQueue1.enqueueWriteBuffer(m_clTreeFeaturesBuff, CL_FALSE, 0,
+				nNodes*sizeof(FeatType)*FeatDim, (void*)tree.getFeatures());
+  m_clQueue1.enqueueWriteBuffer(m_clTreeThrsBuff, CL_FALSE, 0, nNodes*sizeof(FeatType),
 				(void*)tree.getThresholds());
-  m_clTreePosteriorsBuff = cl::Buffer(m_clContext,
-				      CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-				      nNodes*sizeof(cl_float)*nClasses,
-				      (void*)tree.getPosteriors());
+  m_clQueue1.enqueueWriteBuffer(m_clTreePosteriorsBuff, CL_TRUE, 0,
+				nNodes*sizeof(cl_float)*nClasses, (void*)tree.getPosteriors());
 
   // Init per-node total and per-class number of samples
   m_perNodeTotSamples = new unsigned int[nNodes];
@@ -81,6 +105,10 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
     /** \todo update here total number of pixel per class at root node */
     m_perNodeTotSamples[0]+=currImage.getNSamples();
   }
+  if (m_communicator) m_communicator->allReduceSum(m_perNodeTotSamples, 1);
+
+  // Host split scores table: no node can be reached by more samples than the root
+  fillNLog2NTable(m_nLog2nTable, m_perNodeTotSamples[0]);
 
   // Make the maximum width and height a multiple of the, respectively, work-group x and y
   // dimension
@@ -89,7 +117,10 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
   m_maxTsImgWidth += (m_maxTsImgWidth%16) ? 16-(m_maxTsImgWidth%16) : 0;
   m_maxTsImgHeight += (m_maxTsImgHeight%16) ? 16-(m_maxTsImgHeight%16) : 0;
 
-  // - initialize OpenCL images
+  // - initialize OpenCL images: each pipeline slot has its own set of device objects
+  //   and its own portion of pinned staging memory
+  unsigned int nPipelineSlots = m_clPipelineQueues.size();
+  unsigned int fifoSize = m_internalParams.histogramFifoSize;
   cl::size_t<3> origin, region;
   size_t rowPitch;
   origin[0]=0; origin[1]=0; origin[2]=0;
@@ -98,107 +129,99 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
 
   cl::ImageFormat clTsImgFormat;
   ImgTypeTrait<ImgType, nChannels>::toCLImgFmt(clTsImgFormat);
-  if (nChannels<=4)
+  void *mapped;
+  m_clTsImg.resize(nPipelineSlots);
+  for (unsigned int p=0; p<nPipelineSlots; p++)
   {
-    m_clTsImg1 = new cl::Image2D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				 m_maxTsImgWidth, m_maxTsImgHeight);
-    m_clTsImg2 = new cl::Image2D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				 m_maxTsImgWidth, m_maxTsImgHeight);
-  }
-  else
-  {
-    m_clTsImg1 = new cl::Image3D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				 m_maxTsImgWidth, m_maxTsImgHeight, nChannels);
-    m_clTsImg2 = new cl::Image3D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				 m_maxTsImgWidth, m_maxTsImgHeight, nChannels);
+    if (nChannels<=4)
+    {
+      m_clTsImg[p] = new cl::Image2D(m_clBufferPool.acquireImage2D(CL_MEM_READ_ONLY, clTsImgFormat,
+								   m_maxTsImgWidth,
+								   m_maxTsImgHeight));
+    }
+    else
+    {
+      m_clTsImg[p] = new cl::Image3D(m_clBufferPool.acquireImage3D(CL_MEM_READ_ONLY, clTsImgFormat,
+								   m_maxTsImgWidth,
+								   m_maxTsImgHeight, nChannels));
+    }
   }
-  m_clTsImgPinn = cl::Buffer(m_clContext,
-			     CL_MEM_READ_ONLY|CL_MEM_ALLOC_HOST_PTR,
-			     m_maxTsImgWidth*m_maxTsImgHeight*nChannels*sizeof(ImgType)*2);
-  m_clTsImgPinnPtr = 
-    reinterpret_cast<ImgType*>(m_clQueue1.enqueueMapBuffer(m_clTsImgPinn, CL_TRUE,
-							   CL_MAP_WRITE,
-							   0, m_maxTsImgWidth*m_maxTsImgHeight*nChannels*sizeof(ImgType)*2));
+  m_clTsImgPinn = m_clBufferPool.acquirePinnedBuffer(m_clQueue1, CL_MEM_READ_ONLY, CL_MAP_WRITE,
+							  m_maxTsImgWidth*m_maxTsImgHeight*nChannels*sizeof(ImgType)*nPipelineSlots,
+							  mapped);
+  m_clTsImgPinnPtr = reinterpret_cast<ImgType*>(mapped);
 
   clTsImgFormat.image_channel_order = CL_R;
   clTsImgFormat.image_channel_data_type = CL_UNSIGNED_INT8;
   region[2] = 1;
-  m_clTsLabelsImg1 = cl::Image2D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				 m_maxTsImgWidth, m_maxTsImgHeight);
-  m_clTsLabelsImg2 = cl::Image2D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				 m_maxTsImgWidth, m_maxTsImgHeight);
-  m_clTsLabelsImgPinn = cl::Buffer(m_clContext,
-				   CL_MEM_READ_ONLY|CL_MEM_ALLOC_HOST_PTR,
-				   m_maxTsImgWidth*m_maxTsImgHeight*sizeof(cl_uchar)*2);
-  m_clTsLabelsImgPinnPtr = 
-    reinterpret_cast<unsigned char*>(m_clQueue1.enqueueMapBuffer(m_clTsLabelsImgPinn, CL_TRUE,
-								 CL_MAP_WRITE,
-								 0, m_maxTsImgWidth*m_maxTsImgHeight*sizeof(cl_uchar)*2));
+  m_clTsLabelsImg.clear();
+  for (unsigned int p=0; p<nPipelineSlots; p++)
+  {
+    m_clTsLabelsImg.push_back(m_clBufferPool.acquireImage2D(CL_MEM_READ_ONLY, clTsImgFormat,
+							     m_maxTsImgWidth, m_maxTsImgHeight));
+  }
+  m_clTsLabelsImgPinn = m_clBufferPool.acquirePinnedBuffer(m_clQueue1, CL_MEM_READ_ONLY, CL_MAP_WRITE,
+							  m_maxTsImgWidth*m_maxTsImgHeight*sizeof(cl_uchar)*nPipelineSlots,
+							  mapped);
+  m_clTsLabelsImgPinnPtr = reinterpret_cast<unsigned char*>(mapped);
 
   clTsImgFormat.image_channel_data_type = CL_SIGNED_INT32;
-  m_clTsNodesIDImg1 = cl::Image2D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				  m_maxTsImgWidth, m_maxTsImgHeight);
-  m_clTsNodesIDImg2 = cl::Image2D(m_clContext, CL_MEM_READ_ONLY, clTsImgFormat,
-				  m_maxTsImgWidth, m_maxTsImgHeight);
-  m_clTsNodesIDImgPinn = cl::Buffer(m_clContext,
-				     CL_MEM_READ_ONLY|CL_MEM_ALLOC_HOST_PTR,
-				     m_maxTsImgWidth*m_maxTsImgHeight*sizeof(cl_uint)*GLOBAL_HISTOGRAM_FIFO_SIZE);
-  m_clTsNodesIDImgPinnPtr =
-    reinterpret_cast<int*>(m_clQueue1.enqueueMapBuffer(m_clTsNodesIDImgPinn, CL_TRUE,
-						       CL_MAP_READ|CL_MAP_WRITE,
-						       0, m_maxTsImgWidth*m_maxTsImgHeight*sizeof(cl_uint)*GLOBAL_HISTOGRAM_FIFO_SIZE));
-
-  m_clPredictImg1 = cl::Image2D(m_clContext, CL_MEM_WRITE_ONLY, clTsImgFormat,
-				m_maxTsImgWidth, m_maxTsImgHeight);
-  m_clPredictImg2 = cl::Image2D(m_clContext, CL_MEM_WRITE_ONLY, clTsImgFormat,
-				m_maxTsImgWidth, m_maxTsImgHeight);
+  m_clTsNodesIDImg.clear();
+  m_clPredictImg.clear();
+  for (unsigned int p=0; p<nPipelineSlots; p++)
+  {
+    m_clTsNodesIDImg.push_back(m_clBufferPool.acquireImage2D(CL_MEM_READ_ONLY, clTsImgFormat,
+							     m_maxTsImgWidth, m_maxTsImgHeight));
+    m_clPredictImg.push_back(m_clBufferPool.acquireImage2D(CL_MEM_WRITE_ONLY, clTsImgFormat,
+							   m_maxTsImgWidth, m_maxTsImgHeight));
+  }
+  m_clTsNodesIDImgPinn = m_clBufferPool.acquirePinnedBuffer(m_clQueue1, CL_MEM_READ_ONLY, CL_MAP_READ|CL_MAP_WRITE,
+							  m_maxTsImgWidth*m_maxTsImgHeight*sizeof(cl_uint)*fifoSize,
+							  mapped);
+  m_clTsNodesIDImgPinnPtr = reinterpret_cast<int*>(mapped);
   
   // Init OpenCL buffers for per-image histogram computation
   FeatType *tmpFeatLowBounds = new FeatType[FeatDim];
   FeatType *tmpFeatUpBounds = new FeatType[FeatDim];
   std::copy(params.featLowBounds, params.featLowBounds+FeatDim, tmpFeatLowBounds);
   std::copy(params.featUpBounds, params.featUpBounds+FeatDim, tmpFeatUpBounds);
-  m_clFeatLowBoundsBuff = cl::Buffer(m_clContext,
-				     CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-				     FeatDim*sizeof(FeatType),
-				     (void*)tmpFeatLowBounds);
-  m_clFeatUpBoundsBuff = cl::Buffer(m_clContext,
-				    CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-				    FeatDim*sizeof(FeatType),
-				    (void*)tmpFeatUpBounds);
-
-  m_clTsSamplesBuff1 = cl::Buffer(m_clContext,
-				  CL_MEM_READ_ONLY,
-				  m_maxTsImgSamples*sizeof(cl_uint));
-  m_clTsSamplesBuff2 = cl::Buffer(m_clContext,
-				  CL_MEM_READ_ONLY,
-				  m_maxTsImgSamples*sizeof(cl_uint));
-  m_clTsSamplesBuffPinn = cl::Buffer(m_clContext,
-				     CL_MEM_READ_ONLY|CL_MEM_ALLOC_HOST_PTR,
-				     m_maxTsImgSamples*sizeof(cl_uint)*2);
-  m_clTsSamplesBuffPinnPtr =
-    reinterpret_cast<unsigned int*>(m_clQueue1.enqueueMapBuffer(m_clTsSamplesBuffPinn, CL_TRUE,
-								CL_MAP_WRITE,
-								0, m_maxTsImgSamples*sizeof(cl_uint)*2));
+  m_clFeatLowBoundsBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY, FeatDim*sizeof(FeatType));
+  m_clFeatUpBoundsBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY, FeatDim*sizeof(FeatType));
+  m_clQueue1.enqueueWriteBuffer(m_clFeatLowBoundsBuff, CL_FALSE, 0, FeatDim*sizeof(FeatType),
+				(void*)tmpFeatLowBounds);
+  m_clQueue1.enqueueWriteBuffer(m_clFeatUpBoundsBuff, CL_TRUE, 0, FeatDim*sizeof(FeatType),
+				(void*)tmpFeatUpBounds);
+
+  m_clTsSamplesBuff.clear();
+  for (unsigned int p=0; p<nPipelineSlots; p++)
+  {
+    m_clTsSamplesBuff.push_back(m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY,
+							     m_maxTsImgSamples*sizeof(cl_uint)));
+  }
+  m_clTsSamplesBuffPinn = m_clBufferPool.acquirePinnedBuffer(m_clQueue1, CL_MEM_READ_ONLY, CL_MAP_WRITE,
+							  m_maxTsImgSamples*sizeof(cl_uint)*nPipelineSlots,
+							  mapped);
+  m_clTsSamplesBuffPinnPtr = reinterpret_cast<unsigned int*>(mapped);
 
   
   // Note:
   // - 4D Historam (sample-ID, feature, class, threshold) can be compressed to 3D since we can access
   //   the sample class from labels image
-  size_t perImgHistogramSize = m_maxTsImgSamples*params.nFeatures*params.nThresholds;
-  m_clPerImgHistBuff1 = cl::Buffer(m_clContext,
-				   CL_MEM_WRITE_ONLY,
-				   perImgHistogramSize*sizeof(cl_uchar));
-  m_clPerImgHistBuff2 = cl::Buffer(m_clContext,
-				   CL_MEM_WRITE_ONLY,
-				   perImgHistogramSize*sizeof(cl_uchar));
-  m_clPerImgHistBuffPinn = cl::Buffer(m_clContext,
-				      CL_MEM_WRITE_ONLY|CL_MEM_ALLOC_HOST_PTR,
-				      perImgHistogramSize*sizeof(cl_uchar)*GLOBAL_HISTOGRAM_FIFO_SIZE);
-  m_clPerImgHistBuffPinnPtr =
-    reinterpret_cast<unsigned char*>(m_clQueue1.enqueueMapBuffer(m_clPerImgHistBuffPinn, CL_TRUE,
-								 CL_MAP_READ,
-								 0, perImgHistogramSize*sizeof(cl_uchar)*GLOBAL_HISTOGRAM_FIFO_SIZE));
+  // - the threshold dimension is further compressed into a single bin index since per-feature
+  //   thresholds are sorted
+  // - with exact split search, raw feature responses are stored instead
+  size_t perImgHistogramSize = m_maxTsImgSamples*params.nFeatures*
+    ((params.randomThrSampling) ? sizeof(cl_uchar) : sizeof(FeatType));
+  m_clPerImgHistBuff.clear();
+  for (unsigned int p=0; p<nPipelineSlots; p++)
+  {
+    m_clPerImgHistBuff.push_back(m_clBufferPool.acquireBuffer(CL_MEM_WRITE_ONLY,
+							      perImgHistogramSize*sizeof(cl_uchar)));
+  }
+  m_clPerImgHistBuffPinn = m_clBufferPool.acquirePinnedBuffer(m_clQueue1, CL_MEM_WRITE_ONLY, CL_MAP_READ,
+							  perImgHistogramSize*sizeof(cl_uchar)*fifoSize,
+							  mapped);
+  m_clPerImgHistBuffPinnPtr = reinterpret_cast<unsigned char*>(mapped);
 
 
   // Init buffers used for best per-node feature/threshold pair learning
@@ -212,22 +235,42 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
   unsigned int perThreadFeatThrPairs = PER_THREAD_FEAT_THR_PAIRS;
   unsigned int parLearntNodes = (maxFrontierSize>PARALLEL_LEARNT_NODES) ? 
     PARALLEL_LEARNT_NODES : maxFrontierSize;
-  size_t learnBuffsSize = parLearntNodes*(params.nFeatures*params.nThresholds)/perThreadFeatThrPairs;
-  m_clHistogramBuff = cl::Buffer(m_clContext,
-				 CL_MEM_READ_ONLY,
-				 parLearntNodes*perNodeHistogramSize*sizeof(cl_uint));
-  m_clBestFeaturesBuff = cl::Buffer(m_clContext,
-				    CL_MEM_WRITE_ONLY,
-				    learnBuffsSize*sizeof(cl_uint));
-  m_clBestThresholdsBuff = cl::Buffer(m_clContext,
-				      CL_MEM_WRITE_ONLY,
-				      learnBuffsSize*sizeof(cl_uint));
-  m_clBestEntropiesBuff = cl::Buffer(m_clContext,
-				     CL_MEM_WRITE_ONLY,
-				     learnBuffsSize*sizeof(cl_float));
-  m_clPerClassTotSamplesBuff = cl::Buffer(m_clContext,
-					  CL_MEM_READ_ONLY,
-					  parLearntNodes*nClasses*sizeof(cl_uint));
+  // Note: feature/threshold pairs are reduced on the device, first to one candidate per
+  // work-group, then to the best one per node
+  unsigned int learnGroupsPerNode =
+    (params.nFeatures*params.nThresholds+perThreadFeatThrPairs*WG_LEARN_BEST_FEAT-1)/
+    (perThreadFeatThrPairs*WG_LEARN_BEST_FEAT);
+  size_t learnBuffsSize = parLearntNodes;
+  // Note: with exact split search, the global histogram is not used and best
+  // features/thresholds are learnt on the host
+  if (params.randomThrSampling)
+  {
+    m_clHistogramBuff.clear();
+    m_clPerClassTotSamplesBuff.clear();
+    for (unsigned int b=0; b<2; b++)
+    {
+      m_clHistogramBuff.push_back(m_clBufferPool.acquireBuffer(
+	CL_MEM_READ_ONLY, parLearntNodes*perNodeHistogramSize*sizeof(cl_uint)));
+      m_clPerClassTotSamplesBuff.push_back(m_clBufferPool.acquireBuffer(
+	CL_MEM_READ_ONLY, parLearntNodes*nClasses*sizeof(cl_uint)));
+    }
+    m_clGroupBestPairsBuff = m_clBufferPool.acquireBuffer(
+      CL_MEM_READ_WRITE, parLearntNodes*learnGroupsPerNode*sizeof(cl_uint));
+    m_clGroupBestEntropiesBuff = m_clBufferPool.acquireBuffer(
+      CL_MEM_READ_WRITE, parLearntNodes*learnGroupsPerNode*sizeof(cl_float));
+    m_clBestFeaturesBuff.clear();
+    m_clBestThresholdsBuff.clear();
+    m_clBestEntropiesBuff.clear();
+    for (unsigned int b=0; b<2; b++)
+    {
+      m_clBestFeaturesBuff.push_back(m_clBufferPool.acquireBuffer(CL_MEM_WRITE_ONLY,
+								  learnBuffsSize*sizeof(cl_uint)));
+      m_clBestThresholdsBuff.push_back(m_clBufferPool.acquireBuffer(CL_MEM_WRITE_ONLY,
+								    learnBuffsSize*sizeof(cl_uint)));
+      m_clBestEntropiesBuff.push_back(m_clBufferPool.acquireBuffer(CL_MEM_WRITE_ONLY,
+								   learnBuffsSize*sizeof(cl_float)));
+    }
+  }
 				    
   // Set kernels arguments that does not change between calls:
   // - prediction
@@ -246,45 +289,69 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
   //m_clPredictKern.setArg(12, cl::Local(sizeof(FeatType)*WG_WIDTH*WG_HEIGHT*FeatDim));
   m_clPredictKern.setArg(12, cl::Local(sizeof(FeatType)*256*FeatDim));
 
-  // - per-image histogram update
+  // - per-image histogram update (or per-image responses computation with exact split search,
+  //   both kernels share the same signature)
+  m_clPerImgHistKern = cl::Kernel(m_clHistUpdateProg, (params.randomThrSampling) ?
+				  "computePerImageHistogram" : "computePerImageResponses");
   //m_clPerImgHistKern.setArg(0, m_clTsImg);
   m_clPerImgHistKern.setArg(1, nChannels);
   //m_clPerImgHistKern.setArg(4, m_clTsLabelsImg);
   //m_clPerImgHistKern.setArg(5, m_clTsNodesIDImg);
   //m_clPerImgHistKern.setArg(6, m_clTsSamplesBuff);
   m_clPerImgHistKern.setArg(8, FeatDim);
-  m_clPerImgHistKern.setArg(9, m_clFeatLowBoundsBuff);
-  m_clPerImgHistKern.setArg(10, m_clFeatUpBoundsBuff);
-  m_clPerImgHistKern.setArg(11, params.nThresholds);
-  m_clPerImgHistKern.setArg(12, params.thrLowBound);
-  m_clPerImgHistKern.setArg(13, params.thrUpBound);
-  //m_clPerImgHistKern.setArg(14, m_clPerImgHistBuff);
-  m_clPerImgHistKern.setArg(15, tree.getID());
-  m_clPerImgHistKern.setArg(18, m_clTreeLeftChildBuff);
-  m_clPerImgHistKern.setArg(19, m_clTreePosteriorsBuff);
-  m_clPerImgHistKern.setArg(20, cl::Local(sizeof(FeatType)*8));
-  //m_clPerImgHistKern.setArg(21, cl::Local(sizeof(FeatType)*WG_WIDTH*WG_HEIGHT*FeatDim));
-  m_clPerImgHistKern.setArg(21, cl::Local(sizeof(FeatType)*256*FeatDim));
-
-  // - node's best feature/threshold learning
-  m_clLearnBestFeatKern.setArg(0, m_clHistogramBuff);
-  m_clLearnBestFeatKern.setArg(1, m_clPerClassTotSamplesBuff);
-  m_clLearnBestFeatKern.setArg(2, params.nFeatures);
-  m_clLearnBestFeatKern.setArg(3, params.nThresholds);
-  m_clLearnBestFeatKern.setArg(4, nClasses);
-  m_clLearnBestFeatKern.setArg(5, perThreadFeatThrPairs);
-  m_clLearnBestFeatKern.setArg(6, m_clBestFeaturesBuff);
-  m_clLearnBestFeatKern.setArg(7, m_clBestThresholdsBuff);
-  m_clLearnBestFeatKern.setArg(8, m_clBestEntropiesBuff);
+  //m_clPerImgHistKern.setArg(9, m_clFeatTableBuff);   // set once the tables are allocated
+  //m_clPerImgHistKern.setArg(10, m_clThrTableBuff);
+  //m_clPerImgHistKern.setArg(11, m_clNodeRowMapBuff);
+  m_clPerImgHistKern.setArg(12, params.nThresholds);
+  //m_clPerImgHistKern.setArg(13, m_clPerImgHistBuff);
+  m_clPerImgHistKern.setArg(16, m_clTreeLeftChildBuff);
+  m_clPerImgHistKern.setArg(17, m_clTreePosteriorsBuff);
+  //m_clPerImgHistKern.setArg(18, cl::Local(sizeof(FeatType)*WG_WIDTH*WG_HEIGHT*FeatDim));
+  m_clPerImgHistKern.setArg(18, cl::Local(sizeof(FeatType)*256*FeatDim));
+
+  // - per-slice features/thresholds generation
+  m_clFeatThrTablesKern.setArg(0, tree.getID());
+  m_clFeatThrTablesKern.setArg(2, FeatDim);
+  m_clFeatThrTablesKern.setArg(3, m_clFeatLowBoundsBuff);
+  m_clFeatThrTablesKern.setArg(4, m_clFeatUpBoundsBuff);
+  m_clFeatThrTablesKern.setArg(5, params.nThresholds);
+  m_clFeatThrTablesKern.setArg(6, params.thrLowBound);
+  m_clFeatThrTablesKern.setArg(7, params.thrUpBound);
+
+  // - learning
+  if (params.randomThrSampling)
+  {
+    _buildLearnProgram(params.splitCriterion);
+
+    //m_clLearnBestFeatKern.setArg(0, m_clHistogramBuff);
+    //m_clLearnBestFeatKern.setArg(1, m_clPerClassTotSamplesBuff);
+    m_clLearnBestFeatKern.setArg(2, params.nFeatures);
+    m_clLearnBestFeatKern.setArg(3, params.nThresholds);
+    m_clLearnBestFeatKern.setArg(4, nClasses);
+    m_clLearnBestFeatKern.setArg(5, perThreadFeatThrPairs);
+    m_clLearnBestFeatKern.setArg(6, m_clGroupBestPairsBuff);
+    m_clLearnBestFeatKern.setArg(7, m_clGroupBestEntropiesBuff);
+    m_clLearnBestFeatKern.setArg(8, cl::Local(sizeof(cl_uint)*WG_LEARN_BEST_FEAT));
+    m_clLearnBestFeatKern.setArg(9, cl::Local(sizeof(cl_float)*WG_LEARN_BEST_FEAT));
+    m_clLearnBestFeatKern.setArg(10, std::max(params.minChildSamples, 1u));
+
+    m_clReduceBestFeatKern.setArg(0, m_clGroupBestPairsBuff);
+    m_clReduceBestFeatKern.setArg(1, m_clGroupBestEntropiesBuff);
+    m_clReduceBestFeatKern.setArg(2, learnGroupsPerNode);
+    m_clReduceBestFeatKern.setArg(3, params.nFeatures);
+    // Note: result buffers (args 4-6) are set per batch, see _enqueueLearnBatch()
+    m_clReduceBestFeatKern.setArg(7, cl::Local(sizeof(cl_uint)*WG_LEARN_BEST_FEAT));
+    m_clReduceBestFeatKern.setArg(8, cl::Local(sizeof(cl_float)*WG_LEARN_BEST_FEAT));
+  }
 
 
   // Init corresponding host buffers
   /** \todo use mapping/unmapping to avoid device/host copy */
-  //m_tsNodesIDImg = new int[m_maxTsImgWidth*m_maxTsImgHeight*GLOBAL_HISTOGRAM_FIFO_SIZE];
-  //m_perImgHist = new unsigned char[perImgHistogramSize*GLOBAL_HISTOGRAM_FIFO_SIZE];
-  m_bestFeatures = new unsigned int[learnBuffsSize];
-  m_bestThresholds = new unsigned int[learnBuffsSize];
-  m_bestEntropies = new float[learnBuffsSize];
+  // Note: two batches (the uploaded/learnt one and the processed one) are kept at once
+  m_batchPerClassTotSamples = new unsigned int[2*learnBuffsSize*nClasses];
+  m_bestFeatures = new unsigned int[2*learnBuffsSize];
+  m_bestThresholds = new unsigned int[2*learnBuffsSize];
+  m_bestEntropies = new float[2*learnBuffsSize];
 
   // Done with OpenCL initialization
 
@@ -293,24 +360,124 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
   // define the global histogram as a vector of per-node histograms. The total size of
   // the global histogram (defined as number of per-node histograms simultaneously kept)
   // is limited by the smaller between maxFrontierSize and
-  // GLOBAL_HISTOGRAM_MAX_SIZE/perNodeHistogramSize
-  m_histogramSize = std::min(maxFrontierSize,
-			                (size_t)floorl((long double)GLOBAL_HISTOGRAM_MAX_SIZE/
-							               (perNodeHistogramSize*sizeof(unsigned int))));
+  // GLOBAL_HISTOGRAM_MAX_SIZE/perNodeHistogramSize.
+  // Per-node histograms are stored contiguously inside a single (huge-page backed) arena.
+  // With exact split search there are no histograms: the slice nodes samples responses
+  // are bounded by GLOBAL_HISTOGRAM_MAX_SIZE at each depth instead (see _initHistogram())
+  m_histogramSize = (!perNodeHistogramSize) ? maxFrontierSize :
+    std::min(maxFrontierSize,
+	     (size_t)floorl((long double)GLOBAL_HISTOGRAM_MAX_SIZE/
+			    (perNodeHistogramSize*sizeof(unsigned int))));
+  // Per-slice feature/threshold tables must fit a single device allocation as well
+  size_t perNodeTablesSize = params.nFeatures*std::max(FeatDim, params.nThresholds)*sizeof(FeatType);
+  for (unsigned int d=0; d<m_clDevices.size(); d++)
+  {
+    m_histogramSize = std::min(m_histogramSize,
+			       (size_t)(m_clDevices[d].getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()/
+					perNodeTablesSize));
+  }
+  // Data-parallel training: slices must match among the processes, hence the smallest
+  // histogram size is used by all of them
+  if (m_communicator)
+  {
+    std::vector<unsigned int> histogramSizes(m_communicator->getNRanks(), 0);
+    histogramSizes[m_communicator->getRank()] = m_histogramSize;
+    m_communicator->allReduceSum(&histogramSizes[0], histogramSizes.size());
+    m_histogramSize = *std::min_element(histogramSizes.begin(), histogramSizes.end());
+  }
+  if (params.randomThrSampling) m_histogramArena.allocate(m_histogramSize*perNodeHistogramSize);
   m_histogram = new unsigned int*[m_histogramSize];
-  for (int i=0; i<m_histogramSize; i++) m_histogram[i] = new unsigned int[perNodeHistogramSize];
+  for (int i=0; i<m_histogramSize; i++)
+  {
+    m_histogram[i] = m_histogramArena.getData()+i*perNodeHistogramSize;
+  }
 
 
   // Buffer used to track to-train nodes for each depth
   m_frontier = new int[maxFrontierSize];
 
+  // Per-slice feature/threshold tables. Each slice node is assigned a row of the tables,
+  // frontier nodes IDs are mapped to rows using the (node ID - slice start node) map
+  m_clSliceNodesBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY, m_histogramSize*sizeof(cl_int));
+  m_clNodeRowMapBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_ONLY, maxFrontierSize*sizeof(cl_int));
+  m_clFeatTableBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_WRITE,
+						   m_histogramSize*params.nFeatures*FeatDim*
+						   sizeof(FeatType));
+  m_clThrTableBuff = m_clBufferPool.acquireBuffer(CL_MEM_READ_WRITE,
+						  m_histogramSize*params.nFeatures*
+						  std::max(params.nThresholds, 1u)*sizeof(FeatType));
+  m_nodeRowMap = new int[maxFrontierSize];
+  if (!params.randomThrSampling)
+  {
+    m_nodeResponses.resize(m_histogramSize);
+    m_nodeLabels.resize(m_histogramSize);
+  }
+  m_clFeatThrTablesKern.setArg(1, m_clSliceNodesBuff);
+  m_clFeatThrTablesKern.setArg(8, m_clFeatTableBuff);
+  m_clFeatThrTablesKern.setArg(9, m_clThrTableBuff);
+  m_clPerImgHistKern.setArg(9, m_clFeatTableBuff);
+  m_clPerImgHistKern.setArg(10, m_clThrTableBuff);
+  m_clPerImgHistKern.setArg(11, m_clNodeRowMapBuff);
+
+  // Per-image slices index, used to skip images not contributing to a slice
+  // Note: with exact split search, slices are cut by the responses budget as well (see
+  // _initHistogram()). A slice is cut either when full or when the next node exceeds the
+  // budget, hence the latter happens at most 2*(training set responses size)/budget times
+  m_maxSlices = ceill((double)maxFrontierSize/m_histogramSize);
+  if (!params.randomThrSampling)
+  {
+    size_t tsResponsesSize = (size_t)trainingSet.getImages().size()*m_maxTsImgSamples*
+      (params.nFeatures*sizeof(FeatType)+sizeof(unsigned char));
+    m_maxSlices += 2*tsResponsesSize/GLOBAL_HISTOGRAM_MAX_SIZE+1;
+  }
+  m_tsImgSlices = new bool[trainingSet.getImages().size()*m_maxSlices];
+  m_sliceSkippedTsImg = new bool[trainingSet.getImages().size()];
+
 
   // Note: the histogram for the root node is equal to the training set priors
+  m_pendingCPUSubtreeRoots.clear();
   if (startDepth==1)
   {
     const TreeNode<FeatType, FeatDim> &rootNode = tree.getNode(0); 
     std::copy(trainingSet.getPriors(), trainingSet.getPriors()+nClasses, rootNode.m_posterior);
   }
+  else if (m_checkpointPath.empty() || !_loadCheckpoint(tree, trainingSet, startDepth))
+  {
+    // Resuming without a checkpoint: recompute the per-node statistics from the input tree
+    _computeNodeStatistics(trainingSet, startDepth);
+  }
+
+
+  // CPU subtrees training (only when a host implementation of the feature is available)
+  m_cpuSubtreeRoots.clear();
+  if (m_hostFeature && m_internalParams.cpuSubtreeMaxSamples)
+  {
+    m_cpuContext = new CPUSubtreeContext<ImgType, nChannels, FeatType, FeatDim, nClasses>;
+    m_cpuContext->trainingSet = &trainingSet;
+    m_cpuContext->hostFeature = m_hostFeature;
+    m_cpuContext->params = params;
+    m_cpuContext->treeID = tree.getID();
+    m_cpuContext->endDepth = endDepth;
+    m_cpuContext->prngRand = getPRNGFunc(m_internalParams.prng);
+    m_cpuContext->splitGainRow = getSplitGainRowFunc(params.splitCriterion);
+    m_cpuContext->nLog2n = &m_nLog2nTable[0];
+
+    m_cpuPool = new WorkStealingPool(m_internalParams.cpuSubtreeThreads);
+    m_cpuContext->splits.resize(m_cpuPool->getNWorkers());
+  }
+
+  // Resuming from a checkpoint: subtrees not committed yet are trained again from their
+  // roots, i.e. leaves of the restored levels (images skip flags do not account for them)
+  if (!m_pendingCPUSubtreeRoots.empty())
+  {
+    if (!m_cpuPool)
+    {
+      throw "Training checkpoint has pending CPU subtrees, but CPU subtrees are disabled";
+    }
+    std::vector<int> roots;
+    roots.swap(m_pendingCPUSubtreeRoots);
+    _handOffCPUSubtrees(tree, trainingSet, roots, false);
+  }
 
 
   // Finally, init the random seed for features and thresholds sampling
@@ -334,32 +501,14 @@ unsigned int CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_in
   Tree<FeatType, FeatDim, nClasses> &tree,
   const TreeTrainerParameters<FeatType, FeatDim> &params, unsigned int currDepth)
 {
-  size_t currFrontierSize = currDepth>1 ? (2<<(currDepth-2)) : 1;
-  unsigned int startNode = currFrontierSize-1;
-  unsigned int toTrainNodes = 0;
+  // Small nodes are trained, with their whole subtree, on CPU threads
+  unsigned int toTrainNodes = _selectFrontier(tree, params, currDepth, m_perNodeTotSamples,
+					      m_perClassTotSamples, m_frontier,
+					      (m_cpuPool) ? &m_cpuSubtreeRoots : NULL,
+					      m_internalParams.cpuSubtreeMaxSamples);
 
   m_frontierIdxMap.clear();
-
-  if (currDepth>1)
-  {
-    for (unsigned int i=0; i<currFrontierSize; i++)
-    {
-      const TreeNode<FeatType, FeatDim> &currNode = tree.getNode(startNode+i);
-      if (*currNode.m_leftChild==-1 && m_perNodeTotSamples[startNode+i]>params.perLeafSamplesThr)
-      {
-	m_frontier[toTrainNodes]=startNode+i;
-	m_frontierIdxMap[startNode+i] = toTrainNodes;
-	toTrainNodes++;
-      }
-    }
-  }
-  else
-  {
-    // Note: when starting from depth 1, root node gets always trained
-    m_frontier[0] = 0;
-    m_frontierIdxMap[0] = 0;
-    toTrainNodes = 1;
-  }
+  for (unsigned int i=0; i<toTrainNodes; i++) m_frontierIdxMap[m_frontier[i]] = i;
 
   return toTrainNodes;
 }
@@ -372,23 +521,38 @@ unsigned int CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_in
   const TreeTrainerParameters<FeatType, FeatDim> &params)
 {
   unsigned int frontierSize = m_frontierIdxMap.size();
+  size_t perSampleResponsesSize = params.nFeatures*sizeof(FeatType)+sizeof(unsigned char);
+  size_t sliceResponsesSize = 0;
+
+  // Split the frontier into slices of at most m_histogramSize nodes. With exact split search,
+  // a slice is cut early as well when the samples responses of its nodes would exceed
+  // GLOBAL_HISTOGRAM_MAX_SIZE (a single node exceeding it gets its own slice)
+  m_sliceOffsets.assign(1, 0);
+  for (unsigned int i=0; i<frontierSize; i++)
+  {
+    size_t nodeResponsesSize = (params.randomThrSampling) ? 0 :
+      m_perNodeTotSamples[m_frontier[i]]*perSampleResponsesSize;
+    if (i>m_sliceOffsets.back() &&
+	(i-m_sliceOffsets.back()==m_histogramSize ||
+	 sliceResponsesSize+nodeResponsesSize>GLOBAL_HISTOGRAM_MAX_SIZE))
+    {
+      m_sliceOffsets.push_back(i);
+      sliceResponsesSize = 0;
+    }
+    sliceResponsesSize += nodeResponsesSize;
+  }
+  if (frontierSize) m_sliceOffsets.push_back(frontierSize);
 
-  size_t perNodeHistogramSize = params.nFeatures*params.nThresholds*nClasses;
-  unsigned int nSlices = ceill((double)frontierSize/m_histogramSize);
-
-  return nSlices;
+  return m_sliceOffsets.size()-1;
 }
 
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
 void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_cleanTrain()
 {
-  // Release pinned memory objects
-  m_clQueue1.enqueueUnmapMemObject(m_clTsImgPinn, m_clTsImgPinnPtr);
-  m_clQueue1.enqueueUnmapMemObject(m_clTsLabelsImgPinn, m_clTsLabelsImgPinnPtr);
-  m_clQueue1.enqueueUnmapMemObject(m_clTsNodesIDImgPinn, m_clTsNodesIDImgPinnPtr);
-  m_clQueue1.enqueueUnmapMemObject(m_clTsSamplesBuffPinn, m_clTsSamplesBuffPinnPtr);
-  m_clQueue1.enqueueUnmapMemObject(m_clPerImgHistBuffPinn, m_clPerImgHistBuffPinnPtr);
+  // Give device objects back to the pool: pinned buffers stay mapped for the next training,
+  // objects not used by this training are destroyed
+  m_clBufferPool.release();
 
 
   // Delete data dinamically allocated for current tree training
@@ -396,16 +560,26 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_cleanTrain
   delete []m_perClassTotSamples;
   delete []m_toSkipTsImg;
   delete []m_skippedTsImg;
-  delete m_clTsImg1;
-  delete m_clTsImg2;
+  for (unsigned int p=0; p<m_clTsImg.size(); p++) delete m_clTsImg[p];
+  m_clTsImg.clear();
+  delete []m_batchPerClassTotSamples;
   delete []m_bestFeatures;
   delete []m_bestThresholds;
   delete []m_bestEntropies;
-  for (int i=0; i<m_histogramSize; i++)
-  {
-    delete []m_histogram[i];
-    m_histogram[i] = NULL;
-  }
+  std::vector<float>().swap(m_nLog2nTable);
   delete []m_histogram;
+  m_histogramArena.release();
+  delete []m_nodeRowMap;
+  m_nodeResponses.clear();
+  m_nodeLabels.clear();
+  m_sliceOffsets.clear();
   delete []m_frontier;
+  delete []m_tsImgSlices;
+  delete []m_sliceSkippedTsImg;
+  delete m_cpuPool;
+  delete m_cpuContext;
+  m_cpuPool = NULL;
+  m_cpuContext = NULL;
+  m_cpuSubtreeRoots.clear();
+  m_pendingCPUSubtreeRoots.clear();
 }
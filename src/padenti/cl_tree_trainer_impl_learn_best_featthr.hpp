@@ -17,9 +17,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  ******************************************************************************/
 
+#include <algorithm>
+#include <vector>
+#include <utility>
 #include <boost/chrono/chrono.hpp>
+#include <padenti/node_sampling.hpp>
+#include <padenti/node_training.hpp>
 //#include <boost/log/trivial.hpp>
 
+
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
 void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_learnBestFeatThr(
@@ -27,226 +33,128 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_learnBestF
   const TreeTrainerParameters<FeatType, FeatDim> &params,
   unsigned int currDepth, unsigned int currSlice)
 {
+  TraceScope traceScope(m_tracer, "learnBestFeatThr", "train");
   // Compute per-node best feature/threshold pair for current depth using ID3 algorithm
   /**
    * \todo different learning algorithm?
    * \todo as above, parallelize execution, e.g. parallel read/write and computation
-   * \todo generic (non-md5) prng?
-   * \todo terminate conditions?
   */
 
   boost::chrono::steady_clock::time_point startLearn = 
     boost::chrono::steady_clock::now();
 
-  size_t perNodeHistogramSize = nClasses*params.nFeatures*params.nThresholds;
-  unsigned int frontierSize = m_frontierIdxMap.size();
-  unsigned int toTrainNodes = ((currSlice+1)*m_histogramSize > frontierSize) ?
-    (frontierSize%m_histogramSize) : m_histogramSize;
+  unsigned int toTrainNodes = m_sliceOffsets[currSlice+1]-m_sliceOffsets[currSlice];
+  // Host generator matching the one used by the per-image histogram kernels
+  PRNGFunc prngRand = getPRNGFunc(m_internalParams.prng);
 
-  size_t learnBuffSize = 
-    ((PARALLEL_LEARNT_NODES<frontierSize) ? PARALLEL_LEARNT_NODES : frontierSize) * 
-    (params.nFeatures*params.nThresholds)/PER_THREAD_FEAT_THR_PAIRS;
-  if (!currSlice)
+  // Exact split search: best feature/threshold pairs are searched on the host from the
+  // sorted samples responses
+  if (!params.randomThrSampling)
   {
-    std::fill_n(m_bestFeatures, learnBuffSize, 0);
-    std::fill_n(m_bestThresholds, learnBuffSize, 0);
-    std::fill_n(m_bestEntropies, learnBuffSize, -1.);
+    std::vector<unsigned int> bestFeatures(toTrainNodes);
+    std::vector<FeatType> bestThresholds(toTrainNodes);
+    std::vector<float> bestGains(toTrainNodes);
+    std::vector<unsigned int> leftHistograms(toTrainNodes*nClasses);
+    switch (params.splitCriterion)
+    {
+    case SPLIT_CRITERION_GINI:
+      _searchExactSplits<SPLIT_CRITERION_GINI>(params, currSlice, &bestFeatures[0],
+					       &bestThresholds[0], &bestGains[0],
+					       &leftHistograms[0]);
+      break;
+    case SPLIT_CRITERION_GAIN_RATIO:
+      _searchExactSplits<SPLIT_CRITERION_GAIN_RATIO>(params, currSlice, &bestFeatures[0],
+						     &bestThresholds[0], &bestGains[0],
+						     &leftHistograms[0]);
+      break;
+    default:
+      _searchExactSplits<SPLIT_CRITERION_ENTROPY>(params, currSlice, &bestFeatures[0],
+						  &bestThresholds[0], &bestGains[0],
+						  &leftHistograms[0]);
+      break;
+    }
+    for (unsigned int n=0; n<toTrainNodes; n++)
+    {
+      _splitNode(tree, params, prngRand, m_perNodeTotSamples, m_perClassTotSamples,
+		 m_frontier[m_sliceOffsets[currSlice]+n], bestFeatures[n], bestThresholds[n],
+		 bestGains[n], &leftHistograms[n*nClasses]);
+    }
   }
-
-
-  unsigned int nIters = toTrainNodes/PARALLEL_LEARNT_NODES + \
-    ((toTrainNodes%PARALLEL_LEARNT_NODES) ? 1 : 0);
-  for (unsigned int i=0; i<nIters; i++)
+  // Histogram split search on the host: node histograms are already in host memory, hence
+  // copying them to the device may cost more than the search itself
+  else if (m_internalParams.splitSearch==SPLIT_SEARCH_HOST ||
+	   (m_internalParams.splitSearch==SPLIT_SEARCH_AUTO &&
+	    (m_cpuDevice || toTrainNodes>=HOST_SPLIT_SEARCH_MIN_NODES)))
   {
-    unsigned int currNNodes = (!i && toTrainNodes<=PARALLEL_LEARNT_NODES) ? toTrainNodes : 
-      ((i==(nIters-1) && toTrainNodes%PARALLEL_LEARNT_NODES) ? 
-       (toTrainNodes%PARALLEL_LEARNT_NODES) : PARALLEL_LEARNT_NODES);
-    unsigned int nThreads =
-      currNNodes*(params.nFeatures*params.nThresholds)/PER_THREAD_FEAT_THR_PAIRS;
-    unsigned int frontierOffset = currSlice*m_histogramSize + i*PARALLEL_LEARNT_NODES;
-
-    for (unsigned int n=0; n<currNNodes; n++)
+    std::vector<unsigned int> bestFeatures(toTrainNodes);
+    std::vector<unsigned int> bestThresholds(toTrainNodes);
+    std::vector<float> bestGains(toTrainNodes);
+    searchHistogramSplits(getSplitGainRowFunc(params.splitCriterion), m_histogram,
+			  m_frontier+m_sliceOffsets[currSlice], toTrainNodes, params.nFeatures,
+			  params.nThresholds, nClasses, m_perNodeTotSamples, m_perClassTotSamples,
+			  &m_nLog2nTable[0], params.minChildSamples, 0, &bestFeatures[0],
+			  &bestThresholds[0], &bestGains[0]);
+    for (unsigned int n=0; n<toTrainNodes; n++)
     {
-      unsigned int nodeID = m_frontier[frontierOffset+n];
-      m_clQueue1.enqueueWriteBuffer(m_clHistogramBuff,
-				   CL_FALSE,
-				   n*perNodeHistogramSize*sizeof(cl_uint),
-				   perNodeHistogramSize*sizeof(cl_uint),
-				   (void*)m_histogram[i*PARALLEL_LEARNT_NODES+n]);
-
-      // Upload per-node per-class total number of samples on GPU
-      m_clQueue1.enqueueWriteBuffer(m_clPerClassTotSamplesBuff,
-				   CL_FALSE,
-				   n*nClasses*sizeof(cl_uint),
-				   nClasses*sizeof(cl_uint),
-				   (void*)(&m_perClassTotSamples[nodeID*nClasses]));
+      _splitHistogramNode(tree, params, prngRand, m_perNodeTotSamples, m_perClassTotSamples,
+			  m_frontier[m_sliceOffsets[currSlice]+n], m_histogram[n],
+			  bestFeatures[n], bestThresholds[n], bestGains[n]);
     }
-
-    /** \todo Check if nThreads is a multiple of 32 */
-    m_clQueue1.enqueueNDRangeKernel(m_clLearnBestFeatKern,
-				   cl::NullRange,
-				   cl::NDRange(nThreads),
-				   cl::NDRange(32));
-
-    m_clQueue1.enqueueReadBuffer(m_clBestFeaturesBuff,
-				CL_FALSE,
-				0, nThreads*sizeof(cl_uint), m_bestFeatures);
-    m_clQueue1.enqueueReadBuffer(m_clBestThresholdsBuff,
-				CL_FALSE,
-				0, nThreads*sizeof(cl_uint), m_bestThresholds);
-    m_clQueue1.enqueueReadBuffer(m_clBestEntropiesBuff,
-				CL_TRUE,
-				0, nThreads*sizeof(cl_float), m_bestEntropies);
-
-    unsigned int perNodeThreads = nThreads/currNNodes;
-    for (unsigned int n=0; n<currNNodes; n++)
+  }
+  else
+  {
+    unsigned int nIters = toTrainNodes/PARALLEL_LEARNT_NODES + \
+      ((toTrainNodes%PARALLEL_LEARNT_NODES) ? 1 : 0);
+    std::vector<cl::Event> readEvents(2);
+
+    // Batches are double-buffered: while the results of the i-th batch are processed on
+    // the host, the (i+1)-th batch is uploaded and learnt on the device
+    _enqueueLearnBatch(params, currSlice, toTrainNodes, 0, readEvents[0]);
+    for (unsigned int i=0; i<nIters; i++)
     {
-      unsigned int *perNodeBestFeatures = &m_bestFeatures[perNodeThreads*n];
-      unsigned int *perNodeBestThresholds = &m_bestThresholds[perNodeThreads*n];
-      float *perNodeBestEntropies = &m_bestEntropies[perNodeThreads*n];
-      
-      unsigned int nodeID = m_frontier[frontierOffset+n];
-      unsigned int perNodeSliceOffset = i*PARALLEL_LEARNT_NODES+n;
-
-      unsigned int bestID = std::distance(perNodeBestEntropies,
-	std::max_element(perNodeBestEntropies, perNodeBestEntropies+perNodeThreads));
-
-      // Update children histograms and left children
-      /** \todo more elegant way? the two for above are awful */
-      /** \todo move the node update to another function */
-      const TreeNode<FeatType, FeatDim> &currNode = tree.getNode(nodeID);
-      const TreeNode<FeatType, FeatDim> &leftChildNode = tree.getNode(nodeID*2+1);
-      const TreeNode<FeatType, FeatDim> &rightChildNode = tree.getNode(nodeID*2+2);
-      unsigned int *leftHistogram = new unsigned int[nClasses];
-      unsigned int *rightHistogram = new unsigned int[nClasses];
-      unsigned int lSum=0, rSum=0;
-      for (unsigned int l=0; l<nClasses; l++)
-      {
-	unsigned int *currHistogram = m_histogram[perNodeSliceOffset];
-	/*
-	unsigned int offset = 
-	  l                               * (params.nFeatures*params.nThresholds) +
-	  perNodeBestFeatures[bestID]    * (params.nThresholds) +
-	  perNodeBestThresholds[bestID];
-	*/
-	unsigned int offset = 
-	  l                             * (params.nThresholds*params.nFeatures) +
-	  perNodeBestThresholds[bestID] * (params.nFeatures) +
-	  perNodeBestFeatures[bestID];
-	leftHistogram[l] = currHistogram[offset];
-	rightHistogram[l] = m_perClassTotSamples[nodeID*nClasses+l]-leftHistogram[l];
-	lSum += leftHistogram[l];
-	rSum += rightHistogram[l];
-      }
-
-      // If all the pixels follow the same path, the best-feature is not discriminative enough
-      // and the current node is kept as a leaf node
-      /** \todo insert additional splitting stop criteria here, e.g. information gain threshold */
-      if (!lSum || !rSum) continue;
-
-      // Update the total number of samples reaching child nodes
-      m_perNodeTotSamples[nodeID*2+1] = lSum;
-      m_perNodeTotSamples[nodeID*2+2] = rSum;
-      for (unsigned int l=0; l<nClasses; l++)
+      unsigned int currNNodes = (!i && toTrainNodes<=PARALLEL_LEARNT_NODES) ? toTrainNodes : 
+	((i==(nIters-1) && toTrainNodes%PARALLEL_LEARNT_NODES) ? 
+	 (toTrainNodes%PARALLEL_LEARNT_NODES) : PARALLEL_LEARNT_NODES);
+      unsigned int frontierOffset = m_sliceOffsets[currSlice] + i*PARALLEL_LEARNT_NODES;
+      unsigned int *bestFeatures = &m_bestFeatures[(i%2)*PARALLEL_LEARNT_NODES];
+      unsigned int *bestThresholds = &m_bestThresholds[(i%2)*PARALLEL_LEARNT_NODES];
+      float *bestGains = &m_bestEntropies[(i%2)*PARALLEL_LEARNT_NODES];
+
+      if (i+1<nIters) _enqueueLearnBatch(params, currSlice, toTrainNodes, i+1, readEvents[(i+1)%2]);
+      readEvents[i%2].wait();
+
+      for (unsigned int n=0; n<currNNodes; n++)
       {
-	m_perClassTotSamples[(nodeID*2+1)*nClasses+l]=leftHistogram[l];
-	m_perClassTotSamples[(nodeID*2+2)*nClasses+l]=rightHistogram[l];
-	assert((leftHistogram[l]+rightHistogram[l])==m_perClassTotSamples[nodeID*nClasses+l]);
+	_splitHistogramNode(tree, params, prngRand, m_perNodeTotSamples, m_perClassTotSamples,
+			    m_frontier[frontierOffset+n], m_histogram[i*PARALLEL_LEARNT_NODES+n],
+			    bestFeatures[n], bestThresholds[n], bestGains[n]);
       }
-      assert((lSum+rSum)==m_perNodeTotSamples[nodeID]);
-
-      float *leftPosteriors = new float[nClasses];
-      float *rightPosteriors = new float[nClasses];
-      for (unsigned int l=0; l<nClasses; l++)
-      {
-	leftPosteriors[l] = ((float)leftHistogram[l])/lSum;
-	rightPosteriors[l] = ((float)rightHistogram[l])/rSum;
-      }
-
-      std::copy(leftPosteriors, leftPosteriors+nClasses, leftChildNode.m_posterior);
-      std::copy(rightPosteriors, rightPosteriors+nClasses, rightChildNode.m_posterior);
-      *leftChildNode.m_leftChild=-1;
-      *rightChildNode.m_leftChild=-1;
-	
-
-      // Finally, recompute feature and threshold values for current node
-      /**
-       * \todo move integer-to-float conversion to prng, i.e. assume prngs work on floats
-       * \todo compute features directly inside kernel during learning
-       */
-      /*
-      unsigned int seed[4] = {tree.getID()^m_seed,
-			      nodeID^m_seed,
-			      perNodeBestFeatures[bestID]^m_seed,
-			      m_seed};
-      */
-      unsigned int seed[4] = {tree.getID(),
-			      nodeID,
-			      perNodeBestFeatures[bestID],
-			      0};
-      unsigned int state[4];
-      for (unsigned int j=0; j<FeatDim; j+=4)
-      {
-	md5Rand(seed, state);
-	 
-	currNode.m_feature[j] = params.featLowBounds[j] +
-	  (FeatType)(((float)state[0])/(0xFFFFFFFF)*(params.featUpBounds[j]-params.featLowBounds[j]));
-	if ((j+1)>=FeatDim) break;
-
-	currNode.m_feature[j+1] = params.featLowBounds[j+1]  +
-	  (FeatType)(((float)state[1])/(0xFFFFFFFF)*(params.featUpBounds[j+1]-params.featLowBounds[j+1]));
-	if ((j+2)>=FeatDim) break;
-	  
-	currNode.m_feature[j+2] = params.featLowBounds[j+2] +
-	  (FeatType)(((float)state[2])/(0xFFFFFFFF)*(params.featUpBounds[j+2]-params.featLowBounds[j+2]));
-	if ((j+3)>=FeatDim) break;	  
-
-	currNode.m_feature[j+3] = params.featLowBounds[j+3] +
-	  (FeatType)(((float)state[3])/(0xFFFFFFFF)*(params.featUpBounds[j+3]-params.featLowBounds[j+3]));
-	  
-	std::copy(state, state+4, seed);
-      }
-
-      
-      seed[0] = tree.getID();
-      seed[1] = nodeID;
-      seed[2] = perNodeBestFeatures[bestID];
-      seed[3] = 1;
-      for (unsigned int j=0; j<(perNodeBestThresholds[bestID]/4+1); j++)
-      {
-	md5Rand(seed, state);
-	std::copy(state, state+4, seed);
-      }
-      *currNode.m_threshold = params.thrLowBound +
-	(FeatType)((float)state[perNodeBestThresholds[bestID]%4]/0xFFFFFFFF*
-		   (params.thrUpBound-params.thrLowBound));
-      
-
-      /*
-      *currNode.m_threshold = params.thrLowBound + 
-       (FeatType)((float)perNodeBestThresholds[bestID]*
-      	   (params.thrUpBound-params.thrLowBound)/params.nThresholds);
-      */
-
-
-      // Update current node left child
-      *currNode.m_leftChild = nodeID*2+1;
-
-
-      // Done with node
-
-      delete []rightPosteriors;
-      delete []leftPosteriors;
-      delete []rightHistogram;
-      delete []leftHistogram;
     }
   }
-
   // Finally, update node's portion of tree's OpenCL buffers
   //unsigned int startNode = m_frontier[currSlice*maxNodesPerGlobalHistogram];
   //unsigned int endNode = m_frontier[currSlice*maxNodesPerGlobalHistogram+toTrainNodes-1];
-  unsigned int startNode = m_frontier[currSlice*m_histogramSize];
-  unsigned int endNode = m_frontier[currSlice*m_histogramSize+toTrainNodes-1];
+  unsigned int startNode = m_frontier[m_sliceOffsets[currSlice]];
+  unsigned int endNode = m_frontier[m_sliceOffsets[currSlice]+toTrainNodes-1];
+  _writeTreeBuffers(tree, startNode, endNode);
+
+  boost::chrono::duration<double> learnTime = 
+    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-startLearn);
+  m_stats.depths.back().learnTime += learnTime.count();
+  /*
+  BOOST_LOG_TRIVIAL(info) << "Best feature/threshold for nodes " << startNode
+			  << "-" << endNode << " learnt in "
+			  << learnTime.count() << " seconds";
+  */
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_writeTreeBuffers(
+  const Tree<FeatType, FeatDim, nClasses> &tree,
+  unsigned int startNode, unsigned int endNode)
+{
   unsigned int toWriteNodes = endNode-startNode+1;
 
   m_clQueue1.enqueueWriteBuffer(m_clTreeLeftChildBuff,
@@ -271,13 +179,122 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_learnBestF
 			       CL_TRUE,
 			       (startNode*2+1)*nClasses*sizeof(cl_float),
 			       toWriteNodes*2*nClasses*sizeof(cl_float),
-			       (void*)(&tree.getPosteriors()[(startNode+2+1)*nClasses]));
+			       (void*)(&tree.getPosteriors()[(startNode*2+1)*nClasses]));
+}
 
-  /*
-  boost::chrono::duration<double> learnTime = 
-    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-startLearn);
-  BOOST_LOG_TRIVIAL(info) << "Best feature/threshold for nodes " << startNode
-			  << "-" << endNode << " learnt in "
-			  << learnTime.count() << " seconds";
-  */
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_enqueueLearnBatch(
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int currSlice, unsigned int toTrainNodes, unsigned int batch, cl::Event &readEvent)
+{
+  size_t perNodeHistogramSize = nClasses*params.nFeatures*params.nThresholds;
+  unsigned int nNodes = std::min<unsigned int>(PARALLEL_LEARNT_NODES,
+					       toTrainNodes-batch*PARALLEL_LEARNT_NODES);
+  unsigned int frontierOffset = m_sliceOffsets[currSlice] + batch*PARALLEL_LEARNT_NODES;
+  unsigned int perNodeThreads =
+    (params.nFeatures*params.nThresholds+PER_THREAD_FEAT_THR_PAIRS-1)/PER_THREAD_FEAT_THR_PAIRS;
+  unsigned int nGroups = (perNodeThreads+WG_LEARN_BEST_FEAT-1)/WG_LEARN_BEST_FEAT;
+  unsigned int b = batch%2;
+  std::vector<cl::Event> uploadEvents(1);
+
+  // Upload node histograms and per-class total number of samples on the second queue, one
+  // write each per batch
+  // Note: histograms of consecutive frontier nodes are contiguous inside the arena
+  unsigned int *batchPerClassTotSamples = &m_batchPerClassTotSamples[b*PARALLEL_LEARNT_NODES*nClasses];
+  for (unsigned int n=0; n<nNodes; n++)
+  {
+    std::copy(&m_perClassTotSamples[m_frontier[frontierOffset+n]*nClasses],
+	      &m_perClassTotSamples[m_frontier[frontierOffset+n]*nClasses]+nClasses,
+	      batchPerClassTotSamples+n*nClasses);
+  }
+  m_clQueue2.enqueueWriteBuffer(m_clHistogramBuff[b],
+				CL_FALSE,
+				0, nNodes*perNodeHistogramSize*sizeof(cl_uint),
+				(void*)m_histogram[batch*PARALLEL_LEARNT_NODES]);
+  m_clQueue2.enqueueWriteBuffer(m_clPerClassTotSamplesBuff[b],
+				CL_FALSE,
+				0, nNodes*nClasses*sizeof(cl_uint),
+				(void*)batchPerClassTotSamples,
+				NULL, &uploadEvents[0]);
+  m_clQueue2.flush();
+
+  // Learn the batch once uploaded: per-work-group candidates, then per-node reduction
+  m_clLearnBestFeatKern.setArg(0, m_clHistogramBuff[b]);
+  m_clLearnBestFeatKern.setArg(1, m_clPerClassTotSamplesBuff[b]);
+  m_clQueue1.enqueueNDRangeKernel(m_clLearnBestFeatKern,
+				  cl::NullRange,
+				  cl::NDRange(nGroups*WG_LEARN_BEST_FEAT, nNodes),
+				  cl::NDRange(WG_LEARN_BEST_FEAT, 1),
+				  &uploadEvents);
+  m_clReduceBestFeatKern.setArg(4, m_clBestFeaturesBuff[b]);
+  m_clReduceBestFeatKern.setArg(5, m_clBestThresholdsBuff[b]);
+  m_clReduceBestFeatKern.setArg(6, m_clBestEntropiesBuff[b]);
+  m_clQueue1.enqueueNDRangeKernel(m_clReduceBestFeatKern,
+				  cl::NullRange,
+				  cl::NDRange(nNodes*WG_LEARN_BEST_FEAT),
+				  cl::NDRange(WG_LEARN_BEST_FEAT));
+
+  // Non-blocking read of the batch results
+  m_clQueue1.enqueueReadBuffer(m_clBestFeaturesBuff[b],
+			       CL_FALSE,
+			       0, nNodes*sizeof(cl_uint), &m_bestFeatures[b*PARALLEL_LEARNT_NODES]);
+  m_clQueue1.enqueueReadBuffer(m_clBestThresholdsBuff[b],
+			       CL_FALSE,
+			       0, nNodes*sizeof(cl_uint), &m_bestThresholds[b*PARALLEL_LEARNT_NODES]);
+  m_clQueue1.enqueueReadBuffer(m_clBestEntropiesBuff[b],
+			       CL_FALSE,
+			       0, nNodes*sizeof(cl_float), &m_bestEntropies[b*PARALLEL_LEARNT_NODES],
+			       NULL, &readEvent);
+  m_clQueue1.flush();
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+template <SplitCriterion criterion>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_searchExactSplits(
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int currSlice, unsigned int *bestFeatures,
+  FeatType *bestThresholds, float *bestGains, unsigned int *leftHistograms)
+{
+  unsigned int toTrainNodes = m_sliceOffsets[currSlice+1]-m_sliceOffsets[currSlice];
+
+  // For each node and feature, sort the samples responses and evaluate the split score
+  // of each cut between two distinct responses (i.e. threshold equal to the smaller one)
+  #pragma omp parallel
+  {
+    std::vector<std::pair<FeatType, unsigned char> > responses;
+
+    #pragma omp for schedule(dynamic)
+    for (int n=0; n<(int)toTrainNodes; n++)
+    {
+      unsigned int nodeID = m_frontier[m_sliceOffsets[currSlice]+n];
+      const std::vector<FeatType> &nodeResponses = m_nodeResponses[n];
+      const std::vector<unsigned char> &nodeLabels = m_nodeLabels[n];
+      unsigned int nSamples = nodeLabels.size();
+      const unsigned int *totHistogram = &m_perClassTotSamples[nodeID*nClasses];
+      unsigned int *bestLeftHistogram = &leftHistograms[n*nClasses];
+      float bestGain = -1.0f;
+
+      // If no cut is found, all the samples go left (i.e. the node is kept as a leaf)
+      bestFeatures[n] = 0;
+      bestThresholds[n] = params.thrUpBound;
+      std::copy(totHistogram, totHistogram+nClasses, bestLeftHistogram);
+
+      responses.resize(nSamples);
+      for (unsigned int f=0; f<params.nFeatures; f++)
+      {
+	for (unsigned int s=0; s<nSamples; s++)
+	{
+	  responses[s] = std::make_pair(nodeResponses[s*params.nFeatures+f], nodeLabels[s]);
+	}
+	searchExactSplit<criterion>(responses, totHistogram, nClasses, &m_nLog2nTable[0],
+				    params.minChildSamples, f, bestGain, bestFeatures[n],
+				    bestThresholds[n], bestLeftHistogram);
+      }
+      bestGains[n] = std::max(bestGain, 0.0f);
+    }
+  }
 }
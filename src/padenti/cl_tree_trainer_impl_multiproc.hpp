@@ -0,0 +1,87 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <algorithm>
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_reduceHistogram(
+  Tree<FeatType, FeatDim, nClasses> &tree,
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int currDepth, unsigned int currSlice)
+{
+  TraceScope traceScope(m_tracer, "reduceHistogram", "train");
+  boost::chrono::steady_clock::time_point reduceStart = boost::chrono::steady_clock::now();
+
+  size_t perNodeHistogramSize = params.nFeatures*params.nThresholds*nClasses;
+  unsigned int frontierOffset = m_sliceOffsets[currSlice];
+  unsigned int totNodes = m_sliceOffsets[currSlice+1]-frontierOffset;
+
+  // Slice node histograms are contiguous inside the arena, hence a single all-reduce is
+  // enough
+  m_communicator->allReduceSum(m_histogramArena.getData(), totNodes*perNodeHistogramSize);
+
+  // Root per-class samples are counted during the first traversal: sum them as well and
+  // replace the shard priors with the whole training set ones
+  if (currDepth==1)
+  {
+    m_communicator->allReduceSum(m_perClassTotSamples, nClasses);
+    const TreeNode<FeatType, FeatDim> &rootNode = tree.getNode(0);
+    for (unsigned int l=0; l<nClasses; l++)
+    {
+      rootNode.m_posterior[l] = (float)m_perClassTotSamples[l]/m_perNodeTotSamples[0];
+    }
+  }
+
+  boost::chrono::duration<double> reduceTime =
+    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-
+								 reduceStart);
+  m_stats.depths.back().reduceTime += reduceTime.count();
+  BOOST_LOG_TRIVIAL(info) << "Global histogram reduced among " << m_communicator->getNRanks()
+			  << " processes in " << reduceTime.count() << " seconds";
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_broadcastTreeNodes(
+  Tree<FeatType, FeatDim, nClasses> &tree, unsigned int currSlice)
+{
+  TraceScope traceScope(m_tracer, "broadcastTreeNodes", "train");
+  unsigned int frontierOffset = m_sliceOffsets[currSlice];
+  unsigned int totNodes = m_sliceOffsets[currSlice+1]-frontierOffset;
+  unsigned int startNode = m_frontier[frontierOffset];
+  unsigned int endNode = m_frontier[frontierOffset+totNodes-1];
+
+  // Learning updates the slice nodes and their children, i.e. nodes in
+  // [startNode, 2*endNode+2]
+  unsigned int nNodes = 2*endNode+3-startNode;
+  m_communicator->broadcast(&tree.getLeftChildren()[startNode], nNodes*sizeof(int));
+  m_communicator->broadcast(&tree.getFeatures()[startNode*FeatDim], nNodes*FeatDim*sizeof(FeatType));
+  m_communicator->broadcast(&tree.getThresholds()[startNode], nNodes*sizeof(FeatType));
+  m_communicator->broadcast(&tree.getPosteriors()[startNode*nClasses],
+			    nNodes*nClasses*sizeof(float));
+  m_communicator->broadcast(&m_perNodeTotSamples[startNode], nNodes*sizeof(unsigned int));
+  m_communicator->broadcast(&m_perClassTotSamples[startNode*nClasses],
+			    nNodes*nClasses*sizeof(unsigned int));
+
+  // Rank 0 already updated its device buffers while learning
+  if (m_communicator->getRank()) _writeTreeBuffers(tree, startNode, endNode);
+}
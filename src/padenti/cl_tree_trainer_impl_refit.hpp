@@ -0,0 +1,170 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <vector>
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::refit(
+  Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  bool allLabeledPixels)
+{
+  boost::chrono::steady_clock::time_point refitStart = boost::chrono::steady_clock::now();
+
+  unsigned int nNodes = (2<<(tree.getDepth()-1))-1;
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &tsImages = trainingSet.getImages();
+
+  // Device objects are sized on the largest image (multiple of the work-group size)
+  unsigned int maxWidth=0, maxHeight=0;
+  for (unsigned int i=0; i<tsImages.size(); i++)
+  {
+    if (tsImages[i].getWidth()>maxWidth) maxWidth = tsImages[i].getWidth();
+    if (tsImages[i].getHeight()>maxHeight) maxHeight = tsImages[i].getHeight();
+  }
+  maxWidth += (maxWidth%WG_PREDICT_WIDTH) ? WG_PREDICT_WIDTH-(maxWidth%WG_PREDICT_WIDTH) : 0;
+  maxHeight += (maxHeight%WG_PREDICT_HEIGHT) ? WG_PREDICT_HEIGHT-(maxHeight%WG_PREDICT_HEIGHT) : 0;
+
+  cl::Buffer clLeftChildBuff(m_clContext, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			     nNodes*sizeof(cl_int), (void*)tree.getLeftChildren());
+  cl::Buffer clFeaturesBuff(m_clContext, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			    nNodes*FeatDim*sizeof(FeatType), (void*)tree.getFeatures());
+  cl::Buffer clThrsBuff(m_clContext, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			nNodes*sizeof(FeatType), (void*)tree.getThresholds());
+  cl::Buffer clPosteriorsBuff(m_clContext, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			      nNodes*nClasses*sizeof(cl_float), (void*)tree.getPosteriors());
+  std::vector<unsigned int> histogram(nNodes*nClasses, 0);
+  cl::Buffer clHistogramBuff(m_clContext, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
+			     nNodes*nClasses*sizeof(cl_uint), (void*)&histogram[0]);
+
+  cl::ImageFormat clImgFormat;
+  ImgTypeTrait<ImgType, nChannels>::toCLImgFmt(clImgFormat);
+  cl::Image *clImg;
+  if (nChannels<=4) clImg = new cl::Image2D(m_clContext, CL_MEM_READ_ONLY, clImgFormat,
+					    maxWidth, maxHeight);
+  else clImg = new cl::Image3D(m_clContext, CL_MEM_READ_ONLY, clImgFormat,
+			       maxWidth, maxHeight, nChannels);
+  clImgFormat.image_channel_order = CL_R;
+  clImgFormat.image_channel_data_type = CL_UNSIGNED_INT8;
+  cl::Image2D clLabelsImg(m_clContext, CL_MEM_READ_ONLY, clImgFormat, maxWidth, maxHeight);
+  clImgFormat.image_channel_data_type = CL_SIGNED_INT32;
+  std::vector<int> zeroNodesID(maxWidth*maxHeight, 0);
+  cl::Image2D clNodesIDImg(m_clContext, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, clImgFormat,
+			   maxWidth, maxHeight, 0, (void*)&zeroNodesID[0]);
+
+  cl::Kernel refitKern(m_clPredictProg, "refitLeaves");
+  if (nChannels<=4) refitKern.setArg(0, *reinterpret_cast<cl::Image2D*>(clImg));
+  else refitKern.setArg(0, *reinterpret_cast<cl::Image3D*>(clImg));
+  refitKern.setArg(1, clLabelsImg);
+  refitKern.setArg(2, nChannels);
+  refitKern.setArg(5, clLeftChildBuff);
+  refitKern.setArg(6, clFeaturesBuff);
+  refitKern.setArg(7, FeatDim);
+  refitKern.setArg(8, clThrsBuff);
+  refitKern.setArg(9, clPosteriorsBuff);
+  refitKern.setArg(10, clNodesIDImg);
+  refitKern.setArg(11, nClasses);
+  refitKern.setArg(12, clHistogramBuff);
+  refitKern.setArg(13, cl::Local(sizeof(FeatType)*WG_PREDICT_WIDTH*WG_PREDICT_HEIGHT*FeatDim));
+
+  // Push each image through the tree: writes are not blocking (the in-order queue serializes
+  // them with the previous launch), but for the sampled pixels mask which is reused
+  std::vector<unsigned char> samplesMask;
+  cl::size_t<3> origin, region;
+  origin[0]=0; origin[1]=0; origin[2]=0;
+  for (unsigned int i=0; i<tsImages.size(); i++)
+  {
+    const TrainingSetImage<ImgType, nChannels> &currImage = tsImages[i];
+    unsigned int width = currImage.getWidth(), height = currImage.getHeight();
+    unsigned int fillWidth = (width%WG_PREDICT_WIDTH) ? WG_PREDICT_WIDTH-(width%WG_PREDICT_WIDTH) : 0;
+    unsigned int fillHeight = (height%WG_PREDICT_HEIGHT) ? WG_PREDICT_HEIGHT-(height%WG_PREDICT_HEIGHT) : 0;
+
+    region[0]=width; region[1]=height; region[2]=(nChannels<=4) ? 1 : nChannels;
+    if (nChannels<=4)
+    {
+      m_clQueue1.enqueueWriteImage(*reinterpret_cast<cl::Image2D*>(clImg), CL_FALSE,
+				   origin, region, 0, 0, (void*)currImage.getData());
+    }
+    else
+    {
+      m_clQueue1.enqueueWriteImage(*reinterpret_cast<cl::Image3D*>(clImg), CL_FALSE,
+				   origin, region, 0, 0, (void*)currImage.getData());
+    }
+
+    region[2] = 1;
+    if (allLabeledPixels)
+    {
+      m_clQueue1.enqueueWriteImage(clLabelsImg, CL_FALSE, origin, region, 0, 0,
+				   (void*)currImage.getLabels());
+    }
+    else
+    {
+      samplesMask.assign(width*height, 0);
+      for (unsigned int s=0; s<currImage.getNSamples(); s++)
+      {
+	unsigned int id = currImage.getSamples()[s];
+	samplesMask[id] = currImage.getLabels()[id];
+      }
+      m_clQueue1.enqueueWriteImage(clLabelsImg, CL_TRUE, origin, region, 0, 0,
+				   (void*)&samplesMask[0]);
+    }
+
+    refitKern.setArg(3, width);
+    refitKern.setArg(4, height);
+    m_clQueue1.enqueueNDRangeKernel(refitKern, cl::NullRange,
+				    cl::NDRange(width+fillWidth, height+fillHeight),
+				    cl::NDRange(WG_PREDICT_WIDTH, WG_PREDICT_HEIGHT));
+  }
+  m_clQueue1.enqueueReadBuffer(clHistogramBuff, CL_TRUE, 0, nNodes*nClasses*sizeof(cl_uint),
+			       (void*)&histogram[0]);
+  delete clImg;
+
+  // Propagate leaf counts up to the root and replace the posteriors of the nodes reached
+  // by at least one pixel (others keep the training ones)
+  for (int n=nNodes-1; n>=0; n--)
+  {
+    const TreeNode<FeatType, FeatDim> &currNode = tree.getNode(n);
+    if (*currNode.m_leftChild==-2) continue;
+
+    unsigned int *nodeHistogram = &histogram[n*nClasses];
+    if (*currNode.m_leftChild>0)
+    {
+      for (unsigned int l=0; l<nClasses; l++)
+      {
+	nodeHistogram[l] = histogram[(*currNode.m_leftChild)*nClasses+l]+
+	  histogram[(*currNode.m_leftChild+1)*nClasses+l];
+      }
+    }
+
+    unsigned int nodeTotSamples = 0;
+    for (unsigned int l=0; l<nClasses; l++) nodeTotSamples += nodeHistogram[l];
+    if (!nodeTotSamples) continue;
+    for (unsigned int l=0; l<nClasses; l++)
+    {
+      currNode.m_posterior[l] = ((float)nodeHistogram[l])/nodeTotSamples;
+    }
+  }
+
+  boost::chrono::duration<double> refitTime =
+    boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now()-
+								 refitStart);
+  BOOST_LOG_TRIVIAL(info) << "Tree " << tree.getID() << " posteriors refit in "
+			  << refitTime.count() << " seconds";
+}
@@ -18,11 +18,26 @@
  ******************************************************************************/
 
 #include <algorithm>
-#include <queue>
 #include <pthread.h>
 #include <boost/chrono/chrono.hpp>
 #include <boost/log/trivial.hpp>
-#include <emmintrin.h>
+#include <padenti/histogram_update.hpp>
+#include <padenti/spsc_ring.hpp>
+
+
+// OpenCL events of a single image processed by the training pipeline
+struct PerImageEvents
+{
+  cl::Event startWrite;
+  cl::Event endWrite;
+  cl::Event startCompute;
+  cl::Event endCompute;
+  cl::Event startRead;
+  cl::Event endRead;
+  bool predict;
+  bool pending;
+};
+
 
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
@@ -31,12 +46,14 @@ struct ConsumerProducerData
   int *nodesIDImg;
   unsigned int maxImgWidth;
   unsigned int maxImgHeight;
-  unsigned int *perNodeTotSamples;
   unsigned int *perClassTotSamples;
   boost::unordered_map<int, int> *frontierIdxMap;
   unsigned int **histogram;
   unsigned char *perImgHistogram;
   size_t perImgHistogramStride;
+  size_t perSampleHistogramSize;
+  std::vector<std::vector<FeatType> > *nodeResponses;
+  std::vector<std::vector<unsigned char> > *nodeLabels;
   const TrainingSet<ImgType, nChannels> *trainingSet;
   bool *skippedTsImg;
   bool *toSkipTsImg;
@@ -45,15 +62,53 @@ struct ConsumerProducerData
   unsigned int frontierOffset;
   unsigned int startNode;
   unsigned int endNode;
-  pthread_mutex_t *fifoMtx;
-  pthread_cond_t *fifoCond;
-  std::queue<int> *fifoQueue;
+  SPSCRing *fifoRing;
+  PerImageEvents *fifoEvents;
+  bool *tsImgSlices;
+  unsigned int tsImgSlicesStride;
+  const std::vector<unsigned int> *sliceStartNodes;
+  double histogramUpdateTime; // output: total global histogram update time (seconds)
+  Tracer *tracer;
 };
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
 void *_updateGlobalHistogram(void *_data);
 
 
+template <typename ImgType, unsigned int nChannels>
+struct StagingData
+{
+  const TrainingSet<ImgType, nChannels> *trainingSet;
+  bool *skippedTsImg;
+  ImgType *tsImgPinnPtr;
+  unsigned char *tsLabelsImgPinnPtr;
+  unsigned int *tsSamplesBuffPinnPtr;
+  size_t tsImgPinnStride;
+  size_t tsLabelsImgPinnStride;
+  size_t tsSamplesBuffPinnStride;
+  SPSCRing *stagingRing;
+  cl::Event *stagingWriteEvents;
+  Tracer *tracer;
+};
+template <typename ImgType, unsigned int nChannels>
+void *_stageTrainingSet(void *_data);
+
+
+inline void _updateTraversalTimes(const PerImageEvents &events,
+				  cl_ulong &totWriteTime, cl_ulong &totComputeTime,
+				  cl_ulong &totReadTime)
+{
+  totWriteTime += events.endWrite.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+    events.startWrite.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+  totComputeTime += events.endCompute.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+    ((events.predict) ? events.startCompute.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
+                        events.endCompute.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+  totReadTime += events.endRead.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+    ((events.predict) ? events.startRead.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
+                        events.endRead.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+}
+
+
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
 void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_traverseTrainingSet(
@@ -61,62 +116,153 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_traverseTr
   const TreeTrainerParameters<FeatType, FeatDim> &params,
   unsigned int currDepth, unsigned int currSlice)
 {
+  TraceScope traceScope(m_tracer, "traverseTrainingSet", "train");
   size_t perNodeHistogramSize = params.nFeatures*params.nThresholds*nClasses;
-  size_t perImgHistogramStride = m_maxTsImgSamples*params.nFeatures*params.nThresholds;
+  // Per-image histograms store a byte bin index per (sample, feature) pair, or the raw
+  // feature response with exact split search
+  size_t perSampleHistogramSize = params.nFeatures*
+    ((params.randomThrSampling) ? sizeof(cl_uchar) : sizeof(FeatType));
+  size_t perImgHistogramStride = m_maxTsImgSamples*perSampleHistogramSize;
   unsigned int frontierSize = m_frontierIdxMap.size();
-  unsigned int frontierOffset = currSlice*m_histogramSize;
+  unsigned int frontierOffset = m_sliceOffsets[currSlice];
+  unsigned int nPipelineSlots = m_clPipelineQueues.size();
+  unsigned int fifoSize = m_internalParams.histogramFifoSize;
 
   unsigned int startNode = m_frontier[frontierOffset];
-  unsigned int totNodes = ((frontierOffset+m_histogramSize)>frontierSize) ? \
-    (frontierSize%m_histogramSize) : m_histogramSize;
+  unsigned int totNodes = m_sliceOffsets[currSlice+1]-frontierOffset;
   unsigned int endNode = m_frontier[frontierOffset+totNodes-1];
+  unsigned int nSlices = m_sliceOffsets.size()-1;
+
+  // Images to skip: during the first slice, visit all the images not skipped at the
+  // previous depth and index the slices reached by their samples. During the following
+  // slices, visit only the images with at least one sample inside the slice.
+  bool *skippedTsImg = m_skippedTsImg;
+  std::vector<unsigned int> sliceStartNodes;
+  if (nSlices>1 && !currSlice)
+  {
+    for (unsigned int i=0; i<nSlices; i++)
+    {
+      sliceStartNodes.push_back(m_frontier[m_sliceOffsets[i]]);
+    }
+    // Sentinel: first node after the last slice
+    sliceStartNodes.push_back(m_frontier[frontierSize-1]+1);
+  }
+  else if (currSlice)
+  {
+    unsigned int nSkipped = 0;
+    for (unsigned int i=0; i<trainingSet.getImages().size(); i++)
+    {
+      m_sliceSkippedTsImg[i] = m_skippedTsImg[i] || !m_tsImgSlices[i*m_maxSlices+currSlice];
+      if (m_sliceSkippedTsImg[i]) nSkipped++;
+    }
+    skippedTsImg = m_sliceSkippedTsImg;
+
+    BOOST_LOG_TRIVIAL(info) << "Slice " << currSlice << ": " << nSkipped << " of "
+			    << trainingSet.getImages().size() << " images skipped";
+  }
+
+  // Generate the features/thresholds of the slice nodes once, instead of regenerating
+  // them for each sample of each image
+  std::fill_n(m_nodeRowMap, endNode-startNode+1, -1);
+  for (unsigned int i=0; i<totNodes; i++)
+  {
+    m_nodeRowMap[m_frontier[frontierOffset+i]-startNode] = i;
+  }
+  m_clQueue1.enqueueWriteBuffer(m_clSliceNodesBuff, CL_FALSE, 0, totNodes*sizeof(cl_int),
+				(void*)(m_frontier+frontierOffset));
+  m_clQueue1.enqueueWriteBuffer(m_clNodeRowMapBuff, CL_FALSE, 0,
+				(endNode-startNode+1)*sizeof(cl_int), (void*)m_nodeRowMap);
+  m_clQueue1.enqueueNDRangeKernel(m_clFeatThrTablesKern,
+				  cl::NullRange,
+				  cl::NDRange(totNodes, params.nFeatures),
+				  cl::NullRange);
+  m_clQueue1.finish();
 
   // Fill global histogram with zeros
-  #pragma omp parallel for
-  for (int i=0; i<totNodes; i++) std::fill_n(m_histogram[i], perNodeHistogramSize, 0);
+  // Note: on Linux zeroing is lazy, i.e. pages are zero-filled when first touched by
+  // the consumer thread and hence allocated on its NUMA node
+  if (params.randomThrSampling) m_histogramArena.clear(totNodes*perNodeHistogramSize);
+  for (unsigned int i=0; i<m_nodeResponses.size(); i++)
+  {
+    m_nodeResponses[i].clear();
+    m_nodeLabels[i].clear();
+  }
+
+  // At depth 1 all samples reach the root node: predicted nodes are not read back
+  if (currDepth==1)
+  {
+    std::fill_n(m_clTsNodesIDImgPinnPtr, fifoSize*m_maxTsImgWidth*m_maxTsImgHeight, 0);
+  }
 
   // Consumer-producer stuff init
-  std::queue<int> fifoQueue;
-  pthread_mutex_t fifoMtx = PTHREAD_MUTEX_INITIALIZER;
-  pthread_cond_t fifoCond = PTHREAD_COND_INITIALIZER;
+  SPSCRing fifoRing(fifoSize);
+  std::vector<PerImageEvents> fifoEvents(fifoSize);
+  for (unsigned int q=0; q<fifoSize; q++) fifoEvents[q].pending = false;
   struct ConsumerProducerData<ImgType, nChannels, FeatType, FeatDim, nClasses> consumerProducerData;
   consumerProducerData.nodesIDImg = m_clTsNodesIDImgPinnPtr;
   consumerProducerData.maxImgWidth = m_maxTsImgWidth;
   consumerProducerData.maxImgHeight = m_maxTsImgHeight;
-  consumerProducerData.perNodeTotSamples = m_perNodeTotSamples;
   consumerProducerData.perClassTotSamples = m_perClassTotSamples;
   consumerProducerData.frontierIdxMap = &m_frontierIdxMap;
   consumerProducerData.histogram = m_histogram;
   consumerProducerData.perImgHistogram = m_clPerImgHistBuffPinnPtr;
   consumerProducerData.perImgHistogramStride = perImgHistogramStride;
+  consumerProducerData.perSampleHistogramSize = perSampleHistogramSize;
+  consumerProducerData.nodeResponses = (params.randomThrSampling) ? NULL : &m_nodeResponses;
+  consumerProducerData.nodeLabels = &m_nodeLabels;
   consumerProducerData.trainingSet = &trainingSet;
-  consumerProducerData.skippedTsImg = m_skippedTsImg;
+  consumerProducerData.skippedTsImg = skippedTsImg;
   consumerProducerData.toSkipTsImg = m_toSkipTsImg;
   consumerProducerData.params = &params;
   consumerProducerData.currDepth = currDepth;
   consumerProducerData.frontierOffset = frontierOffset;
   consumerProducerData.startNode = startNode;
   consumerProducerData.endNode = endNode;
-  consumerProducerData.fifoMtx = &fifoMtx;
-  consumerProducerData.fifoCond = &fifoCond;
-  consumerProducerData.fifoQueue = &fifoQueue;
-
-
-  // Start the consumer
-  int queueIdx=0;
-  pthread_t consumer;
+  consumerProducerData.fifoRing = &fifoRing;
+  consumerProducerData.fifoEvents = &fifoEvents[0];
+  consumerProducerData.tsImgSlices = m_tsImgSlices;
+  consumerProducerData.tsImgSlicesStride = m_maxSlices;
+  consumerProducerData.sliceStartNodes = sliceStartNodes.empty() ? NULL : &sliceStartNodes;
+  consumerProducerData.histogramUpdateTime = 0;
+  consumerProducerData.tracer = m_tracer;
+
+  // Host staging stuff init: images are copied to pinned memory ahead of time by a
+  // dedicated thread
+  SPSCRing stagingRing(nPipelineSlots);
+  std::vector<cl::Event> stagingWriteEvents(nPipelineSlots);
+  struct StagingData<ImgType, nChannels> stagingData;
+  stagingData.trainingSet = &trainingSet;
+  stagingData.skippedTsImg = skippedTsImg;
+  stagingData.tsImgPinnPtr = m_clTsImgPinnPtr;
+  stagingData.tsLabelsImgPinnPtr = m_clTsLabelsImgPinnPtr;
+  stagingData.tsSamplesBuffPinnPtr = m_clTsSamplesBuffPinnPtr;
+  stagingData.tsImgPinnStride = m_maxTsImgWidth*m_maxTsImgHeight*nChannels;
+  stagingData.tsLabelsImgPinnStride = m_maxTsImgWidth*m_maxTsImgHeight;
+  stagingData.tsSamplesBuffPinnStride = m_maxTsImgSamples;
+  stagingData.stagingRing = &stagingRing;
+  stagingData.stagingWriteEvents = &stagingWriteEvents[0];
+  stagingData.tracer = m_tracer;
+
+
+  // Start the consumer and the staging thread
+  pthread_t consumer, stager;
   pthread_create(&consumer, NULL,
 		 _updateGlobalHistogram<ImgType, nChannels, FeatType, FeatDim, nClasses>,
 		 &consumerProducerData);
+  pthread_create(&stager, NULL, _stageTrainingSet<ImgType, nChannels>, &stagingData);
 
 
-  // Start the producer
-  
-  // OpenCL events for timing purposes
-  cl::Event startWriteEvent1, endWriteEvent1, startWriteEvent2, endWriteEvent2;
-  cl::Event startComputeEvent1, endComputeEvent1, startComputeEvent2, endComputeEvent2;
-  cl::Event startReadEvent, endReadEvent;
+  // Start the producer: each staged image is assigned to a pipeline slot (i.e. a command
+  // queue and its device objects) and its results are read back into a fifo slot. The
+  // producer never waits for device completion: fifo slots are published as soon as
+  // reads are enqueued and the consumer waits on their read events.
   cl_ulong totWriteTime=0, totComputeTime=0, totReadTime=0;
+  TrainingDepthStats &depthStats = m_stats.depths.back();
+
+  // Tracing: all the commands get an event, the ones not used for timing share this one
+  Tracer *tracer = (m_tracer && m_tracer->isEnabled()) ? m_tracer : NULL;
+  cl::Event traceEvent;
+  cl::Event *traceEventPtr = (tracer) ? &traceEvent : NULL;
   
   int imgID=0, fillWidth, fillHeight;
   cl::size_t<3> origin, region;
@@ -127,16 +273,40 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_traverseTr
   for (typename std::vector<TrainingSetImage<ImgType, nChannels> >::const_iterator it=tsImages.begin();
        it!=tsImages.end(); ++it,++imgID)
   {
-    const TrainingSetImage<ImgType, nChannels> &currImage = *it;
-
-    cl::CommandQueue *weCLQueue = (imgID%2) ? &m_clQueue2 : &m_clQueue1;
-    cl::CommandQueue *rCLQueue = (imgID%2) ? &m_clQueue1 : &m_clQueue2;
-    size_t clPinnMemWOffset = (imgID%2) ? 1 : 0;
-
-
-    if (!m_skippedTsImg[imgID])
+    if (skippedTsImg[imgID])
     {
-    // ************ FIRST QUEUE: WRITE AND KERNELS LAUNCH *************/
+      depthStats.nSkippedImages++;
+      continue;
+    }
+
+    const TrainingSetImage<ImgType, nChannels> &currImage = *it;
+    depthStats.nVisitedImages++;
+
+    // Wait for the image to be staged into pinned memory: the pipeline slot is the same
+    // of the staging slot
+    double waitStart = (tracer) ? tracer->now() : 0;
+    unsigned int p = stagingRing.acquire();
+    if (tracer) tracer->addHostEvent("waitStaging", "pipeline", waitStart, tracer->now());
+    cl::CommandQueue &clQueue = m_clPipelineQueues[p];
+    cl::Image &clTsImg = *m_clTsImg[p];
+    cl::Image2D &clTsLabelsImg = m_clTsLabelsImg[p];
+    cl::Image2D &clTsNodesIDImg = m_clTsNodesIDImg[p];
+    cl::Image2D &clPredictImg = m_clPredictImg[p];
+    cl::Buffer &clTsSamplesBuff = m_clTsSamplesBuff[p];
+    cl::Buffer &clPerImgHistBuff = m_clPerImgHistBuff[p];
+
+    // Wait for a free fifo slot where results will be read: its previous content
+    // has been consumed, hence its events are complete and timing info can be collected
+    if (tracer) waitStart = tracer->now();
+    unsigned int q = fifoRing.reserve();
+    if (tracer) tracer->addHostEvent("waitFifoSlot", "pipeline", waitStart, tracer->now());
+    TraceScope enqueueScope(tracer, "enqueueImage", "pipeline");
+    PerImageEvents &events = fifoEvents[q];
+    if (events.pending) _updateTraversalTimes(events, totWriteTime, totComputeTime, totReadTime);
+    events.predict = (currDepth!=1);
+    events.pending = true;
+
+    // ************ WRITE AND KERNELS LAUNCH *************/
     fillWidth = (currImage.getWidth()%WG_PREDICT_WIDTH) ? 
       WG_PREDICT_WIDTH-(currImage.getWidth()%WG_PREDICT_WIDTH) : 0;
     fillHeight = (currImage.getHeight()%WG_PREDICT_HEIGHT) ?
@@ -147,20 +317,18 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_traverseTr
     // the current image ROI instead of zeroing the whole image buffer 
     #ifdef CL_VERSION_1_2
       cl_int4 zeroColor = {0, 0, 0, 0};
-      weCLQueue->enqueueFillImage((imgID%2) ? m_clTsNodesIDImg2 : m_clTsNodesIDImg1,
-				  zeroColor, origin, region,
-				  NULL, (imgID%2) ? &startWriteEvent2 : &startWriteEvent1);
+      clQueue.enqueueFillImage(clTsNodesIDImg, zeroColor, origin, region,
+			       NULL, &events.startWrite);
+      if (tracer) tracer->addDeviceEvent("fillNodesID", events.startWrite, p);
     #else
       // TODO: find a way to use pinned memory or zero-ing kernel
       size_t rowPitch;
-      char *tmpNodesIDptr = (char*)weCLQueue->enqueueMapImage((imgID%2) ? m_clTsNodesIDImg2 : m_clTsNodesIDImg1,
-							      CL_TRUE, CL_MAP_WRITE,
-							      origin, region, &rowPitch, NULL,
-							      NULL, (imgID%2) ? &startWriteEvent2 :
-							                        &startWriteEvent1);
+      char *tmpNodesIDptr = (char*)clQueue.enqueueMapImage(clTsNodesIDImg,
+							   CL_TRUE, CL_MAP_WRITE,
+							   origin, region, &rowPitch, NULL,
+							   NULL, &events.startWrite);
       std::fill_n(tmpNodesIDptr, rowPitch*region[1], 0);
-      weCLQueue->enqueueUnmapMemObject((imgID%2) ? m_clTsNodesIDImg2 : m_clTsNodesIDImg1,
-				       tmpNodesIDptr);
+      clQueue.enqueueUnmapMemObject(clTsNodesIDImg, tmpNodesIDptr);
     #endif
 
 
@@ -169,77 +337,73 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_traverseTr
     /** \todo zero filling of images */
     region[0]=currImage.getWidth(); region[1]=currImage.getHeight();
     region[2] = (nChannels<=4) ? 1 : nChannels;
-    std::copy(currImage.getData(), currImage.getData()+region[0]*region[1]*nChannels,
-	      m_clTsImgPinnPtr+clPinnMemWOffset*region[0]*region[1]*nChannels);
     if (nChannels<=4)
     {
-      weCLQueue->enqueueWriteImage(*reinterpret_cast<cl::Image2D*>((imgID%2) ?
-								   m_clTsImg2 : m_clTsImg1),
-				   CL_FALSE,
-				   origin, region, 0, 0,
-				   (void*)(m_clTsImgPinnPtr +
-					   clPinnMemWOffset*region[0]*region[1]*nChannels));
+      clQueue.enqueueWriteImage(*reinterpret_cast<cl::Image2D*>(&clTsImg),
+				CL_FALSE,
+				origin, region, 0, 0,
+				(void*)(m_clTsImgPinnPtr + p*stagingData.tsImgPinnStride),
+				NULL, traceEventPtr);
     }
     else
     {
-      weCLQueue->enqueueWriteImage(*reinterpret_cast<cl::Image3D*>((imgID%2) ?
-								   m_clTsImg2 : m_clTsImg1),
-				   CL_FALSE,
-				   origin, region, 0, 0,
-				   (void*)(m_clTsImgPinnPtr +
-					   clPinnMemWOffset*region[0]*region[1]*nChannels));
+      clQueue.enqueueWriteImage(*reinterpret_cast<cl::Image3D*>(&clTsImg),
+				CL_FALSE,
+				origin, region, 0, 0,
+				(void*)(m_clTsImgPinnPtr + p*stagingData.tsImgPinnStride),
+				NULL, traceEventPtr);
     }
+    if (tracer) tracer->addDeviceEvent("writeImage", traceEvent, p);
 
     region[2] = 1;
-    std::copy(currImage.getLabels(), currImage.getLabels()+region[0]*region[1],
-	      m_clTsLabelsImgPinnPtr+clPinnMemWOffset*region[0]*region[1]);
-    weCLQueue->enqueueWriteImage((imgID%2) ? m_clTsLabelsImg2 : m_clTsLabelsImg1,
-				 CL_FALSE,
-				 origin, region, 0, 0,
-				 (void*)(m_clTsLabelsImgPinnPtr + 
-					 clPinnMemWOffset*region[0]*region[1]));
-    std::copy(currImage.getSamples(), currImage.getSamples()+currImage.getNSamples(),
-	      m_clTsSamplesBuffPinnPtr+clPinnMemWOffset*currImage.getNSamples());
-    weCLQueue->enqueueWriteBuffer((imgID%2) ? m_clTsSamplesBuff2 : m_clTsSamplesBuff1,
-				  CL_FALSE,
-				  0, currImage.getNSamples()*sizeof(cl_uint),
-				  (void*)(m_clTsSamplesBuffPinnPtr + 
-					  clPinnMemWOffset*currImage.getNSamples()),
-				  NULL, (imgID%2) ? &endWriteEvent2 : &endWriteEvent1);
+    clQueue.enqueueWriteImage(clTsLabelsImg,
+			      CL_FALSE,
+			      origin, region, 0, 0,
+			      (void*)(m_clTsLabelsImgPinnPtr + p*stagingData.tsLabelsImgPinnStride),
+			      NULL, traceEventPtr);
+    if (tracer) tracer->addDeviceEvent("writeLabels", traceEvent, p);
+    clQueue.enqueueWriteBuffer(clTsSamplesBuff,
+			       CL_FALSE,
+			       0, currImage.getNSamples()*sizeof(cl_uint),
+			       (void*)(m_clTsSamplesBuffPinnPtr + p*stagingData.tsSamplesBuffPinnStride),
+			       NULL, &events.endWrite);
+    if (tracer) tracer->addDeviceEvent("writeSamples", events.endWrite, p);
+
+    // Give back the staging slot: the staging thread waits for the writes to complete
+    // before overwriting it
+    stagingWriteEvents[p] = events.endWrite;
+    stagingRing.release();
     
     // Per-image prediction (i.e. compute samples end nodes)
     if (currDepth!=1)
     { 
       if (nChannels<=4)
       {
-	m_clPredictKern.setArg(0, *reinterpret_cast<cl::Image2D*>((imgID%2) ?
-								  m_clTsImg2 : m_clTsImg1));
+	m_clPredictKern.setArg(0, *reinterpret_cast<cl::Image2D*>(&clTsImg));
       }
       else
       {
-	m_clPredictKern.setArg(0, *reinterpret_cast<cl::Image3D*>((imgID%2) ?
-								  m_clTsImg2 : m_clTsImg1));
+	m_clPredictKern.setArg(0, *reinterpret_cast<cl::Image3D*>(&clTsImg));
       }
-      m_clPredictKern.setArg(1, (imgID%2) ? m_clTsLabelsImg2 : m_clTsLabelsImg1);
+      m_clPredictKern.setArg(1, clTsLabelsImg);
       m_clPredictKern.setArg(3, currImage.getWidth());
       m_clPredictKern.setArg(4, currImage.getHeight());
-      m_clPredictKern.setArg(10, (imgID%2) ? m_clTsNodesIDImg2 : m_clTsNodesIDImg1);
-      m_clPredictKern.setArg(11, (imgID%2) ? m_clPredictImg2 : m_clPredictImg1);
+      m_clPredictKern.setArg(10, clTsNodesIDImg);
+      m_clPredictKern.setArg(11, clPredictImg);
 
       for (unsigned int d=0; d<currDepth-1; d++)
       {
-	weCLQueue->enqueueNDRangeKernel(m_clPredictKern,
-					cl::NullRange,
-					cl::NDRange(currImage.getWidth()+fillWidth,
-						    currImage.getHeight()+fillHeight),
-					//cl::NDRange(WG_WIDTH, WG_HEIGHT),
-					cl::NDRange(WG_PREDICT_WIDTH, WG_PREDICT_HEIGHT),
-					NULL,
-					(d==0) ? ((imgID%2) ? &startComputeEvent2 :
-                                                              &startComputeEvent1) : NULL);
-	weCLQueue->enqueueCopyImage((imgID%2) ? m_clPredictImg2 : m_clPredictImg1,
-				    (imgID%2) ? m_clTsNodesIDImg2 : m_clTsNodesIDImg1,
-				    origin, origin, region);
+	clQueue.enqueueNDRangeKernel(m_clPredictKern,
+				     cl::NullRange,
+				     cl::NDRange(currImage.getWidth()+fillWidth,
+						 currImage.getHeight()+fillHeight),
+				     cl::NDRange(WG_PREDICT_WIDTH, WG_PREDICT_HEIGHT),
+				     NULL,
+				     (d==0) ? &events.startCompute : traceEventPtr);
+	if (tracer) tracer->addDeviceEvent("predict", (d==0) ? events.startCompute : traceEvent, p);
+	clQueue.enqueueCopyImage(clPredictImg, clTsNodesIDImg, origin, origin, region,
+				 NULL, traceEventPtr);
+	if (tracer) tracer->addDeviceEvent("copyNodesID", traceEvent, p);
       }
     }
 
@@ -248,192 +412,93 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_traverseTr
     /** \todo Assure number of samples/#features are multiple of 8 */
     if (nChannels<=4)
     {
-      m_clPerImgHistKern.setArg(0, *reinterpret_cast<cl::Image2D*>((imgID%2) ?
-								   m_clTsImg2 : m_clTsImg1));
+      m_clPerImgHistKern.setArg(0, *reinterpret_cast<cl::Image2D*>(&clTsImg));
     }
     else
     {
-      m_clPerImgHistKern.setArg(0, *reinterpret_cast<cl::Image3D*>((imgID%2) ?
-								   m_clTsImg2 : m_clTsImg1));
+      m_clPerImgHistKern.setArg(0, *reinterpret_cast<cl::Image3D*>(&clTsImg));
     }
     m_clPerImgHistKern.setArg(2, currImage.getWidth());
     m_clPerImgHistKern.setArg(3, currImage.getHeight());
-    m_clPerImgHistKern.setArg(4, (imgID%2) ? m_clTsLabelsImg2 : m_clTsLabelsImg1);
-    m_clPerImgHistKern.setArg(5, (imgID%2) ? m_clTsNodesIDImg2 : m_clTsNodesIDImg1);
-    m_clPerImgHistKern.setArg(6, (imgID%2) ? m_clTsSamplesBuff2 : m_clTsSamplesBuff1);
+    m_clPerImgHistKern.setArg(4, clTsLabelsImg);
+    m_clPerImgHistKern.setArg(5, clTsNodesIDImg);
+    m_clPerImgHistKern.setArg(6, clTsSamplesBuff);
     m_clPerImgHistKern.setArg(7, currImage.getNSamples());
-    m_clPerImgHistKern.setArg(14, (imgID%2) ? m_clPerImgHistBuff2 : m_clPerImgHistBuff1);
-    m_clPerImgHistKern.setArg(16, startNode);
-    m_clPerImgHistKern.setArg(17, endNode);
-    weCLQueue->enqueueNDRangeKernel(m_clPerImgHistKern,
-				    cl::NullRange,
-				    cl::NDRange(currImage.getNSamples(), params.nFeatures),
-				    //cl::NDRange(WG_WIDTH, WG_HEIGHT),
-				    cl::NDRange(WG_LHIST_UPDATE_HEIGHT, WG_LHIST_UPDATE_WIDTH),
-				    NULL, (imgID%2) ? &endComputeEvent2 : &endComputeEvent1);
-    }
-
-    // ************ SECOND QUEUE: READ PREVIOUS RESULTS *************/
-    if (it!=tsImages.begin() && !m_skippedTsImg[imgID-1])
+    m_clPerImgHistKern.setArg(13, clPerImgHistBuff);
+    m_clPerImgHistKern.setArg(14, startNode);
+    m_clPerImgHistKern.setArg(15, endNode);
+    clQueue.enqueueNDRangeKernel(m_clPerImgHistKern,
+				 cl::NullRange,
+				 cl::NDRange(currImage.getNSamples(), params.nFeatures),
+				 cl::NDRange(WG_LHIST_UPDATE_HEIGHT, WG_LHIST_UPDATE_WIDTH),
+				 NULL, &events.endCompute);
+    if (tracer) tracer->addDeviceEvent("perImageHistogram", events.endCompute, p);
+
+    // ************ READ RESULTS INTO THE FIFO SLOT *************/
+    if (currDepth!=1)
     {
-      const TrainingSetImage<ImgType, nChannels> &prevImage = *(it-1);
-      fillWidth = (prevImage.getWidth()%WG_PREDICT_WIDTH) ?
-	WG_PREDICT_WIDTH-(prevImage.getWidth()%WG_PREDICT_WIDTH) : 0;
-      fillHeight = (prevImage.getHeight()%WG_PREDICT_HEIGHT) ?
-	WG_PREDICT_HEIGHT-(prevImage.getHeight()%WG_PREDICT_HEIGHT) : 0;
-      region[0]=prevImage.getWidth(); region[1]=prevImage.getHeight();
-
-      // Producer
-      // Check if the queue is full
-      pthread_mutex_lock(&fifoMtx);
-      //if (fifoQueue.size()==GLOBAL_HISTOGRAM_FIFO_SIZE)
-      while (fifoQueue.size()==GLOBAL_HISTOGRAM_FIFO_SIZE)
-      {
-	//std::cout << "P: queue full, wait ..."<< std::endl;
-	pthread_cond_wait(&fifoCond, &fifoMtx);
-      }
-      pthread_mutex_unlock(&fifoMtx);
-
-
-      if (currDepth==1 && it==tsImages.begin())
-      {
-	std::fill_n(m_clTsNodesIDImgPinnPtr,
-		    GLOBAL_HISTOGRAM_FIFO_SIZE*m_maxTsImgWidth*m_maxTsImgHeight, 0);
-      }
-      else
-      {
-	rCLQueue->enqueueReadImage((imgID%2) ? m_clTsNodesIDImg1 : m_clTsNodesIDImg2,
-				   CL_TRUE,
-				   origin, region, 0, 0,
-				   (void*)(m_clTsNodesIDImgPinnPtr+queueIdx*m_maxTsImgWidth*m_maxTsImgHeight),
-				   NULL, &startReadEvent);
-      }
-
-      // Read per-image histogram
-      rCLQueue->enqueueReadBuffer((imgID%2) ? m_clPerImgHistBuff1 : m_clPerImgHistBuff2,
-				  CL_TRUE,
-				  0,
-				  prevImage.getNSamples()*params.nFeatures*params.nThresholds*sizeof(cl_uchar),
-				  (void*)(m_clPerImgHistBuffPinnPtr+queueIdx*perImgHistogramStride),
-				  NULL, &endReadEvent);
-      
-      // Queue the current per-image histogram and predicted end nodes
-      pthread_mutex_lock(&fifoMtx);
-      fifoQueue.push(queueIdx);
-      //std::cout << "P: " << (queueIdx) << " produced" << std::endl;
-      queueIdx++;
-      queueIdx = queueIdx%GLOBAL_HISTOGRAM_FIFO_SIZE;
-      pthread_mutex_unlock(&fifoMtx);
-      pthread_cond_signal(&fifoCond);
-
-      // Update timing info
-      cl_ulong startTime, endTime;
-
-      startTime = (imgID%2) ? startWriteEvent1.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-                              startWriteEvent2.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-      endTime = (imgID%2) ? endWriteEvent1.getProfilingInfo<CL_PROFILING_COMMAND_END>() :
-                            endWriteEvent2.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-      totWriteTime += endTime-startTime;
-
-      startTime = (currDepth!=1) ? 
-	((imgID%2) ? startComputeEvent1.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-                     startComputeEvent2.getProfilingInfo<CL_PROFILING_COMMAND_START>()):
-	((imgID%2) ? endComputeEvent1.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-	             endComputeEvent2.getProfilingInfo<CL_PROFILING_COMMAND_START>());
-      endTime = (imgID%2) ? endComputeEvent1.getProfilingInfo<CL_PROFILING_COMMAND_END>() :
-                            endComputeEvent2.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-      totComputeTime += endTime-startTime;
-
-      startTime = (currDepth!=1) ?
-	startReadEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-	endReadEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-      endTime = endReadEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-      totReadTime += endTime-startTime;
+      clQueue.enqueueReadImage(clTsNodesIDImg,
+			       CL_FALSE,
+			       origin, region, 0, 0,
+			       (void*)(m_clTsNodesIDImgPinnPtr+q*m_maxTsImgWidth*m_maxTsImgHeight),
+			       NULL, &events.startRead);
+      if (tracer) tracer->addDeviceEvent("readNodesID", events.startRead, p);
     }
 
-    // Sync point: wait for computation to finish (reading is finished for sure since
-    // local histogram read is blocking)
-    if (!m_skippedTsImg[imgID])
-      if (imgID%2) endComputeEvent2.wait(); else endComputeEvent1.wait();
+    // Read per-image histogram
+    clQueue.enqueueReadBuffer(clPerImgHistBuff,
+			      CL_FALSE,
+			      0,
+			      currImage.getNSamples()*perSampleHistogramSize,
+			      (void*)(m_clPerImgHistBuffPinnPtr+q*perImgHistogramStride),
+			      NULL, &events.endRead);
+    if (tracer) tracer->addDeviceEvent("readHistogram", events.endRead, p);
+    clQueue.flush();
+
+    size_t nPixels = currImage.getWidth()*currImage.getHeight();
+    depthStats.bytesWritten += nPixels*(nChannels*sizeof(ImgType)+sizeof(cl_uchar))+
+      currImage.getNSamples()*sizeof(cl_uint);
+    depthStats.bytesRead += currImage.getNSamples()*perSampleHistogramSize+
+      ((currDepth!=1) ? nPixels*sizeof(cl_int) : 0);
+
+    // Queue the current per-image histogram and predicted end nodes: the consumer waits
+    // for the read to complete
+    fifoRing.commit();
   }
 
-  //************ Last image **********
-  --imgID;
-  if (!m_skippedTsImg[imgID])
-  {
-    const TrainingSetImage<ImgType, nChannels> &currImage = *(tsImages.end()-1);
-    cl::CommandQueue *rCLQueue = (imgID%2) ? &m_clQueue2 : &m_clQueue1;
-
-    fillWidth = (currImage.getWidth()%WG_PREDICT_WIDTH) ?
-      WG_PREDICT_WIDTH-(currImage.getWidth()%WG_PREDICT_WIDTH) : 0;
-    fillHeight = (currImage.getHeight()%WG_PREDICT_HEIGHT) ?
-      WG_PREDICT_HEIGHT-(currImage.getHeight()%WG_PREDICT_HEIGHT) : 0;
-    region[0]=currImage.getWidth(); region[1]=currImage.getHeight();
 
+  // DONE with local histograms
+  pthread_join(stager, NULL);
+  pthread_join(consumer, NULL);
 
-    pthread_mutex_lock(&fifoMtx);
-    while (fifoQueue.size()==GLOBAL_HISTOGRAM_FIFO_SIZE)
-    {
-      //std::cout << "P: queue full, wait ..."<< std::endl;
-      pthread_cond_wait(&fifoCond, &fifoMtx);
-    }
-    pthread_mutex_unlock(&fifoMtx);
-  
-    if (currDepth!=1)
+  // Rebuild per-threshold counters from the per-bin ones, i.e. the number of samples with
+  // a response lower or equal than the t-th threshold is the sum of bins [0, t]
+  HistogramAccumulateFunc accumulate = getHistogramAccumulateFunc();
+  size_t perClassHistogramSize = params.nFeatures*params.nThresholds;
+  #pragma omp parallel for
+  for (int i=0; i<(int)((params.randomThrSampling) ? totNodes*nClasses : 0); i++)
+  {
+    unsigned int *classHistogram = m_histogram[i/nClasses]+(i%nClasses)*perClassHistogramSize;
+    for (unsigned int t=1; t<params.nThresholds; t++)
     {
-      rCLQueue->enqueueReadImage((imgID%2) ? m_clTsNodesIDImg2 : m_clTsNodesIDImg1,
-				 CL_FALSE,
-				 origin, region, 0, 0,
-				 (void*)(m_clTsNodesIDImgPinnPtr+queueIdx*m_maxTsImgWidth*m_maxTsImgHeight),
-				 NULL, &startReadEvent);
+      accumulate(classHistogram+t*params.nFeatures, classHistogram+(t-1)*params.nFeatures,
+		 params.nFeatures);
     }
-
-    // Read per-image histogram
-    rCLQueue->enqueueReadBuffer((imgID%2) ? m_clPerImgHistBuff2 : m_clPerImgHistBuff1,
-				CL_TRUE,
-				0,
-				currImage.getNSamples()*params.nFeatures*params.nThresholds*sizeof(cl_uchar),
-				(void*)(m_clPerImgHistBuffPinnPtr+queueIdx*perImgHistogramStride),
-				NULL, &endReadEvent);
-  
-    // Queue the current per-image histogram and predicted end nodes
-    pthread_mutex_lock(&fifoMtx);
-    fifoQueue.push(queueIdx);
-    //std::cout << "P: " << (queueIdx) << " produced" << std::endl;
-    queueIdx++;
-    queueIdx = queueIdx%GLOBAL_HISTOGRAM_FIFO_SIZE;
-    pthread_mutex_unlock(&fifoMtx);
-    pthread_cond_signal(&fifoCond);
-  
-    cl_ulong startTime, endTime;
-
-    startTime = (imgID%2) ? startWriteEvent2.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-                            startWriteEvent1.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    endTime = (imgID%2) ? endWriteEvent2.getProfilingInfo<CL_PROFILING_COMMAND_END>() :
-                          endWriteEvent1.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    totWriteTime += endTime-startTime;
-
-    startTime = (currDepth!=1) ? 
-      ((imgID%2) ? startComputeEvent2.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-                   startComputeEvent1.getProfilingInfo<CL_PROFILING_COMMAND_START>()):
-      ((imgID%2) ? endComputeEvent2.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-                   endComputeEvent1.getProfilingInfo<CL_PROFILING_COMMAND_START>());
-    endTime = (imgID%2) ? endComputeEvent2.getProfilingInfo<CL_PROFILING_COMMAND_END>() :
-                          endComputeEvent1.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    totComputeTime += endTime-startTime;
-
-    startTime = (currDepth!=1) ?
-      startReadEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>() :
-      endReadEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    endTime = endReadEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    totReadTime += endTime-startTime;
   }
 
-
-  // DONE with local histograms
-  pthread_join(consumer, NULL);
+  // Collect timing info of the images still in the fifo
+  for (unsigned int q=0; q<fifoSize; q++)
+  {
+    if (fifoEvents[q].pending) _updateTraversalTimes(fifoEvents[q], totWriteTime,
+						     totComputeTime, totReadTime);
+  }
 
   
+  depthStats.writeTime += static_cast<double>(totWriteTime)*1.e-9;
+  depthStats.computeTime += static_cast<double>(totComputeTime)*1.e-9;
+  depthStats.readTime += static_cast<double>(totReadTime)*1.e-9;
+  depthStats.histogramUpdateTime += consumerProducerData.histogramUpdateTime;
+
   double totTime = static_cast<double>(totWriteTime)*1.e-9;
   BOOST_LOG_TRIVIAL(info) << "Total local histogram write time: "
 			  << totTime
@@ -456,6 +521,48 @@ void CLTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_traverseTr
 }
 
 
+template <typename ImgType, unsigned int nChannels>
+void *_stageTrainingSet(void *_data)
+{
+  StagingData<ImgType, nChannels> *data = (StagingData<ImgType, nChannels>*)_data;
+
+  const TrainingSet<ImgType, nChannels> &trainingSet = *data->trainingSet;
+  bool *skippedTsImg = data->skippedTsImg;
+  SPSCRing &stagingRing = *data->stagingRing;
+  cl::Event *stagingWriteEvents = data->stagingWriteEvents;
+  Tracer *tracer = (data->tracer && data->tracer->isEnabled()) ? data->tracer : NULL;
+  if (tracer) tracer->setThreadName("Stager");
+
+  int imgID = 0;
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &tsImages = trainingSet.getImages();
+  for (typename std::vector<TrainingSetImage<ImgType, nChannels> >::const_iterator it=tsImages.begin();
+       it!=tsImages.end(); ++it,++imgID)
+  {
+    if (skippedTsImg[imgID]) continue;
+
+    const TrainingSetImage<ImgType, nChannels> &currImage = *it;
+
+    // Wait for a free staging slot and for the device to be done with its previous content
+    double waitStart = (tracer) ? tracer->now() : 0;
+    unsigned int p = stagingRing.reserve();
+    if (stagingWriteEvents[p]()) stagingWriteEvents[p].wait();
+    if (tracer) tracer->addHostEvent("waitStagingSlot", "pipeline", waitStart, tracer->now());
+
+    TraceScope stageScope(tracer, "stageImage", "pipeline");
+    size_t imgSize = currImage.getWidth()*currImage.getHeight();
+    std::copy(currImage.getData(), currImage.getData()+imgSize*nChannels,
+	      data->tsImgPinnPtr+p*data->tsImgPinnStride);
+    std::copy(currImage.getLabels(), currImage.getLabels()+imgSize,
+	      data->tsLabelsImgPinnPtr+p*data->tsLabelsImgPinnStride);
+    std::copy(currImage.getSamples(), currImage.getSamples()+currImage.getNSamples(),
+	      data->tsSamplesBuffPinnPtr+p*data->tsSamplesBuffPinnStride);
+
+    stagingRing.commit();
+  }
+
+  return NULL;
+}
+
 
 template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
@@ -467,12 +574,14 @@ void *_updateGlobalHistogram(void *_data)
   int *nodesIDImg = data->nodesIDImg;
   unsigned int maxImgWidth = data->maxImgWidth;
   unsigned int maxImgHeight = data->maxImgHeight;
-  unsigned int *perNodeTotSamples = data->perNodeTotSamples;
   unsigned int *perClassTotSamples = data->perClassTotSamples;
-  boost::unordered_map<int, int> *frontierIdxMap = data->frontierIdxMap;
+  const boost::unordered_map<int, int> *frontierIdxMap = data->frontierIdxMap;
   unsigned int **histogram = data->histogram;
   unsigned char *perImgHistogram = data->perImgHistogram;
   size_t perImgHistogramStride = data->perImgHistogramStride;
+  size_t perSampleHistogramSize = data->perSampleHistogramSize;
+  std::vector<std::vector<FeatType> > *nodeResponses = data->nodeResponses;
+  std::vector<std::vector<unsigned char> > *nodeLabels = data->nodeLabels;
   const TrainingSet<ImgType, nChannels> &trainingSet = *data->trainingSet;
   bool *skippedTsImg = data->skippedTsImg;
   bool *toSkipTsImg = data->toSkipTsImg;
@@ -481,11 +590,15 @@ void *_updateGlobalHistogram(void *_data)
   unsigned int frontierOffset = data->frontierOffset;
   unsigned int startNode = data->startNode;
   unsigned int endNode = data->endNode;
-  pthread_mutex_t &fifoMtx = *data->fifoMtx;
-  pthread_cond_t &fifoCond = *data->fifoCond;
-  std::queue<int> &fifoQueue = *data->fifoQueue;
+  SPSCRing &fifoRing = *data->fifoRing;
+  PerImageEvents *fifoEvents = data->fifoEvents;
+  bool *tsImgSlices = data->tsImgSlices;
+  unsigned int tsImgSlicesStride = data->tsImgSlicesStride;
+  const std::vector<unsigned int> *sliceStartNodes = data->sliceStartNodes;
 
   boost::chrono::duration<double> totGlobHistUpdateTime(0);
+  Tracer *tracer = (data->tracer && data->tracer->isEnabled()) ? data->tracer : NULL;
+  if (tracer) tracer->setThreadName("Histogram consumer");
 
   int imgID = 0;
   const std::vector<TrainingSetImage<ImgType, nChannels> > &tsImages = trainingSet.getImages();
@@ -495,28 +608,24 @@ void *_updateGlobalHistogram(void *_data)
     if (skippedTsImg[imgID]) continue;
 
     const TrainingSetImage<ImgType, nChannels> &currImage = *it;
-    int queueIdx;
-
-    // Lock the queue and check if it's empty
-    pthread_mutex_lock(&fifoMtx);
-    while (fifoQueue.size()==0)
-    {
-      //std::cout << "C: queue empty ..." << std::endl;
-      pthread_cond_wait(&fifoCond, &fifoMtx);
-      // Get the id of the lastest unprocessed image histogram inside the queue
-    }
-    queueIdx = fifoQueue.front();
-    pthread_mutex_unlock(&fifoMtx);
+    // Wait for the lastest unprocessed image histogram inside the queue
+    double waitStart = (tracer) ? tracer->now() : 0;
+    unsigned int queueIdx = fifoRing.acquire();
+    fifoEvents[queueIdx].endRead.wait();
+    if (tracer) tracer->addHostEvent("waitResults", "pipeline", waitStart, tracer->now());
+    TraceScope updateScope(tracer, "histogramUpdate", "pipeline");
 
     boost::chrono::steady_clock::time_point startGlobHistUpdate = 
       boost::chrono::steady_clock::now();
 
     
     bool toSkipImg = true;
+    bool *currImgSlices = &tsImgSlices[imgID*tsImgSlicesStride];
+    if (sliceStartNodes) std::fill_n(currImgSlices, tsImgSlicesStride, false);
     size_t perImgOffset = queueIdx * perImgHistogramStride;
     size_t perImgNodeOffset = queueIdx*maxImgWidth*maxImgHeight;
     for (unsigned int s=0; s<currImage.getNSamples();
-	 s++, perImgOffset+=(params.nThresholds*params.nFeatures))
+	 s++, perImgOffset+=perSampleHistogramSize)
     {
       unsigned int id = currImage.getSamples()[s];
       int nodeID = nodesIDImg[perImgNodeOffset+id];
@@ -525,176 +634,63 @@ void *_updateGlobalHistogram(void *_data)
       // \todo move inside init 
       if (currDepth==1) perClassTotSamples[nodeID*nClasses+label]++;
 
-      // If the current sample ends up in a node that belongs to a less deep level, skip it
+      // Index the slice reached by the sample (frontier nodes are sorted, hence each slice
+      // spans a contiguous range of node IDs)
+      if (sliceStartNodes && nodeID>=(int)sliceStartNodes->front() &&
+	  nodeID<(int)sliceStartNodes->back())
+      {
+	currImgSlices[std::upper_bound(sliceStartNodes->begin(), sliceStartNodes->end(),
+				       (unsigned int)nodeID)-sliceStartNodes->begin()-1] = true;
+      }
+
+      // If the current sample ends up in a node that belongs to a less deep level or that
+      // is not trained (see _initFrontier), skip it
       // \todo Sampe skipping criteria inside per-image histogram update kernel?
-      if (nodeID<startNode || nodeID>endNode ||
-	  perNodeTotSamples[nodeID]<=params.perLeafSamplesThr) continue;
+      if (nodeID<startNode || nodeID>endNode) continue;
+      boost::unordered_map<int, int>::const_iterator frontierIt = frontierIdxMap->find(nodeID);
+      if (frontierIt==frontierIdxMap->end()) continue;
+      unsigned int row = frontierIt->second-frontierOffset;
 
-      size_t globalOffset = label * (params.nFeatures*params.nThresholds);
-      unsigned int *globalPtr = &histogram[frontierIdxMap->at(nodeID)-frontierOffset][globalOffset];
-      unsigned char *localPtr = &perImgHistogram[perImgOffset];
-
-      // SSE2 optimized version
-      // \todo Check for SSE2 availability
-      /*
-      __m128i globalCounter;
-      __m128i localCounter;
-      for (unsigned int t=0; t<params.nThresholds; t++)
+      toSkipImg = false;
+
+      // Exact split search: store the sample responses and label
+      if (nodeResponses)
       {
-	for (unsigned int f=0; f<params.nFeatures; f+=4, globalPtr+=4, localPtr+=4)
-	{
-	  globalCounter = _mm_loadu_si128(reinterpret_cast<__m128i*>(globalPtr));
-	  
-	  //localCounter = _mm_set_epi32(static_cast<int>(localPtr[3]),
-	  //			       static_cast<int>(localPtr[2]),
-	  //			       static_cast<int>(localPtr[1]),
-	  //			       static_cast<int>(localPtr[0]));
-
-	  localCounter = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr));
-	  localCounter = _mm_unpacklo_epi8(localCounter, _mm_setzero_si128());
-	  localCounter = _mm_unpacklo_epi16(localCounter, _mm_setzero_si128());
-
-	  //localCounter = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr));
-	  //localCounter = _mm_unpacklo_epi8(localCounter, localCounter);
-	  //localCounter = _mm_unpacklo_epi16(localCounter, localCounter);
-	  //localCounter = _mm_srai_epi32(localCounter, 24);
-
-	  globalCounter = _mm_add_epi32(globalCounter, localCounter);
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(globalPtr), globalCounter);
-	  //_mm_stream_si128(reinterpret_cast<__m128i*>(globalPtr), globalCounter);
-	}
+	const FeatType *responses = reinterpret_cast<const FeatType*>(&perImgHistogram[perImgOffset]);
+	(*nodeResponses)[row].insert((*nodeResponses)[row].end(),
+				     responses, responses+params.nFeatures);
+	(*nodeLabels)[row].push_back(label);
+	continue;
       }
-      */
 
-      
-      for (unsigned int t=0; t<params.nThresholds; t++)
+      size_t globalOffset = label * (params.nFeatures*params.nThresholds);
+      unsigned int *globalPtr = &histogram[row][globalOffset];
+      const unsigned char *localPtr = &perImgHistogram[perImgOffset];
+
+      // Per-bin update: only the counter of the bin holding the feature response is
+      // incremented (bin nThresholds, i.e. response greater than all the thresholds, is
+      // not stored). Per-threshold counters are rebuilt once the slice has been traversed
+      for (unsigned int f=0; f<params.nFeatures; f++)
       {
-	for (unsigned int f=0; f<params.nFeatures; f+=16, globalPtr+=16, localPtr+=16)
-	{
-	  __m128i globalCounter1, globalCounter2, globalCounter3, globalCounter4;
-	  __m128i localCounter1, localCounter2, localCounter3, localCounter4;
-	  
-	  globalCounter1 = _mm_loadu_si128(reinterpret_cast<__m128i*>(globalPtr));
-	  globalCounter2 = _mm_loadu_si128(reinterpret_cast<__m128i*>(globalPtr+4));
-	  globalCounter3 = _mm_loadu_si128(reinterpret_cast<__m128i*>(globalPtr+8));
-	  globalCounter4 = _mm_loadu_si128(reinterpret_cast<__m128i*>(globalPtr+12));
-	  
-	  localCounter1 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr));
-	  localCounter2 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr+4));
-	  localCounter3 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr+8));
-	  localCounter4 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr+12));
-
-
-	  localCounter1 = _mm_unpacklo_epi8(localCounter1, _mm_setzero_si128());
-	  localCounter1 = _mm_unpacklo_epi16(localCounter1, _mm_setzero_si128());
-
-	  localCounter2 = _mm_unpacklo_epi8(localCounter2, _mm_setzero_si128());
-	  localCounter2 = _mm_unpacklo_epi16(localCounter2, _mm_setzero_si128());
-
-	  localCounter3 = _mm_unpacklo_epi8(localCounter3, _mm_setzero_si128());
-	  localCounter3 = _mm_unpacklo_epi16(localCounter3, _mm_setzero_si128());
-
-	  localCounter4 = _mm_unpacklo_epi8(localCounter4, _mm_setzero_si128());
-	  localCounter4 = _mm_unpacklo_epi16(localCounter4, _mm_setzero_si128());
-
-
-	  //localCounter = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr));
-	  //localCounter = _mm_unpacklo_epi8(localCounter, localCounter);
-	  //localCounter = _mm_unpacklo_epi16(localCounter, localCounter);
-	  //localCounter = _mm_srai_epi32(localCounter, 24);
-
-	  globalCounter1 = _mm_add_epi32(globalCounter1, localCounter1);
-	  globalCounter2 = _mm_add_epi32(globalCounter2, localCounter2);
-	  globalCounter3 = _mm_add_epi32(globalCounter3, localCounter3);
-	  globalCounter4 = _mm_add_epi32(globalCounter4, localCounter4);
-
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(globalPtr), globalCounter1);
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(globalPtr+4), globalCounter2);
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(globalPtr+8), globalCounter3);
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(globalPtr+12), globalCounter4);
-	  //_mm_stream_si128(reinterpret_cast<__m128i*>(globalPtr), globalCounter);
-	}
+	unsigned int bin = localPtr[f];
+	if (bin<params.nThresholds) globalPtr[bin*params.nFeatures+f]++;
       }
-      
 
       /** \todo how to further improve throughput using OpenMP? */
-      /*
-      #pragma omp parallel for schedule(static,1) num_threads(4)
-      for (unsigned int t=0; t<params.nThresholds; t++)
-      {
-	//unsigned int *pvtGlobalPtr = globalPtr + t*params.nFeatures; 
-	//unsigned char *pvtLocalPtr = localPtr + t*params.nFeatures;
-
-	//for (unsigned int f=0; f<params.nFeatures; f+=16, pvtGlobalPtr+=16, pvtLocalPtr+=16)
-	for (unsigned int f=0; f<params.nFeatures; f+=16)
-	{
-	  __m128i globalCounter1, globalCounter2, globalCounter3, globalCounter4;
-	  __m128i localCounter1, localCounter2, localCounter3, localCounter4;
-	  
-	  unsigned int *pvtGlobalPtr = globalPtr + t*params.nFeatures + f; 
-	  unsigned char *pvtLocalPtr = localPtr + t*params.nFeatures + f;
-
-	  globalCounter1 = _mm_loadu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr));
-	  globalCounter2 = _mm_loadu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr+4));
-	  globalCounter3 = _mm_loadu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr+8));
-	  globalCounter4 = _mm_loadu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr+12));
-	  
-	  localCounter1 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(pvtLocalPtr));
-	  localCounter2 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(pvtLocalPtr+4));
-	  localCounter3 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(pvtLocalPtr+8));
-	  localCounter4 = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(pvtLocalPtr+12));
-
-
-	  localCounter1 = _mm_unpacklo_epi8(localCounter1, _mm_setzero_si128());
-	  localCounter1 = _mm_unpacklo_epi16(localCounter1, _mm_setzero_si128());
-
-	  localCounter2 = _mm_unpacklo_epi8(localCounter2, _mm_setzero_si128());
-	  localCounter2 = _mm_unpacklo_epi16(localCounter2, _mm_setzero_si128());
-
-	  localCounter3 = _mm_unpacklo_epi8(localCounter3, _mm_setzero_si128());
-	  localCounter3 = _mm_unpacklo_epi16(localCounter3, _mm_setzero_si128());
-
-	  localCounter4 = _mm_unpacklo_epi8(localCounter4, _mm_setzero_si128());
-	  localCounter4 = _mm_unpacklo_epi16(localCounter4, _mm_setzero_si128());
-
-
-	  //localCounter = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(localPtr));
-	  //localCounter = _mm_unpacklo_epi8(localCounter, localCounter);
-	  //localCounter = _mm_unpacklo_epi16(localCounter, localCounter);
-	  //localCounter = _mm_srai_epi32(localCounter, 24);
-
-	  globalCounter1 = _mm_add_epi32(globalCounter1, localCounter1);
-	  globalCounter2 = _mm_add_epi32(globalCounter2, localCounter2);
-	  globalCounter3 = _mm_add_epi32(globalCounter3, localCounter3);
-	  globalCounter4 = _mm_add_epi32(globalCounter4, localCounter4);
-
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr), globalCounter1);
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr+4), globalCounter2);
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr+8), globalCounter3);
-	  _mm_storeu_si128(reinterpret_cast<__m128i*>(pvtGlobalPtr+12), globalCounter4);
-	  //_mm_stream_si128(reinterpret_cast<__m128i*>(globalPtr), globalCounter);
-	}
-      }
-      */
-      
-      toSkipImg = false;
     }
     
     if (!toSkipImg) toSkipTsImg[imgID] = false;
     
     totGlobHistUpdateTime += boost::chrono::steady_clock::now() - startGlobHistUpdate;
 
-    // Dequeue the image histogram id and signal
-    pthread_mutex_lock(&fifoMtx);
-    //std::cout << "C: " << fifoQueue.front() << " consumed" << std::endl;
-    fifoQueue.pop();
-    pthread_mutex_unlock(&fifoMtx);
-    pthread_cond_signal(&fifoCond);
+    // Give the slot back to the producer
+    fifoRing.release();
   }
   
 
   boost::chrono::duration<double> totGlobHistUpdateSeconds = 
     boost::chrono::duration_cast<boost::chrono::duration<double> >(totGlobHistUpdateTime);
+  data->histogramUpdateTime = totGlobHistUpdateSeconds.count();
   
   BOOST_LOG_TRIVIAL(info) << "Total global histogram update time: " << totGlobHistUpdateSeconds.count()
                           //<< " seconds (avg: " << totGlobHistUpdateSeconds.count()/tsImages.size()
@@ -0,0 +1,129 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __CPU_TREE_TRAINER_HPP
+#define __CPU_TREE_TRAINER_HPP
+
+#include <vector>
+#include <padenti/tree_trainer.hpp>
+#include <padenti/host_feature.hpp>
+#include <padenti/histogram_arena.hpp>
+#include <padenti/prng.hpp>
+
+
+/*!
+ * \brief Tree trainer running on the host CPU threads, i.e. not requiring an OpenCL
+ * runtime.
+ *
+ * Training proceeds depth by depth as done by CLTreeTrainer: feature responses are
+ * computed by a HostFeature, each thread accumulates the samples it processes into its
+ * own node histograms, which are then merged by a tree-structured (pairwise) reduction
+ * using the SIMD accumulation functions of histogram_update.hpp. Best splits are searched
+ * on the host histograms.
+ *
+ * For the same tree ID, training set and parameters, the trained tree is identical to the
+ * CLTreeTrainer one with host split search (i.e. SPLIT_SEARCH_HOST) or exact thresholds,
+ * provided that the host feature returns the same responses as the OpenCL one.
+ *
+ * \tparam ImgType Image pixels type
+ * \tparam nChannels Number of image channels
+ * \tparam FeatType type of feature entries and threshold
+ * \tparam FeatDim dimension (i.e. number of entries) of the feature
+ * \tparam nClasses number of classes
+ */
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+class CPUTreeTrainer: public TreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>
+{
+private:
+  // Training sample: image, pixel and (0-based) label
+  struct Sample
+  {
+    unsigned int image;
+    unsigned int pixel;
+    unsigned char label;
+  };
+
+  const HostFeature<ImgType, nChannels, FeatType, FeatDim> *m_hostFeature;
+  unsigned int m_nThreads;
+  PRNGType m_prng;
+
+  // Samples still reaching a trainable node and the node they reach
+  std::vector<Sample> m_samples;
+  std::vector<int> m_samplesNode;
+  std::vector<unsigned int> m_perNodeTotSamples;
+  std::vector<unsigned int> m_perClassTotSamples;
+  std::vector<int> m_frontier;
+  // Frontier index of each node of the current depth (-1 if not trained)
+  std::vector<int> m_frontierIdx;
+  unsigned int m_levelStartNode;
+  std::vector<float> m_nLog2nTable;
+
+  // Per-thread histograms of the current slice nodes ([node][class][threshold][feature])
+  std::vector<HistogramArena*> m_threadHistograms;
+  size_t m_histogramSize;
+
+  CPUTreeTrainer(const CPUTreeTrainer &);
+  CPUTreeTrainer &operator=(const CPUTreeTrainer &);
+
+  void _initTrain(const Tree<FeatType, FeatDim, nClasses> &tree,
+		  const TrainingSet<ImgType, nChannels> &trainingSet,
+		  const TreeTrainerParameters<FeatType, FeatDim> &params,
+		  unsigned int startDepth, unsigned int endDepth);
+  unsigned int _initFrontier(const Tree<FeatType, FeatDim, nClasses> &tree,
+			     const TreeTrainerParameters<FeatType, FeatDim> &params,
+			     unsigned int currDepth);
+  void _computeSliceHistogram(const Tree<FeatType, FeatDim, nClasses> &tree,
+			      const TrainingSet<ImgType, nChannels> &trainingSet,
+			      const TreeTrainerParameters<FeatType, FeatDim> &params,
+			      unsigned int sliceStart, unsigned int sliceNodes);
+  void _learnSliceHistogram(Tree<FeatType, FeatDim, nClasses> &tree,
+			    const TreeTrainerParameters<FeatType, FeatDim> &params,
+			    unsigned int sliceStart, unsigned int sliceNodes);
+  template <SplitCriterion criterion>
+  void _learnExact(Tree<FeatType, FeatDim, nClasses> &tree,
+		   const TrainingSet<ImgType, nChannels> &trainingSet,
+		   const TreeTrainerParameters<FeatType, FeatDim> &params,
+		   unsigned int frontierSize);
+  void _routeSamples(const Tree<FeatType, FeatDim, nClasses> &tree,
+		     const TrainingSet<ImgType, nChannels> &trainingSet);
+  void _cleanTrain();
+
+public:
+  /*!
+   * \param hostFeature The host implementation of the feature function. The trainer does
+   * not take its ownership
+   * \param nThreads Number of training threads. If 0, the OpenMP default is used
+   * \param prng Pseudo-random generator used for features and thresholds sampling (must
+   * match the CLTreeTrainer one to get identical trees)
+   */
+  CPUTreeTrainer(const HostFeature<ImgType, nChannels, FeatType, FeatDim> *hostFeature,
+		 unsigned int nThreads=0, PRNGType prng=PRNG_MD5);
+  ~CPUTreeTrainer();
+
+  void train(Tree<FeatType, FeatDim, nClasses> &tree,
+	     const TrainingSet<ImgType, nChannels> &trainingSet,
+	     const TreeTrainerParameters<FeatType, FeatDim> &params,
+	     unsigned int startDepth, unsigned int endDepth);
+};
+
+
+#include <padenti/cpu_tree_trainer_impl.hpp>
+
+#endif // __CPU_TREE_TRAINER_HPP
@@ -0,0 +1,488 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <algorithm>
+#include <climits>
+#include <cassert>
+#include <utility>
+#include <boost/chrono/chrono.hpp>
+#include <boost/log/trivial.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif // _OPENMP
+#include <padenti/cpu_tree_trainer.hpp>
+#include <padenti/histogram_update.hpp>
+#include <padenti/split_search.hpp>
+#include <padenti/node_sampling.hpp>
+#include <padenti/node_training.hpp>
+
+// Maximum size (in bytes) of the per-thread histograms, summed over all the threads: larger
+// frontiers are trained in slices
+#define CPU_HISTOGRAM_MAX_SIZE (4llu<<30)
+
+// Number of counters merged by each work item of the histogram reduction
+#define CPU_HISTOGRAM_REDUCE_BLOCK_SIZE (1lu<<16)
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::CPUTreeTrainer(
+  const HostFeature<ImgType, nChannels, FeatType, FeatDim> *hostFeature,
+  unsigned int nThreads, PRNGType prng):
+  m_hostFeature(hostFeature), m_nThreads(nThreads), m_prng(prng), m_levelStartNode(0), m_histogramSize(0)
+{
+  if (!hostFeature) throw "A host feature is required";
+#ifdef _OPENMP
+  if (!m_nThreads) m_nThreads = omp_get_max_threads();
+#else
+  m_nThreads = 1;
+#endif // _OPENMP
+
+  const char *histAccumulateName, *splitGainRowName;
+  getHistogramAccumulateFunc(&histAccumulateName);
+  getSplitGainRowFunc(SPLIT_CRITERION_ENTROPY, &splitGainRowName);
+  BOOST_LOG_TRIVIAL(info) << "CPU tree training on " << m_nThreads << " threads, using "
+			  << histAccumulateName << " histogram accumulation and "
+			  << splitGainRowName << " split scores";
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::~CPUTreeTrainer()
+{
+  _cleanTrain();
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::train(
+  Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int startDepth, unsigned int endDepth)
+{
+  if (startDepth<1 || startDepth>=endDepth) throw "Starting depth must be in [1, endDepth)";
+  if (tree.getDepth()<endDepth) throw "Tree depth must not be lower than the ending depth";
+  if (params.nThresholds>UCHAR_MAX) throw "Number of thresholds must be lower than 256";
+
+  _initTrain(tree, trainingSet, params, startDepth, endDepth);
+
+  for (unsigned int currDepth=startDepth; currDepth<endDepth; currDepth++)
+  {
+    boost::chrono::steady_clock::time_point perLevelTrainStart =
+      boost::chrono::steady_clock::now();
+
+    unsigned int frontierSize = _initFrontier(tree, params, currDepth);
+    if (!frontierSize) break;
+
+    if (params.randomThrSampling)
+    {
+      // Frontiers larger than the per-thread histograms are trained in slices
+      for (unsigned int sliceStart=0; sliceStart<frontierSize; sliceStart+=m_histogramSize)
+      {
+	unsigned int sliceNodes = std::min<unsigned int>(m_histogramSize, frontierSize-sliceStart);
+	_computeSliceHistogram(tree, trainingSet, params, sliceStart, sliceNodes);
+	_learnSliceHistogram(tree, params, sliceStart, sliceNodes);
+      }
+    }
+    else
+    {
+      switch (params.splitCriterion)
+      {
+      case SPLIT_CRITERION_GINI:
+	_learnExact<SPLIT_CRITERION_GINI>(tree, trainingSet, params, frontierSize);
+	break;
+      case SPLIT_CRITERION_GAIN_RATIO:
+	_learnExact<SPLIT_CRITERION_GAIN_RATIO>(tree, trainingSet, params, frontierSize);
+	break;
+      default:
+	_learnExact<SPLIT_CRITERION_ENTROPY>(tree, trainingSet, params, frontierSize);
+	break;
+      }
+    }
+
+    // Move the samples of split nodes to the next depth
+    if (currDepth+1<endDepth) _routeSamples(tree, trainingSet);
+
+    boost::chrono::duration<double> perLevelTrainTime =
+      boost::chrono::duration_cast<boost::chrono::duration<double> >(boost::chrono::steady_clock::now() -
+								   perLevelTrainStart);
+    BOOST_LOG_TRIVIAL(info) << "Depth " << currDepth << " trained in "
+			    << perLevelTrainTime.count() << " seconds";
+  }
+
+  _cleanTrain();
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initTrain(
+  const Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int startDepth, unsigned int endDepth)
+{
+  unsigned int nNodes = (2<<(endDepth-1))-1;
+  size_t maxFrontierSize = 1<<(endDepth-2);
+  size_t perNodeHistogramSize = nClasses*params.nFeatures*params.nThresholds;
+
+  m_perNodeTotSamples.assign(nNodes, 0);
+  m_perClassTotSamples.assign(nNodes*nClasses, 0);
+  m_frontier.resize(maxFrontierSize);
+  m_frontierIdx.resize(maxFrontierSize);
+
+  // Collect the training set samples, all of them reaching the root
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &images = trainingSet.getImages();
+  m_samples.clear();
+  for (unsigned int i=0; i<images.size(); i++)
+  {
+    const TrainingSetImage<ImgType, nChannels> &image = images[i];
+    for (unsigned int s=0; s<image.getNSamples(); s++)
+    {
+      Sample sample;
+      sample.image = i;
+      sample.pixel = image.getSamples()[s];
+      sample.label = image.getLabels()[sample.pixel]-1;
+      m_samples.push_back(sample);
+    }
+  }
+  m_samplesNode.assign(m_samples.size(), 0);
+
+  // Host split scores table: no node can be reached by more samples than the root
+  fillNLog2NTable(m_nLog2nTable, m_samples.size());
+
+  if (startDepth==1)
+  {
+    m_perNodeTotSamples[0] = m_samples.size();
+    for (unsigned int s=0; s<m_samples.size(); s++) m_perClassTotSamples[m_samples[s].label]++;
+
+    // Note: the histogram for the root node is equal to the training set priors
+    const TreeNode<FeatType, FeatDim> &rootNode = tree.getNode(0);
+    std::copy(trainingSet.getPriors(), trainingSet.getPriors()+nClasses, rootNode.m_posterior);
+  }
+  else
+  {
+    // Resume: route the samples down to the starting depth and count them on reached nodes
+    for (unsigned int d=1; d<startDepth; d++) _routeSamples(tree, trainingSet);
+    for (unsigned int s=0; s<m_samples.size(); s++)
+    {
+      m_perNodeTotSamples[m_samplesNode[s]]++;
+      m_perClassTotSamples[m_samplesNode[s]*nClasses+m_samples[s].label]++;
+    }
+  }
+
+  // Per-thread histograms, bounded by the maximum total size
+  if (params.randomThrSampling)
+  {
+    m_histogramSize = std::min<size_t>(maxFrontierSize,
+				       CPU_HISTOGRAM_MAX_SIZE/
+				       (m_nThreads*perNodeHistogramSize*sizeof(unsigned int)));
+    if (!m_histogramSize) m_histogramSize = 1;
+    m_threadHistograms.resize(m_nThreads);
+    for (unsigned int t=0; t<m_nThreads; t++)
+    {
+      m_threadHistograms[t] = new HistogramArena;
+      m_threadHistograms[t]->allocate(m_histogramSize*perNodeHistogramSize);
+    }
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+unsigned int CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_initFrontier(
+  const Tree<FeatType, FeatDim, nClasses> &tree,
+  const TreeTrainerParameters<FeatType, FeatDim> &params, unsigned int currDepth)
+{
+  unsigned int toTrainNodes = _selectFrontier(tree, params, currDepth, &m_perNodeTotSamples[0],
+					      &m_perClassTotSamples[0], &m_frontier[0]);
+
+  // Frontier index of each node of the current depth
+  size_t currFrontierSize = 1<<(currDepth-1);
+  m_levelStartNode = currFrontierSize-1;
+  std::fill_n(m_frontierIdx.begin(), currFrontierSize, -1);
+  for (unsigned int i=0; i<toTrainNodes; i++) m_frontierIdx[m_frontier[i]-m_levelStartNode] = i;
+
+  return toTrainNodes;
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_computeSliceHistogram(
+  const Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int sliceStart, unsigned int sliceNodes)
+{
+  size_t perClassHistogramSize = params.nFeatures*params.nThresholds;
+  size_t perNodeHistogramSize = nClasses*perClassHistogramSize;
+  size_t sliceHistogramSize = sliceNodes*perNodeHistogramSize;
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &images = trainingSet.getImages();
+  PRNGFunc prngRand = getPRNGFunc(m_prng);
+  HistogramAccumulateFunc accumulate = getHistogramAccumulateFunc();
+
+  // Per-slice feature/threshold tables, as generated by the generateFeatThrTables kernel
+  std::vector<FeatType> features(sliceNodes*params.nFeatures*FeatDim);
+  std::vector<FeatType> thresholds(sliceNodes*params.nFeatures*params.nThresholds);
+  #pragma omp parallel for num_threads(m_nThreads)
+  for (int i=0; i<(int)(sliceNodes*params.nFeatures); i++)
+  {
+    unsigned int nodeID = m_frontier[sliceStart+i/params.nFeatures];
+    _generateNodeFeature(prngRand, params, tree.getID(), nodeID, i%params.nFeatures,
+			 &features[i*FeatDim]);
+    _generateNodeThresholds(prngRand, params, tree.getID(), nodeID, i%params.nFeatures,
+			    &thresholds[i*params.nThresholds]);
+  }
+
+  // Per-thread per-bin update: samples are spread among the threads, each one updating its
+  // own histograms (cleared, i.e. first touched, by the owner thread)
+  unsigned int nActiveThreads = 1;
+  #pragma omp parallel num_threads(m_nThreads)
+  {
+#ifdef _OPENMP
+    unsigned int threadID = omp_get_thread_num();
+    #pragma omp single
+    nActiveThreads = omp_get_num_threads();
+#else
+    unsigned int threadID = 0;
+#endif // _OPENMP
+    HistogramArena &threadHistogram = *m_threadHistograms[threadID];
+    threadHistogram.clear(sliceHistogramSize);
+
+    #pragma omp for schedule(dynamic, 256)
+    for (int s=0; s<(int)m_samples.size(); s++)
+    {
+      int row = m_frontierIdx[m_samplesNode[s]-m_levelStartNode]-(int)sliceStart;
+      if (row<0 || row>=(int)sliceNodes) continue;
+
+      const Sample &sample = m_samples[s];
+      const TrainingSetImage<ImgType, nChannels> &image = images[sample.image];
+      unsigned int x = sample.pixel%image.getWidth(), y = sample.pixel/image.getWidth();
+      unsigned int *histogram = threadHistogram.getData()+row*perNodeHistogramSize+
+	sample.label*perClassHistogramSize;
+      const FeatType *rowFeatures = &features[row*params.nFeatures*FeatDim];
+      const FeatType *rowThresholds = &thresholds[row*params.nFeatures*params.nThresholds];
+
+      // Bin index is the number of thresholds lower than the response, bin nThresholds (i.e.
+      // response greater than all the thresholds) is not stored
+      for (unsigned int f=0; f<params.nFeatures; f++)
+      {
+	FeatType response = m_hostFeature->compute(image, x, y, &rowFeatures[f*FeatDim]);
+	const FeatType *featThresholds = &rowThresholds[f*params.nThresholds];
+	unsigned int bin = std::lower_bound(featThresholds, featThresholds+params.nThresholds,
+					    response)-featThresholds;
+	if (bin<params.nThresholds) histogram[bin*params.nFeatures+f]++;
+      }
+    }
+  }
+
+  // Tree-structured reduction into the first thread histograms: at each step, the
+  // histograms of thread t+stride are added to the thread t ones. Histograms are split in
+  // blocks, so that all the threads take part in every step
+  size_t nBlocks = (sliceHistogramSize+CPU_HISTOGRAM_REDUCE_BLOCK_SIZE-1)/
+    CPU_HISTOGRAM_REDUCE_BLOCK_SIZE;
+  for (unsigned int stride=1; stride<nActiveThreads; stride*=2)
+  {
+    unsigned int nPairs = (nActiveThreads-stride-1)/(2*stride)+1;
+    #pragma omp parallel for num_threads(m_nThreads) schedule(dynamic)
+    for (int i=0; i<(int)(nPairs*nBlocks); i++)
+    {
+      unsigned int t = (i/nBlocks)*2*stride;
+      size_t offset = (i%nBlocks)*CPU_HISTOGRAM_REDUCE_BLOCK_SIZE;
+      size_t size = std::min<size_t>(CPU_HISTOGRAM_REDUCE_BLOCK_SIZE, sliceHistogramSize-offset);
+      accumulate(m_threadHistograms[t]->getData()+offset,
+		 m_threadHistograms[t+stride]->getData()+offset, size);
+    }
+  }
+
+  // Rebuild per-threshold counters from the per-bin ones, as done by CLTreeTrainer
+  unsigned int *histogram = m_threadHistograms[0]->getData();
+  #pragma omp parallel for num_threads(m_nThreads)
+  for (int i=0; i<(int)(sliceNodes*nClasses); i++)
+  {
+    unsigned int *classHistogram = histogram+i*perClassHistogramSize;
+    for (unsigned int t=1; t<params.nThresholds; t++)
+    {
+      accumulate(classHistogram+t*params.nFeatures, classHistogram+(t-1)*params.nFeatures,
+		 params.nFeatures);
+    }
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_learnSliceHistogram(
+  Tree<FeatType, FeatDim, nClasses> &tree,
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int sliceStart, unsigned int sliceNodes)
+{
+  size_t perNodeHistogramSize = nClasses*params.nFeatures*params.nThresholds;
+  const unsigned int *histogram = m_threadHistograms[0]->getData();
+  PRNGFunc prngRand = getPRNGFunc(m_prng);
+  std::vector<const unsigned int*> histograms(sliceNodes);
+  std::vector<unsigned int> bestFeatures(sliceNodes), bestThresholds(sliceNodes);
+  std::vector<float> bestGains(sliceNodes);
+
+  for (unsigned int n=0; n<sliceNodes; n++) histograms[n] = histogram+n*perNodeHistogramSize;
+  searchHistogramSplits(getSplitGainRowFunc(params.splitCriterion), &histograms[0],
+			&m_frontier[sliceStart], sliceNodes, params.nFeatures, params.nThresholds,
+			nClasses, &m_perNodeTotSamples[0], &m_perClassTotSamples[0],
+			&m_nLog2nTable[0], params.minChildSamples, m_nThreads, &bestFeatures[0],
+			&bestThresholds[0], &bestGains[0]);
+
+  for (unsigned int n=0; n<sliceNodes; n++)
+  {
+    _splitHistogramNode(tree, params, prngRand, &m_perNodeTotSamples[0],
+			&m_perClassTotSamples[0], m_frontier[sliceStart+n], histograms[n],
+			bestFeatures[n], bestThresholds[n], bestGains[n]);
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+template <SplitCriterion criterion>
+void CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_learnExact(
+  Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet,
+  const TreeTrainerParameters<FeatType, FeatDim> &params,
+  unsigned int frontierSize)
+{
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &images = trainingSet.getImages();
+  PRNGFunc prngRand = getPRNGFunc(m_prng);
+  std::vector<unsigned int> bestFeatures(frontierSize);
+  std::vector<FeatType> bestThresholds(frontierSize);
+  std::vector<float> bestGains(frontierSize);
+  std::vector<unsigned int> leftHistograms(frontierSize*nClasses);
+
+  // Samples of each frontier node
+  std::vector<std::vector<unsigned int> > nodeSamples(frontierSize);
+  for (unsigned int s=0; s<m_samples.size(); s++)
+  {
+    int idx = m_frontierIdx[m_samplesNode[s]-m_levelStartNode];
+    if (idx>=0) nodeSamples[idx].push_back(s);
+  }
+
+  // Responses are computed per node and feature
+  #pragma omp parallel num_threads(m_nThreads)
+  {
+    std::vector<std::pair<FeatType, unsigned char> > responses;
+    FeatType feature[FeatDim];
+
+    #pragma omp for schedule(dynamic)
+    for (int n=0; n<(int)frontierSize; n++)
+    {
+      unsigned int nodeID = m_frontier[n];
+      const std::vector<unsigned int> &samples = nodeSamples[n];
+      unsigned int nSamples = samples.size();
+      const unsigned int *totHistogram = &m_perClassTotSamples[nodeID*nClasses];
+      unsigned int *bestLeftHistogram = &leftHistograms[n*nClasses];
+      float bestGain = -1.0f;
+
+      // If no cut is found, all the samples go left (i.e. the node is kept as a leaf)
+      bestFeatures[n] = 0;
+      bestThresholds[n] = params.thrUpBound;
+      std::copy(totHistogram, totHistogram+nClasses, bestLeftHistogram);
+
+      responses.resize(nSamples);
+      for (unsigned int f=0; f<params.nFeatures; f++)
+      {
+	_generateNodeFeature(prngRand, params, tree.getID(), nodeID, f, feature);
+	for (unsigned int s=0; s<nSamples; s++)
+	{
+	  const Sample &sample = m_samples[samples[s]];
+	  const TrainingSetImage<ImgType, nChannels> &image = images[sample.image];
+	  responses[s] = std::make_pair(m_hostFeature->compute(image,
+							       sample.pixel%image.getWidth(),
+							       sample.pixel/image.getWidth(),
+							       feature),
+					sample.label);
+	}
+	searchExactSplit<criterion>(responses, totHistogram, nClasses, &m_nLog2nTable[0],
+				    params.minChildSamples, f, bestGain, bestFeatures[n],
+				    bestThresholds[n], bestLeftHistogram);
+      }
+      bestGains[n] = std::max(bestGain, 0.0f);
+    }
+  }
+
+  for (unsigned int n=0; n<frontierSize; n++)
+  {
+    _splitNode(tree, params, prngRand, &m_perNodeTotSamples[0], &m_perClassTotSamples[0],
+	       m_frontier[n], bestFeatures[n], bestThresholds[n], bestGains[n],
+	       &leftHistograms[n*nClasses]);
+  }
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_routeSamples(
+  const Tree<FeatType, FeatDim, nClasses> &tree,
+  const TrainingSet<ImgType, nChannels> &trainingSet)
+{
+  const std::vector<TrainingSetImage<ImgType, nChannels> > &images = trainingSet.getImages();
+
+  // Samples of split nodes go one level down, the others reached a leaf and are dropped
+  #pragma omp parallel for num_threads(m_nThreads) schedule(dynamic, 1024)
+  for (int s=0; s<(int)m_samples.size(); s++)
+  {
+    const TreeNode<FeatType, FeatDim> &node = tree.getNode(m_samplesNode[s]);
+    if (*node.m_leftChild<=0)
+    {
+      m_samplesNode[s] = -1;
+      continue;
+    }
+
+    const Sample &sample = m_samples[s];
+    const TrainingSetImage<ImgType, nChannels> &image = images[sample.image];
+    FeatType response = m_hostFeature->compute(image, sample.pixel%image.getWidth(),
+					       sample.pixel/image.getWidth(), node.m_feature);
+    m_samplesNode[s] = *node.m_leftChild + ((response<=*node.m_threshold) ? 0 : 1);
+  }
+
+  unsigned int nSamples = 0;
+  for (unsigned int s=0; s<m_samples.size(); s++)
+  {
+    if (m_samplesNode[s]<0) continue;
+    m_samples[nSamples] = m_samples[s];
+    m_samplesNode[nSamples] = m_samplesNode[s];
+    nSamples++;
+  }
+  m_samples.resize(nSamples);
+  m_samplesNode.resize(nSamples);
+}
+
+
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void CPUTreeTrainer<ImgType, nChannels, FeatType, FeatDim, nClasses>::_cleanTrain()
+{
+  for (unsigned int t=0; t<m_threadHistograms.size(); t++) delete m_threadHistograms[t];
+  m_threadHistograms.clear();
+  std::vector<Sample>().swap(m_samples);
+  std::vector<int>().swap(m_samplesNode);
+  std::vector<unsigned int>().swap(m_perNodeTotSamples);
+  std::vector<unsigned int>().swap(m_perClassTotSamples);
+}
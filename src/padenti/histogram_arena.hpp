@@ -0,0 +1,103 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __HISTOGRAM_ARENA_HPP
+#define __HISTOGRAM_ARENA_HPP
+
+#include <cstddef>
+
+/*!
+ *  \brief Contiguous memory arena storing the global (i.e. per-depth) histogram.
+ *
+ *  All the per-node histograms simultaneously kept by the trainer are stored in a single
+ *  contiguous block of unsigned int counters. On Linux the block is mapped as anonymous
+ *  memory backed by huge pages (explicit huge pages if available, transparent huge pages
+ *  otherwise) in order to reduce TLB misses during global histogram updates.
+ *
+ *  Counters are zeroed lazily: on Linux, clearing the arena releases its physical pages,
+ *  which are zero-filled by the kernel when first touched again. Since the first touch
+ *  happens inside the thread updating the histogram, pages are allocated on the NUMA node
+ *  of that thread (first-touch policy). Where lazy zeroing is not available, counters
+ *  are zeroed in parallel using OpenMP.
+ */
+class HistogramArena
+{
+private:
+  unsigned int *m_data;
+  size_t m_size;
+  size_t m_bytes;
+  bool m_mapped;
+  bool m_hugeTLB;
+  bool m_pristine;
+
+  HistogramArena(const HistogramArena &);
+  HistogramArena &operator=(const HistogramArena &);
+public:
+  /*!
+   * Base constructor. No memory is allocated until allocate() is called.
+   */
+  HistogramArena();
+  ~HistogramArena();
+
+  /*!
+   * Allocate the arena. Previously allocated memory, if any, is released. Counters are
+   * initially zero.
+   *
+   * \param size Number of unsigned int counters to allocate
+   */
+  void allocate(size_t size);
+
+  /*!
+   * Release the arena memory.
+   */
+  void release();
+
+  /*!
+   * Zero the first size counters of the arena. Depending on the zeroing strategy,
+   * counters following the first size ones may be zeroed as well.
+   *
+   * \param size Number of counters to zero, starting from the beginning of the arena
+   */
+  void clear(size_t size);
+
+  /*!
+   * Get the arena base pointer.
+   *
+   * \return The pointer to the first counter of the arena
+   */
+  unsigned int *getData() const;
+
+  /*!
+   * Get the arena size.
+   *
+   * \return The number of counters stored by the arena
+   */
+  size_t getSize() const;
+
+  /*!
+   * Check if the arena is backed by explicit (i.e. hugetlbfs) huge pages.
+   *
+   * \return True if explicit huge pages are used
+   */
+  bool usesHugeTLB() const;
+};
+
+#include <padenti/histogram_arena_impl.hpp>
+
+#endif // __HISTOGRAM_ARENA_HPP
@@ -0,0 +1,164 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <algorithm>
+#include <new>
+#include <padenti/histogram_arena.hpp>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif // __linux__
+
+// Huge page size assumed for arena alignment (x86-64 default)
+#define HISTOGRAM_ARENA_HUGE_PAGE_SIZE (2lu<<20)
+
+// Below this size, clearing the arena by page release is not worth the page faults
+#define HISTOGRAM_ARENA_LAZY_CLEAR_MIN_SIZE (HISTOGRAM_ARENA_HUGE_PAGE_SIZE)
+
+
+inline HistogramArena::HistogramArena():
+  m_data(NULL), m_size(0), m_bytes(0), m_mapped(false), m_hugeTLB(false), m_pristine(false)
+{}
+
+
+inline HistogramArena::~HistogramArena()
+{
+  release();
+}
+
+
+inline void HistogramArena::allocate(size_t size)
+{
+  release();
+  if (!size) return;
+
+  m_size = size;
+  // Round the arena size to a multiple of the huge page size
+  m_bytes = size*sizeof(unsigned int);
+  m_bytes += (m_bytes%HISTOGRAM_ARENA_HUGE_PAGE_SIZE) ?
+    HISTOGRAM_ARENA_HUGE_PAGE_SIZE-(m_bytes%HISTOGRAM_ARENA_HUGE_PAGE_SIZE) : 0;
+
+#ifdef __linux__
+  void *ptr = MAP_FAILED;
+
+  // First try with explicit huge pages: they require a pre-allocated pool
+  // (i.e. /proc/sys/vm/nr_hugepages), hence may fail
+  #ifdef MAP_HUGETLB
+  ptr = mmap(NULL, m_bytes, PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+  m_hugeTLB = (ptr!=MAP_FAILED);
+  #endif // MAP_HUGETLB
+
+  if (ptr==MAP_FAILED)
+  {
+    // Fall back to regular pages and ask for transparent huge pages
+    ptr = mmap(NULL, m_bytes, PROT_READ|PROT_WRITE,
+	       MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (ptr==MAP_FAILED) throw std::bad_alloc();
+    #ifdef MADV_HUGEPAGE
+    madvise(ptr, m_bytes, MADV_HUGEPAGE);
+    #endif // MADV_HUGEPAGE
+  }
+
+  // Note: anonymous mappings are zero-filled on first touch, no explicit zeroing needed
+  m_data = reinterpret_cast<unsigned int*>(ptr);
+  m_mapped = true;
+  m_pristine = true;
+#else
+  m_data = new unsigned int[m_bytes/sizeof(unsigned int)];
+  m_mapped = false;
+  clear(m_size);
+#endif // __linux__
+}
+
+
+inline void HistogramArena::release()
+{
+  if (!m_data) return;
+
+#ifdef __linux__
+  if (m_mapped) munmap(m_data, m_bytes);
+  else delete []m_data;
+#else
+  delete []m_data;
+#endif // __linux__
+
+  m_data = NULL;
+  m_size = 0;
+  m_bytes = 0;
+  m_mapped = false;
+  m_hugeTLB = false;
+  m_pristine = false;
+}
+
+
+inline void HistogramArena::clear(size_t size)
+{
+  size = std::min(size, m_size);
+  if (!size) return;
+
+  // Never touched since allocation: already zero, and left untouched so that pages are
+  // first-touched by the thread updating the histogram
+  if (m_pristine)
+  {
+    m_pristine = false;
+    return;
+  }
+
+#if defined(__linux__) && defined(MADV_DONTNEED)
+  // Lazy zeroing: release the pages covering the counters to clear. They will be
+  // zero-filled by the kernel on first touch, i.e. by the thread updating the
+  // histogram, and allocated on its NUMA node.
+  // Note: page release is not performed on hugetlbfs mappings, unsupported by older kernels
+  size_t bytes = size*sizeof(unsigned int);
+  if (m_mapped && !m_hugeTLB && bytes>=HISTOGRAM_ARENA_LAZY_CLEAR_MIN_SIZE)
+  {
+    bytes += (bytes%HISTOGRAM_ARENA_HUGE_PAGE_SIZE) ?
+      HISTOGRAM_ARENA_HUGE_PAGE_SIZE-(bytes%HISTOGRAM_ARENA_HUGE_PAGE_SIZE) : 0;
+    if (!madvise(m_data, std::min(bytes, m_bytes), MADV_DONTNEED)) return;
+  }
+#endif // __linux__ && MADV_DONTNEED
+
+  // Parallel zeroing, one huge page per chunk
+  const long int chunkSize = HISTOGRAM_ARENA_HUGE_PAGE_SIZE/sizeof(unsigned int);
+  const long int nChunks = (size+chunkSize-1)/chunkSize;
+  #pragma omp parallel for
+  for (long int i=0; i<nChunks; i++)
+  {
+    std::fill(m_data+i*chunkSize, m_data+std::min((size_t)((i+1)*chunkSize), size), 0);
+  }
+}
+
+
+inline unsigned int *HistogramArena::getData() const
+{
+  return m_data;
+}
+
+
+inline size_t HistogramArena::getSize() const
+{
+  return m_size;
+}
+
+
+inline bool HistogramArena::usesHugeTLB() const
+{
+  return m_hugeTLB;
+}
@@ -0,0 +1,231 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __HISTOGRAM_UPDATE_HPP
+#define __HISTOGRAM_UPDATE_HPP
+
+#include <cstddef>
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(_MSC_VER)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+// AVX2/AVX-512 variants are compiled for their own target (GCC/Clang target attributes)
+// or unconditionally (MSVC), and selected at runtime depending on the host CPU
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define HISTOGRAM_UPDATE_AVX2
+  #define HISTOGRAM_UPDATE_AVX512
+  #define HISTOGRAM_UPDATE_TARGET_AVX2 __attribute__((target("avx2")))
+  #define HISTOGRAM_UPDATE_TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  #define HISTOGRAM_UPDATE_AVX2
+  #define HISTOGRAM_UPDATE_AVX512
+  #define HISTOGRAM_UPDATE_TARGET_AVX2
+  #define HISTOGRAM_UPDATE_TARGET_AVX512
+#endif
+
+
+/*!
+ * Signature of the functions accumulating a row of global histogram counters into another
+ * one, i.e. computing global[i] += local[i] for i in [0, n). They are used to rebuild the
+ * per-threshold counters from the per-bin ones (prefix sum over threshold rows).
+ */
+typedef void (*HistogramAccumulateFunc)(unsigned int *global, const unsigned int *local,
+					size_t n);
+
+
+inline void accumulateHistogramScalar(unsigned int *global, const unsigned int *local,
+				      size_t n)
+{
+  for (size_t i=0; i<n; i++) global[i] += local[i];
+}
+
+
+inline void accumulateHistogramSSE2(unsigned int *global, const unsigned int *local,
+				    size_t n)
+{
+  size_t i=0;
+  for (; i+16<=n; i+=16, global+=16, local+=16)
+  {
+    __m128i globalCounter1, globalCounter2, globalCounter3, globalCounter4;
+
+    globalCounter1 = _mm_loadu_si128(reinterpret_cast<__m128i*>(global));
+    globalCounter2 = _mm_loadu_si128(reinterpret_cast<__m128i*>(global+4));
+    globalCounter3 = _mm_loadu_si128(reinterpret_cast<__m128i*>(global+8));
+    globalCounter4 = _mm_loadu_si128(reinterpret_cast<__m128i*>(global+12));
+
+    globalCounter1 = _mm_add_epi32(globalCounter1,
+				   _mm_loadu_si128(reinterpret_cast<const __m128i*>(local)));
+    globalCounter2 = _mm_add_epi32(globalCounter2,
+				   _mm_loadu_si128(reinterpret_cast<const __m128i*>(local+4)));
+    globalCounter3 = _mm_add_epi32(globalCounter3,
+				   _mm_loadu_si128(reinterpret_cast<const __m128i*>(local+8)));
+    globalCounter4 = _mm_add_epi32(globalCounter4,
+				   _mm_loadu_si128(reinterpret_cast<const __m128i*>(local+12)));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(global), globalCounter1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(global+4), globalCounter2);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(global+8), globalCounter3);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(global+12), globalCounter4);
+  }
+
+  accumulateHistogramScalar(global, local, n-i);
+}
+
+
+#ifdef HISTOGRAM_UPDATE_AVX2
+HISTOGRAM_UPDATE_TARGET_AVX2
+inline void accumulateHistogramAVX2(unsigned int *global, const unsigned int *local,
+				    size_t n)
+{
+  size_t i=0;
+  for (; i+32<=n; i+=32, global+=32, local+=32)
+  {
+    __m256i globalCounter1, globalCounter2, globalCounter3, globalCounter4;
+
+    globalCounter1 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(global));
+    globalCounter2 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(global+8));
+    globalCounter3 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(global+16));
+    globalCounter4 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(global+24));
+
+    globalCounter1 = _mm256_add_epi32(globalCounter1,
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(local)));
+    globalCounter2 = _mm256_add_epi32(globalCounter2,
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(local+8)));
+    globalCounter3 = _mm256_add_epi32(globalCounter3,
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(local+16)));
+    globalCounter4 = _mm256_add_epi32(globalCounter4,
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(local+24)));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(global), globalCounter1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(global+8), globalCounter2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(global+16), globalCounter3);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(global+24), globalCounter4);
+  }
+
+  accumulateHistogramScalar(global, local, n-i);
+}
+#endif // HISTOGRAM_UPDATE_AVX2
+
+
+#ifdef HISTOGRAM_UPDATE_AVX512
+HISTOGRAM_UPDATE_TARGET_AVX512
+inline void accumulateHistogramAVX512(unsigned int *global, const unsigned int *local,
+				      size_t n)
+{
+  size_t i=0;
+  for (; i+64<=n; i+=64, global+=64, local+=64)
+  {
+    __m512i globalCounter1, globalCounter2, globalCounter3, globalCounter4;
+
+    globalCounter1 = _mm512_loadu_si512(global);
+    globalCounter2 = _mm512_loadu_si512(global+16);
+    globalCounter3 = _mm512_loadu_si512(global+32);
+    globalCounter4 = _mm512_loadu_si512(global+48);
+
+    globalCounter1 = _mm512_add_epi32(globalCounter1, _mm512_loadu_si512(local));
+    globalCounter2 = _mm512_add_epi32(globalCounter2, _mm512_loadu_si512(local+16));
+    globalCounter3 = _mm512_add_epi32(globalCounter3, _mm512_loadu_si512(local+32));
+    globalCounter4 = _mm512_add_epi32(globalCounter4, _mm512_loadu_si512(local+48));
+
+    _mm512_storeu_si512(global, globalCounter1);
+    _mm512_storeu_si512(global+16, globalCounter2);
+    _mm512_storeu_si512(global+32, globalCounter3);
+    _mm512_storeu_si512(global+48, globalCounter4);
+  }
+
+  accumulateHistogramScalar(global, local, n-i);
+}
+#endif // HISTOGRAM_UPDATE_AVX512
+
+
+#ifdef _MSC_VER
+inline bool _msvcCPUSupports(int leaf, int reg, int bit, unsigned long long xcr0Mask)
+{
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0]<leaf) return false;
+
+  // Check OS support for extended registers state (OSXSAVE + XCR0)
+  __cpuid(info, 1);
+  if (!(info[2] & (1<<27))) return false;
+  if ((_xgetbv(0) & xcr0Mask)!=xcr0Mask) return false;
+
+  __cpuidex(info, leaf, 0);
+  return (info[reg] & (1<<bit))!=0;
+}
+#endif // _MSC_VER
+
+
+/*!
+ * Select the fastest global histogram accumulation function supported by the host CPU.
+ * The selection is performed once, on first call.
+ *
+ * \param name If not NULL, filled with the name of the selected implementation
+ * \return The selected accumulation function
+ */
+inline HistogramAccumulateFunc getHistogramAccumulateFunc(const char **name=NULL)
+{
+  static HistogramAccumulateFunc func = NULL;
+  static const char *funcName = NULL;
+
+  if (!func)
+  {
+    HistogramAccumulateFunc selFunc = accumulateHistogramSSE2;
+    const char *selFuncName = "SSE2";
+
+#if defined(__GNUC__) && defined(HISTOGRAM_UPDATE_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+      selFunc = accumulateHistogramAVX512;
+      selFuncName = "AVX-512";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+      selFunc = accumulateHistogramAVX2;
+      selFuncName = "AVX2";
+    }
+#elif defined(_MSC_VER) && defined(HISTOGRAM_UPDATE_AVX2)
+    // AVX-512F: CPUID.7.EBX[16], requires opmask/ZMM state; AVX2: CPUID.7.EBX[5]
+    if (_msvcCPUSupports(7, 1, 16, 0xE6))
+    {
+      selFunc = accumulateHistogramAVX512;
+      selFuncName = "AVX-512";
+    }
+    else if (_msvcCPUSupports(7, 1, 5, 0x6))
+    {
+      selFunc = accumulateHistogramAVX2;
+      selFuncName = "AVX2";
+    }
+#endif
+
+    funcName = selFuncName;
+    func = selFunc;
+  }
+
+  if (name) *name = funcName;
+  return func;
+}
+
+
+#endif // __HISTOGRAM_UPDATE_HPP
@@ -0,0 +1,58 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __HOST_FEATURE_HPP
+#define __HOST_FEATURE_HPP
+
+#include <padenti/image.hpp>
+
+
+/*!
+ * \brief Interface of the host (i.e. C++) implementation of the feature function.
+ * Host features are used to train small nodes on CPU threads (see
+ * CLTreeTrainer::setHostFeature) and must return the same responses as the OpenCL
+ * computeFeature function. Features depending on the tree being trained (i.e. using the
+ * tree or the nodes ID image arguments of computeFeature) are not supported.
+ *
+ * \tparam ImgType Image pixels type
+ * \tparam nChannels Number of image channels
+ * \tparam FeatType type of feature entries and response
+ * \tparam FeatDim dimension (i.e. number of entries) of the feature
+ */
+template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned int FeatDim>
+class HostFeature
+{
+public:
+  virtual ~HostFeature() {}
+
+  /*!
+   * Compute the feature response at a given pixel.
+   * Note: the method is concurrently called by multiple threads.
+   *
+   * \param image The input image
+   * \param x The pixel column
+   * \param y The pixel row
+   * \param feature The FeatDim feature entries
+   * \return The feature response
+   */
+  virtual FeatType compute(const Image<ImgType, nChannels> &image,
+			   unsigned int x, unsigned int y, const FeatType *feature) const=0;
+};
+
+#endif // __HOST_FEATURE_HPP
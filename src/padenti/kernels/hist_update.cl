@@ -33,157 +33,188 @@
 #include <feature.cl>
 
 uint4 md5Rand(uint4 seed);
-__kernel void computePerImageHistogram(__read_only image_t image,
-				       uint nChannels, uint width, uint height,
-				       __read_only image2d_t labels,
-				       __read_only image2d_t nodesID,
-				       __global uint *samples, uint nSamples,
-				       uint featDim,
-				       __global feat_t *featLowBounds, __global feat_t *featUpBounds,
-				       uint nThresholds, feat_t thrLowBound, feat_t thrUpBound,
-				       __global uchar *perImageHistogram,
-				       uint treeID, int startNode, int endNode,
-				       __global int *treeLeftChildren,
-				       __global float *treePosteriors,
-				       __local feat_t *tmp,
-				       __local feat_t *featuresBuff)
-                                       //,uint baseSeed)
+uint4 philoxRand(uint4 seed);
+
+// Features/thresholds sampling generator, selected at build time
+#ifdef PRNG_PHILOX
+#define prngRand philoxRand
+#else
+#define prngRand md5Rand
+#endif // PRNG_PHILOX
+
+
+// Generate the random features and thresholds of the nodes of the current frontier slice.
+// Each work-item generates, for a given node and feature index, the feature entries
+// and the thresholds sampled for that feature.
+// Note: the same (treeID, nodeID, featureID, counter) seeding used on the host to
+// reconstruct the best feature/threshold pair is used here
+__kernel void generateFeatThrTables(uint treeID, __global int *nodes,
+				    uint featDim,
+				    __global feat_t *featLowBounds, __global feat_t *featUpBounds,
+				    uint nThresholds, feat_t thrLowBound, feat_t thrUpBound,
+				    __global feat_t *featTable,
+				    __global feat_t *thrTable)
 {
-  const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
   uint4 seed;
-  feat_t feat, thr;
-  int2 coords;
-  int nodeID;
-
-  coords.x = samples[get_global_id(0)];
-  coords = (int2)(coords.x%width, coords.x/width);
-  nodeID = read_imagei(nodesID, sampler, coords).x;
+  uint row = get_global_id(0);
+  uint featID = get_global_id(1);
+  size_t tableOffset = row*get_global_size(1)+featID;
 
   seed.x = treeID;
-  seed.y = nodeID;
-  seed.z = get_global_id(1);
-  seed.w = 0; // Non zero value for 4th int???
-
-  /*
-  seed.x = treeID^baseSeed;
-  seed.y = nodeID^baseSeed;
-  seed.z = get_global_id(1)^baseSeed;
-  seed.w = baseSeed;
-  */
+  seed.y = nodes[row];
+  seed.z = featID;
+  seed.w = 0;
 
   /** 
    * \todo better int32-to-float32 conversion
   */
-  for (int i=0; i<featDim; i+=4)
+  featTable += tableOffset*featDim;
+  for (uint i=0; i<featDim; i+=4)
   {
-    seed = md5Rand(seed);
-
-    // The first 8 work-items of each work-group copy the upper/lower feature bounds
-    // to shared in order to avoid multiple reads from global memory
-    int gtThrID = min(4, ((int)featDim)-i);
-    if (!get_local_id(0)&&get_local_id(1)<gtThrID*2)
-    {
-      tmp[get_local_id(1)] = \
-	(get_local_id(1)<gtThrID) ? featLowBounds[i+get_local_id(1)] : featUpBounds[i+get_local_id(1)-gtThrID];
-    }
-    barrier(CLK_LOCAL_MEM_FENCE);
-    
+    seed = prngRand(seed);
 
     /** \todo  Find another way the uint32-to-float conversion since uncorrect results get
      are returned by old fglrx driver versions (e.g. default Ubuntu 14.04 version) */
-    feat = tmp[0] + 
-      (feat_t)(((float)(seed.x))/(0xFFFFFFFF)*(tmp[gtThrID]-tmp[0]));
-    ACCESS_FEATURE(featuresBuff, i, featDim) = feat;
+    featTable[i] = featLowBounds[i] + 
+      (feat_t)(((float)(seed.x))/(0xFFFFFFFF)*(featUpBounds[i]-featLowBounds[i]));
     if ((i+1)>=featDim) break;
     
-    feat = tmp[1] + 
-      (feat_t)(((float)seed.y)/(0xFFFFFFFF)*(tmp[gtThrID+1]-tmp[1]));
-    ACCESS_FEATURE(featuresBuff, i+1, featDim) = feat;
+    featTable[i+1] = featLowBounds[i+1] + 
+      (feat_t)(((float)seed.y)/(0xFFFFFFFF)*(featUpBounds[i+1]-featLowBounds[i+1]));
     if ((i+2)>=featDim) break;
     
-    feat = tmp[2] +
-      (feat_t)(((float)seed.z)/(0xFFFFFFFF)*(tmp[gtThrID+2]-tmp[2]));
-    ACCESS_FEATURE(featuresBuff, i+2, featDim) = feat;
+    featTable[i+2] = featLowBounds[i+2] +
+      (feat_t)(((float)seed.z)/(0xFFFFFFFF)*(featUpBounds[i+2]-featLowBounds[i+2]));
     if ((i+3)>=featDim) break;
 
-    feat = tmp[3] +
-      (feat_t)(((float)seed.w)/(0xFFFFFFFF)*(tmp[gtThrID+3]-tmp[3]));
-    ACCESS_FEATURE(featuresBuff, i+3, featDim) = feat;
+    featTable[i+3] = featLowBounds[i+3] +
+      (feat_t)(((float)seed.w)/(0xFFFFFFFF)*(featUpBounds[i+3]-featLowBounds[i+3]));
+  }
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+  seed.x = treeID;
+  seed.y = nodes[row];
+  seed.z = featID;
+  seed.w = 1;
+
+  thrTable += tableOffset*nThresholds;
+  for (uint t=0; t<nThresholds; t+=4)
+  { 
+    seed = prngRand(seed);
+
+    thrTable[t] = thrLowBound + 
+      (feat_t)(((float)seed.x)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
+    if ((t+1)>=nThresholds) break;
+
+    thrTable[t+1] = thrLowBound + 
+      (feat_t)(((float)seed.y)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
+    if ((t+2)>=nThresholds) break;
+    
+    thrTable[t+2] = thrLowBound + 
+      (feat_t)(((float)seed.z)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
+    if ((t+3)>=nThresholds) break;
+      
+    thrTable[t+3] = thrLowBound + 
+      (feat_t)(((float)seed.w)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
   }
 
-  // Perform computation on image samples only if they reach the current slice of
-  // trained leaves
-  if (nodeID>=startNode && nodeID<=endNode)
+  // Sort thresholds (insertion sort, few thresholds per feature): a sample response can
+  // then be encoded as a single bin index
+  for (uint t=1; t<nThresholds; t++)
   {
+    feat_t thr = thrTable[t];
+    int k = t-1;
+    for (; k>=0 && thrTable[k]>thr; k--) thrTable[k+1] = thrTable[k];
+    thrTable[k+1] = thr;
+  }
+}
+
+
+__kernel void computePerImageHistogram(__read_only image_t image,
+				       uint nChannels, uint width, uint height,
+				       __read_only image2d_t labels,
+				       __read_only image2d_t nodesID,
+				       __global uint *samples, uint nSamples,
+				       uint featDim,
+				       __global feat_t *featTable, __global feat_t *thrTable,
+				       __global int *nodeRowMap,
+				       uint nThresholds,
+				       __global uchar *perImageHistogram,
+				       int startNode, int endNode,
+				       __global int *treeLeftChildren,
+				       __global float *treePosteriors,
+				       __local feat_t *featuresBuff)
+{
+  const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
+  feat_t feat;
+  int2 coords;
+  int nodeID, row;
+
+  coords.x = samples[get_global_id(0)];
+  coords = (int2)(coords.x%width, coords.x/width);
+  nodeID = read_imagei(nodesID, sampler, coords).x;
 
-    //offset = (get_global_id(0)*get_global_size(1)+get_global_id(1))*featDim;
-    feat = computeFeature(image, nChannels, width, height, coords,
-			  treeLeftChildren, treePosteriors, nodesID,
-			  featuresBuff, featDim);
+  // Perform computation on image samples only if they reach the current slice of
+  // trained leaves
+  if (nodeID<startNode || nodeID>endNode) return;
+  row = nodeRowMap[nodeID-startNode];
+  if (row<0) return;
+
+  // Fetch the node's feature from the per-slice table
+  size_t tableOffset = row*get_global_size(1)+get_global_id(1);
+  featTable += tableOffset*featDim;
+  for (uint i=0; i<featDim; i++) ACCESS_FEATURE(featuresBuff, i, featDim) = featTable[i];
+
+  feat = computeFeature(image, nChannels, width, height, coords,
+			treeLeftChildren, treePosteriors, nodesID,
+			featuresBuff, featDim);
   
-    /** \todo speed up threshold sampling by sampling 4 thresholds at a time */
-    seed.x = treeID;
-    seed.y = read_imagei(nodesID, sampler, coords).x;
-    seed.z = get_global_id(1);
-    seed.w = 1;
-    //offset = get_global_id(0)*nThresholds*get_global_size(1)+get_global_id(1);
-    perImageHistogram += get_global_id(0)*nThresholds*get_global_size(1)+get_global_id(1);
-
-    /*
-    for (uint t=0; t<nThresholds; t++)
-    { 
-      thr = thrLowBound + (feat_t)((float)t*(thrUpBound-thrLowBound)/nThresholds);
-      //perImageHistogram[offset] = (uchar)((feat<=thr) ? 1 : 0);
-      //offset += get_global_size(1);
-      *perImageHistogram = (uchar)((feat<=thr) ? 1 : 0);
-      perImageHistogram += get_global_size(1);
-    }
-    */
-    
-    
-    for (uint t=0; t<nThresholds;)
-    { 
-      seed = md5Rand(seed);
-
-      thr = thrLowBound + 
-	(feat_t)(((float)seed.x)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
-      //perImageHistogram[offset] = (uchar)((feat<=thr) ? 1 : 0);
-      //offset += get_global_size(1);
-      *perImageHistogram = (uchar)((feat<=thr) ? 1 : 0);
-      perImageHistogram += get_global_size(1);
-      ++t;
-      if ((t)>=nThresholds) break;
-
-      thr = thrLowBound + 
-	(feat_t)(((float)seed.y)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
-      //perImageHistogram[offset] = (uchar)((feat<=thr) ? 1 : 0);
-      //offset += get_global_size(1);
-      *perImageHistogram = (uchar)((feat<=thr) ? 1 : 0);
-      perImageHistogram += get_global_size(1);
-      ++t;
-      if ((t)>=nThresholds) break;
-    
-      thr = thrLowBound + 
-	(feat_t)(((float)seed.z)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
-      //perImageHistogram[offset] = (uchar)((feat<=thr) ? 1 : 0);
-      //offset += get_global_size(1);
-      *perImageHistogram = (uchar)((feat<=thr) ? 1 : 0);
-      perImageHistogram += get_global_size(1);
-      ++t;
-      if ((t)>=nThresholds) break;
-      
-      thr = thrLowBound + 
-	(feat_t)(((float)seed.w)/(0xFFFFFFFF)*(thrUpBound-thrLowBound));
-      //perImageHistogram[offset] = (uchar)((feat<=thr) ? 1 : 0);
-      //offset += get_global_size(1);
-      *perImageHistogram = (uchar)((feat<=thr) ? 1 : 0);
-      perImageHistogram += get_global_size(1);
-      ++t;
-    }
-    
-  }
+  // Thresholds are sorted: store the index of the first threshold greater or equal than
+  // the feature response (i.e. the number of thresholds lower than it). The per-threshold
+  // counters are rebuilt on the host by a prefix sum over bins
+  uchar bin = 0;
+  thrTable += tableOffset*nThresholds;
+  for (uint t=0; t<nThresholds; t++) bin += (uchar)((feat>thrTable[t]) ? 1 : 0);
+  perImageHistogram[get_global_id(0)*get_global_size(1)+get_global_id(1)] = bin;
+}
+
+
+// Exact split search: store the raw feature response of each (sample, feature) pair, later
+// sorted on the host to evaluate every distinct cut. The signature matches the one of
+// computePerImageHistogram (thresholds table and number of thresholds are unused)
+__kernel void computePerImageResponses(__read_only image_t image,
+				       uint nChannels, uint width, uint height,
+				       __read_only image2d_t labels,
+				       __read_only image2d_t nodesID,
+				       __global uint *samples, uint nSamples,
+				       uint featDim,
+				       __global feat_t *featTable, __global feat_t *thrTable,
+				       __global int *nodeRowMap,
+				       uint nThresholds,
+				       __global feat_t *perImageResponses,
+				       int startNode, int endNode,
+				       __global int *treeLeftChildren,
+				       __global float *treePosteriors,
+				       __local feat_t *featuresBuff)
+{
+  const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
+  int2 coords;
+  int nodeID, row;
+
+  coords.x = samples[get_global_id(0)];
+  coords = (int2)(coords.x%width, coords.x/width);
+  nodeID = read_imagei(nodesID, sampler, coords).x;
+
+  if (nodeID<startNode || nodeID>endNode) return;
+  row = nodeRowMap[nodeID-startNode];
+  if (row<0) return;
+
+  featTable += (row*get_global_size(1)+get_global_id(1))*featDim;
+  for (uint i=0; i<featDim; i++) ACCESS_FEATURE(featuresBuff, i, featDim) = featTable[i];
+
+  perImageResponses[get_global_id(0)*get_global_size(1)+get_global_id(1)] =
+    computeFeature(image, nChannels, width, height, coords,
+		   treeLeftChildren, treePosteriors, nodesID,
+		   featuresBuff, featDim);
 }
 
 
@@ -367,3 +398,36 @@ uint4 md5Rand(uint4 seed)
   // Done
   return state;
 }
+
+
+/**********************************************************/
+// Philox4x32-10 counter-based PRNG
+#define PHILOX_M0 (0xD2511F53u)
+#define PHILOX_M1 (0xCD9E8D57u)
+#define PHILOX_W0 (0x9E3779B9u)
+#define PHILOX_W1 (0xBB67AE85u)
+#define PHILOX_KEY0 (0x243F6A88u)
+#define PHILOX_KEY1 (0x85A308D3u)
+#define PHILOX_ROUNDS (10)
+
+uint4 philoxRand(uint4 seed)
+{
+  uint2 key = (uint2)(PHILOX_KEY0, PHILOX_KEY1);
+  uint4 state = seed;
+  uint hi0, lo0, hi1, lo1;
+
+  for (uint r=0; r<PHILOX_ROUNDS; r++)
+  {
+    hi0 = mul_hi(PHILOX_M0, state.x);
+    lo0 = PHILOX_M0*state.x;
+    hi1 = mul_hi(PHILOX_M1, state.z);
+    lo1 = PHILOX_M1*state.z;
+
+    state = (uint4)(hi1^state.y^key.x, lo1, hi0^state.w^key.y, lo0);
+
+    key.x += PHILOX_W0;
+    key.y += PHILOX_W1;
+  }
+
+  return state;
+}
@@ -19,23 +19,57 @@
 
 #define EPS (1.e-6)
 
+// Compare two (gain, feature/threshold pair index) candidates: the highest gain wins, ties
+// are broken in favour of the lowest pair index (i.e. the first candidate in pair order)
+#define IS_BETTER_CANDIDATE(__e1, __p1, __e2, __p2)		\
+  ((__e1)>(__e2) || ((__e1)==(__e2) && (__p1)<(__p2)))
+
+// Work-group reduction of the per-work-item candidates stored in local memory
+// Note: work-group size must be a power of two
+#define REDUCE_CANDIDATES(__entropies, __pairs)				\
+  for (uint __s=get_local_size(0)/2; __s>0; __s>>=1)			\
+  {									\
+    barrier(CLK_LOCAL_MEM_FENCE);					\
+    uint __lid = get_local_id(0);					\
+    if (__lid<__s &&							\
+	IS_BETTER_CANDIDATE(__entropies[__lid+__s], __pairs[__lid+__s],	\
+			    __entropies[__lid], __pairs[__lid]))	\
+    {									\
+      __entropies[__lid] = __entropies[__lid+__s];			\
+      __pairs[__lid] = __pairs[__lid+__s];				\
+    }									\
+  }									\
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+
+// Compute the split score of perThreadFeatThrPairs feature/threshold pairs per
+// work-item and reduce them to a single candidate per work-group.
+// The score is the information gain, unless SPLIT_CRITERION_GINI (Gini gain) or
+// SPLIT_CRITERION_GAIN_RATIO (information gain ratio) is defined at build time.
+// Pairs leaving less than minChildSamples (at least one) samples to a child get the lowest
+// score, hence they never win against a valid pair.
+// Note: the NDRange is 2D, i.e. (per-node pairs/perThreadFeatThrPairs rounded up to the
+// work-group size, number of nodes), hence each work-group works on a single node
 __kernel void learnBestFeature(__global unsigned int *histogram,
 			       __global unsigned int *perClassTotSamples,
 			       unsigned int nFeatures, unsigned int nThresholds,
 			       unsigned int nClasses,
 			       unsigned int perThreadFeatThrPairs,
-			       __global unsigned int *bestFeatures,
-			       __global unsigned int *bestThresholds,
-			       __global float *entropies
+			       __global unsigned int *groupBestPairs,
+			       __global float *groupBestEntropies,
+			       __local unsigned int *localPairs,
+			       __local float *localEntropies,
+			       unsigned int minChildSamples
 			       )
 {
   float tmp, h, hL, hR, currBestEntropy;
-  int offset, nL, nR, currBestFeature, currBestThreshold;
-  int nodeID, featureID, thrID;
+  int offset, nL, nR;
+  unsigned int nodeID, featureID, thrID, pairID, currBestPair;
 
-  // Suppose the first feature and threshold as the best ones
-  currBestFeature = get_global_id(0);
-  currBestThreshold = 0;
+  // Work-items without pairs to evaluate never win the reduction
+  currBestEntropy = -MAXFLOAT;
+  currBestPair = UINT_MAX;
+  nodeID = get_global_id(1);
 
   for (int i=0; i<perThreadFeatThrPairs; i++)
   {
@@ -45,18 +79,16 @@ __kernel void learnBestFeature(__global unsigned int *histogram,
     nL = 0;
     nR = 0;
 
-    // Compute the current node, feature and threshold IDs and build the
-    // corresponding offset within the histogram
+    // Compute the current feature and threshold IDs and build the corresponding offset
+    // within the histogram
     // Note: historam dimensions:
     // - node ID
     // - threshold ID
     // - feature ID
-    offset = get_global_id(0)*perThreadFeatThrPairs+i;
-    nodeID = offset/(nFeatures*nThresholds);
-    //featureID = (offset%(nFeatures*nThresholds))/nThresholds;
-    //thrID = offset%nThresholds;
-    thrID = (offset%(nFeatures*nThresholds))/nFeatures;
-    featureID = offset%nFeatures;
+    pairID = get_global_id(0)*perThreadFeatThrPairs+i;
+    if (pairID>=nFeatures*nThresholds) break;
+    thrID = pairID/nFeatures;
+    featureID = pairID%nFeatures;
 
     // Compute the number of samples which, for the current feature/threshold pair,
     // reach the left and right branch respectively
@@ -71,7 +103,8 @@ __kernel void learnBestFeature(__global unsigned int *histogram,
       nR += perClassTotSamples[nodeID*nClasses+l]-histogram[offset];
     }
 
-    // Compute the information gain and update the best one if improved
+    // Compute the split score of the criterion selected at build time and update the best
+    // one if improved
     for (int l=0; l<nClasses; l++)
     {
       offset =\
@@ -80,6 +113,15 @@ __kernel void learnBestFeature(__global unsigned int *histogram,
 	thrID     * (nFeatures) +
 	featureID;
 
+#ifdef SPLIT_CRITERION_GINI
+      // Sums of squared per-class counts, no transcendental functions needed
+      tmp = (float)perClassTotSamples[nodeID*nClasses+l];
+      h += tmp*tmp;
+      tmp = (float)histogram[offset];
+      hL += tmp*tmp;
+      tmp = (float)(perClassTotSamples[nodeID*nClasses+l]-histogram[offset]);
+      hR += tmp*tmp;
+#else
       //tmp = (float)(histogram[offset] + histogram[offset+1])/(nL+nR);
       tmp = ((float)perClassTotSamples[nodeID*nClasses+l])/(nL+nR);
       h -= (tmp<=EPS) ? 0.0f : tmp*log2(tmp);
@@ -89,25 +131,82 @@ __kernel void learnBestFeature(__global unsigned int *histogram,
 
       tmp = (nR) ? (float)(perClassTotSamples[nodeID*nClasses+l]-histogram[offset])/nR : 0.0f;
       hR -= (tmp<=EPS) ? 0.0f : tmp*log2(tmp);
+#endif
     }
+#ifdef SPLIT_CRITERION_GINI
+    // Gini gain, i.e. G(parent) - (nL/N*G(left) + nR/N*G(right)) with G = 1 - sum_l p_l^2
+    tmp = (((nL) ? hL/nL : 0.0f) + ((nR) ? hR/nR : 0.0f) - h/(nL+nR))/(nL+nR);
+#else
     tmp = h - ((float)nL/(nL+nR)*hL + (float)nR/(nL+nR)*hR); // Final information gain
     //tmp = 2.0*tmp/(h+hL+hR); // Final normalized information gain
+#ifdef SPLIT_CRITERION_GAIN_RATIO
+    // Information gain normalized by the split information
+    {
+      float pL = (float)nL/(nL+nR), pR = (float)nR/(nL+nR);
+      float splitInfo = -(((pL<=EPS) ? 0.0f : pL*log2(pL)) + ((pR<=EPS) ? 0.0f : pR*log2(pR)));
+      tmp = (splitInfo<=EPS) ? 0.0f : tmp/splitInfo;
+    }
+#endif
+#endif
+    if (nL<minChildSamples || nR<minChildSamples) tmp = -MAXFLOAT;
 
     if (!i || tmp>currBestEntropy)
     {
       currBestEntropy=tmp;
-      currBestFeature=featureID;
-      currBestThreshold=thrID;
+      currBestPair=pairID;
     }
   }
 
-  /**
-   * \todo  in order to reduce global memory write, save only the feature/threshold pair index and
-   *        compute the corresponding feature and threshold IDs host side
-   */
-  bestFeatures[get_global_id(0)] = currBestFeature;
-  bestThresholds[get_global_id(0)] = currBestThreshold;
-  entropies[get_global_id(0)] = currBestEntropy;
+  localEntropies[get_local_id(0)] = currBestEntropy;
+  localPairs[get_local_id(0)] = currBestPair;
+  REDUCE_CANDIDATES(localEntropies, localPairs);
+
+  if (!get_local_id(0))
+  {
+    offset = nodeID*get_num_groups(0)+get_group_id(0);
+    groupBestPairs[offset] = localPairs[0];
+    groupBestEntropies[offset] = localEntropies[0];
+  }
+}
+
+
+// Reduce the per-work-group candidates of learnBestFeature to the best feature/threshold
+// pair of each node. One work-group per node.
+__kernel void reduceBestFeature(__global unsigned int *groupBestPairs,
+				__global float *groupBestEntropies,
+				unsigned int nGroups, unsigned int nFeatures,
+				__global unsigned int *bestFeatures,
+				__global unsigned int *bestThresholds,
+				__global float *entropies,
+				__local unsigned int *localPairs,
+				__local float *localEntropies)
+{
+  unsigned int nodeID = get_group_id(0);
+  unsigned int currBestPair = UINT_MAX;
+  float currBestEntropy = -MAXFLOAT;
+
+  groupBestPairs += nodeID*nGroups;
+  groupBestEntropies += nodeID*nGroups;
+  for (unsigned int g=get_local_id(0); g<nGroups; g+=get_local_size(0))
+  {
+    if (IS_BETTER_CANDIDATE(groupBestEntropies[g], groupBestPairs[g],
+			    currBestEntropy, currBestPair))
+    {
+      currBestEntropy = groupBestEntropies[g];
+      currBestPair = groupBestPairs[g];
+    }
+  }
+
+  localEntropies[get_local_id(0)] = currBestEntropy;
+  localPairs[get_local_id(0)] = currBestPair;
+  REDUCE_CANDIDATES(localEntropies, localPairs);
+
+  if (!get_local_id(0))
+  {
+    bestFeatures[nodeID] = localPairs[0]%nFeatures;
+    bestThresholds[nodeID] = localPairs[0]/nFeatures;
+    entropies[nodeID] = localEntropies[0];
+  }
 }
 
 
@@ -115,3 +115,49 @@ __kernel void computePosterior(__read_only image2d_t nodesID,
     }
   }
 }
+
+
+// Leaf posteriors refit: traverse the whole tree in a single launch and count, for each
+// labeled pixel, its label on the reached leaf ([node][class] histogram)
+// Note: features depending on the tree being trained are not supported, the imageNodesID
+// argument of computeFeature is a zero (i.e. root) image
+__kernel void refitLeaves(__read_only image_t image, __read_only image2d_t labels,
+			  uint nChannels, uint width, uint height,
+			  __global int *treeLeftChildren,
+			  __global feat_t *treeFeatures, unsigned int featDim,
+			  __global feat_t *treeThresholds,
+			  __global float *treePosteriors,
+			  __read_only image2d_t imageNodesID,
+			  uint nClasses,
+			  __global uint *leafHistogram,
+			  __local feat_t *featuresBuff)
+{
+  const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
+  int2 coords = (int2)(get_global_id(0), get_global_id(1));
+
+  if (get_global_id(0) >= width || get_global_id(1) >= height) return;
+
+  unsigned char label = read_imageui(labels, sampler, coords).x;
+  if (!label) return;
+
+  int nodeID = 0;
+  int leftChild = treeLeftChildren[0];
+  while (leftChild > 0)
+  {
+    __global feat_t *feature = treeFeatures+nodeID*featDim;
+    feat_t thr = treeThresholds[nodeID];
+
+    for (int i=0; i<featDim; i++)
+      ACCESS_FEATURE(featuresBuff, i, featDim) = feature[i];
+
+    feat_t response = computeFeature(image, nChannels, width, height, coords,
+				     treeLeftChildren,
+				     treePosteriors,
+				     imageNodesID,
+				     featuresBuff, featDim);
+    nodeID = leftChild + ((response<=thr) ? 0 : 1);
+    leftChild = treeLeftChildren[nodeID];
+  }
+
+  atomic_inc(leafHistogram+nodeID*nClasses+label-1);
+}
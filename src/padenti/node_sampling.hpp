@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __NODE_SAMPLING_HPP
+#define __NODE_SAMPLING_HPP
+
+#include <algorithm>
+#include <padenti/tree_trainer.hpp>
+#include <padenti/prng.hpp>
+
+// Host generation of the random features and thresholds sampled for each node: the
+// generators are seeded with the (tree ID, node ID, feature ID) triplet, hence trainers
+// sample the same candidates for the same node regardless of where the node is trained
+
+// Generate the bestFeature-th feature of a node, as done by the generateFeatThrTables kernel
+/**
+ * \todo move integer-to-float conversion to prng, i.e. assume prngs work on floats
+ */
+template <typename FeatType, unsigned int FeatDim>
+inline void _generateNodeFeature(PRNGFunc prngRand,
+				 const TreeTrainerParameters<FeatType, FeatDim> &params,
+				 unsigned int treeID, unsigned int nodeID, unsigned int featureID,
+				 FeatType *feature)
+{
+  /*
+  unsigned int seed[4] = {tree.getID()^m_seed,
+			  nodeID^m_seed,
+			  bestFeature^m_seed,
+			  m_seed};
+  */
+  unsigned int seed[4] = {treeID,
+			  nodeID,
+			  featureID,
+			  0};
+  unsigned int state[4];
+  for (unsigned int j=0; j<FeatDim; j+=4)
+  {
+    prngRand(seed, state);
+	 
+    feature[j] = params.featLowBounds[j] +
+      (FeatType)(((float)state[0])/(0xFFFFFFFF)*(params.featUpBounds[j]-params.featLowBounds[j]));
+    if ((j+1)>=FeatDim) break;
+
+    feature[j+1] = params.featLowBounds[j+1]  +
+      (FeatType)(((float)state[1])/(0xFFFFFFFF)*(params.featUpBounds[j+1]-params.featLowBounds[j+1]));
+    if ((j+2)>=FeatDim) break;
+	  
+    feature[j+2] = params.featLowBounds[j+2] +
+      (FeatType)(((float)state[2])/(0xFFFFFFFF)*(params.featUpBounds[j+2]-params.featLowBounds[j+2]));
+    if ((j+3)>=FeatDim) break;	  
+
+    feature[j+3] = params.featLowBounds[j+3] +
+      (FeatType)(((float)state[3])/(0xFFFFFFFF)*(params.featUpBounds[j+3]-params.featLowBounds[j+3]));
+	  
+    std::copy(state, state+4, seed);
+  }
+}
+
+
+// Generate the sorted random thresholds of a node feature, as done by the
+// generateFeatThrTables kernel
+template <typename FeatType, unsigned int FeatDim>
+inline void _generateNodeThresholds(PRNGFunc prngRand,
+				    const TreeTrainerParameters<FeatType, FeatDim> &params,
+				    unsigned int treeID, unsigned int nodeID, unsigned int featureID,
+				    FeatType *thresholds)
+{
+  unsigned int seed[4] = {treeID,
+			  nodeID,
+			  featureID,
+			  1};
+  unsigned int state[4];
+  for (unsigned int j=0; j<params.nThresholds; j++)
+  {
+    if (!(j%4))
+    {
+      prngRand(seed, state);
+      std::copy(state, state+4, seed);
+    }
+    thresholds[j] = params.thrLowBound +
+      (FeatType)((float)state[j%4]/0xFFFFFFFF*(params.thrUpBound-params.thrLowBound));
+  }
+  std::sort(thresholds, thresholds+params.nThresholds);
+}
+
+#endif // __NODE_SAMPLING_HPP
@@ -0,0 +1,201 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __NODE_TRAINING_HPP
+#define __NODE_TRAINING_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <utility>
+#include <vector>
+#include <padenti/tree_trainer.hpp>
+#include <padenti/node_sampling.hpp>
+
+// Host node training steps shared by the tree trainers: frontier selection, stop criteria
+// and tree update from the best split of a node. Per-node statistics are indexed by node
+// ID, i.e. perClassTotSamples[nodeID*nClasses+l] counts the class l samples reaching nodeID
+
+// Check whether a node meets the purity stop criterion
+template <typename FeatType, unsigned int FeatDim>
+inline bool _isPureNode(const TreeTrainerParameters<FeatType, FeatDim> &params,
+			unsigned int nClasses, const unsigned int *perNodeTotSamples,
+			const unsigned int *perClassTotSamples, unsigned int nodeID)
+{
+  if (params.purityThr<=0.0f || !perNodeTotSamples[nodeID]) return false;
+
+  const unsigned int *classTotSamples = &perClassTotSamples[nodeID*nClasses];
+  unsigned int maxClassSamples = *std::max_element(classTotSamples, classTotSamples+nClasses);
+  return (float)maxClassSamples/perNodeTotSamples[nodeID]>=params.purityThr;
+}
+
+
+// Check the split stop criteria: if all the pixels follow the same path, or the split does
+// not meet the criteria, the best feature is not discriminative enough and the node is kept
+// as a leaf
+template <typename FeatType, unsigned int FeatDim>
+inline bool _isValidSplit(const TreeTrainerParameters<FeatType, FeatDim> &params,
+			  unsigned int lSum, unsigned int rSum, float gain)
+{
+  if (!lSum || !rSum) return false;
+  if (lSum<params.minChildSamples || rSum<params.minChildSamples) return false;
+  return !(params.minGain>0.0f && gain<params.minGain);
+}
+
+
+// Select the nodes of the current depth to be trained and store their IDs, sorted, in the
+// frontier. If cpuSubtreeRoots is not NULL, nodes reached by at most cpuSubtreeMaxSamples
+// samples are stored there instead (i.e. they are trained, with their whole subtree, by the
+// CPU subtrees path)
+template <typename FeatType, unsigned int FeatDim, unsigned int nClasses>
+inline unsigned int _selectFrontier(const Tree<FeatType, FeatDim, nClasses> &tree,
+				    const TreeTrainerParameters<FeatType, FeatDim> &params,
+				    unsigned int currDepth, const unsigned int *perNodeTotSamples,
+				    const unsigned int *perClassTotSamples, int *frontier,
+				    std::vector<int> *cpuSubtreeRoots=NULL,
+				    unsigned int cpuSubtreeMaxSamples=0)
+{
+  size_t currFrontierSize = currDepth>1 ? (2<<(currDepth-2)) : 1;
+  unsigned int startNode = currFrontierSize-1;
+  unsigned int toTrainNodes = 0;
+
+  if (cpuSubtreeRoots) cpuSubtreeRoots->clear();
+
+  if (currDepth>1)
+  {
+    for (unsigned int i=0; i<currFrontierSize; i++)
+    {
+      const TreeNode<FeatType, FeatDim> &currNode = tree.getNode(startNode+i);
+      if (*currNode.m_leftChild==-1 && perNodeTotSamples[startNode+i]>params.perLeafSamplesThr &&
+	  !_isPureNode(params, nClasses, perNodeTotSamples, perClassTotSamples, startNode+i))
+      {
+	if (cpuSubtreeRoots && perNodeTotSamples[startNode+i]<=cpuSubtreeMaxSamples)
+	{
+	  cpuSubtreeRoots->push_back(startNode+i);
+	  continue;
+	}
+	frontier[toTrainNodes++] = startNode+i;
+      }
+    }
+
+    // Keep only the maxFrontierNodes nodes reached by more samples, sorted by ID as
+    // required by the per-slice node ranges
+    if (params.maxFrontierNodes && toTrainNodes>params.maxFrontierNodes)
+    {
+      std::vector<std::pair<unsigned int, int> > candidates(toTrainNodes);
+      for (unsigned int i=0; i<toTrainNodes; i++)
+      {
+	candidates[i] = std::make_pair(UINT_MAX-perNodeTotSamples[frontier[i]], frontier[i]);
+      }
+      std::partial_sort(candidates.begin(), candidates.begin()+params.maxFrontierNodes,
+			candidates.end());
+      toTrainNodes = params.maxFrontierNodes;
+      for (unsigned int i=0; i<toTrainNodes; i++) frontier[i] = candidates[i].second;
+      std::sort(frontier, frontier+toTrainNodes);
+    }
+  }
+  else if (cpuSubtreeRoots && perNodeTotSamples[0]<=cpuSubtreeMaxSamples)
+  {
+    cpuSubtreeRoots->push_back(0);
+  }
+  else
+  {
+    // Note: when starting from depth 1, root node gets always trained
+    frontier[0] = 0;
+    toTrainNodes = 1;
+  }
+
+  return toTrainNodes;
+}
+
+
+// Split a node given its best feature/threshold pair and the corresponding left child
+// per-class number of samples: update the node and its children and their statistics.
+// Return false if the split does not meet the stop criteria (i.e. the node is kept as a
+// leaf)
+template <typename FeatType, unsigned int FeatDim, unsigned int nClasses>
+inline bool _splitNode(Tree<FeatType, FeatDim, nClasses> &tree,
+		       const TreeTrainerParameters<FeatType, FeatDim> &params,
+		       PRNGFunc prngRand, unsigned int *perNodeTotSamples,
+		       unsigned int *perClassTotSamples, unsigned int nodeID,
+		       unsigned int bestFeature, FeatType bestThreshold, float bestGain,
+		       const unsigned int *leftHistogram)
+{
+  const TreeNode<FeatType, FeatDim> &currNode = tree.getNode(nodeID);
+  const TreeNode<FeatType, FeatDim> &leftChildNode = tree.getNode(nodeID*2+1);
+  const TreeNode<FeatType, FeatDim> &rightChildNode = tree.getNode(nodeID*2+2);
+  unsigned int rightHistogram[nClasses];
+  unsigned int lSum=0, rSum=0;
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    rightHistogram[l] = perClassTotSamples[nodeID*nClasses+l]-leftHistogram[l];
+    lSum += leftHistogram[l];
+    rSum += rightHistogram[l];
+  }
+  if (!_isValidSplit(params, lSum, rSum, bestGain)) return false;
+
+  // Update the children statistics and posteriors
+  perNodeTotSamples[nodeID*2+1] = lSum;
+  perNodeTotSamples[nodeID*2+2] = rSum;
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    perClassTotSamples[(nodeID*2+1)*nClasses+l] = leftHistogram[l];
+    perClassTotSamples[(nodeID*2+2)*nClasses+l] = rightHistogram[l];
+    leftChildNode.m_posterior[l] = ((float)leftHistogram[l])/lSum;
+    rightChildNode.m_posterior[l] = ((float)rightHistogram[l])/rSum;
+  }
+  assert((lSum+rSum)==perNodeTotSamples[nodeID]);
+  *leftChildNode.m_leftChild = -1;
+  *rightChildNode.m_leftChild = -1;
+
+  // Finally, recompute the feature of the node and set its threshold and left child
+  _generateNodeFeature(prngRand, params, tree.getID(), nodeID, bestFeature, currNode.m_feature);
+  *currNode.m_threshold = bestThreshold;
+  *currNode.m_leftChild = nodeID*2+1;
+
+  return true;
+}
+
+
+// Split a node given the best feature/threshold pair found on its histogram of left child
+// counters ([class][threshold][feature] layout): the threshold index refers to the sorted
+// per-feature thresholds, hence all of them are generated to recompute its value
+template <typename FeatType, unsigned int FeatDim, unsigned int nClasses>
+inline bool _splitHistogramNode(Tree<FeatType, FeatDim, nClasses> &tree,
+				const TreeTrainerParameters<FeatType, FeatDim> &params,
+				PRNGFunc prngRand, unsigned int *perNodeTotSamples,
+				unsigned int *perClassTotSamples, unsigned int nodeID,
+				const unsigned int *histogram, unsigned int bestFeature,
+				unsigned int bestThreshold, float bestGain)
+{
+  std::vector<FeatType> thresholds(params.nThresholds);
+  unsigned int leftHistogram[nClasses];
+
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    leftHistogram[l] = histogram[l*params.nThresholds*params.nFeatures+
+				 bestThreshold*params.nFeatures+bestFeature];
+  }
+  _generateNodeThresholds(prngRand, params, tree.getID(), nodeID, bestFeature, &thresholds[0]);
+
+  return _splitNode(tree, params, prngRand, perNodeTotSamples, perClassTotSamples, nodeID,
+		    bestFeature, thresholds[bestThreshold], bestGain, leftHistogram);
+}
+
+#endif // __NODE_TRAINING_HPP
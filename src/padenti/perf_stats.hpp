@@ -0,0 +1,132 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __PERF_STATS_HPP
+#define __PERF_STATS_HPP
+
+#include <cstddef>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif // __linux__
+
+
+/*!
+ * \brief Performance statistics of a single trained depth.
+ *
+ * Device times are measured with OpenCL profiling and summed over all the images (images
+ * processed simultaneously by different pipeline slots are summed as well). Host times
+ * are wall clock times.
+ */
+class TrainingDepthStats
+{
+public:
+  unsigned int depth;            /*!< Trained depth */
+  unsigned int frontierSize;     /*!< Number of nodes trained at this depth */
+  unsigned int nSlices;          /*!< Number of global histogram slices */
+  unsigned int nVisitedImages;   /*!< Images traversed, summed over the slices */
+  unsigned int nSkippedImages;   /*!< Images skipped (no sample reaching the slice nodes),
+				   summed over the slices */
+  double time;                   /*!< Depth training time (seconds) */
+  double writeTime;              /*!< Device time of images, labels and samples writes */
+  double computeTime;            /*!< Device time of prediction and per-image histograms */
+  double readTime;               /*!< Device time of per-image results reads */
+  double histogramUpdateTime;    /*!< Host time of the global histogram updates */
+  double reduceTime;             /*!< Host time of the global histogram reduction among the
+				   processes (data-parallel training only) */
+  double learnTime;              /*!< Best feature/threshold pairs search time */
+  size_t bytesWritten;           /*!< Bytes transferred to the devices */
+  size_t bytesRead;              /*!< Bytes transferred from the devices */
+
+  TrainingDepthStats();
+};
+
+
+/*!
+ * \brief Performance statistics of a tree training.
+ */
+class TrainingStats
+{
+public:
+  std::vector<TrainingDepthStats> depths; /*!< Per-depth statistics, in training order */
+  double initTime;               /*!< Training initialization time (seconds) */
+  double time;                   /*!< Total training time (seconds) */
+  size_t histogramSize;          /*!< Size of the global histogram (bytes) */
+  size_t deviceBuffersSize;      /*!< Size of the device buffers (bytes, images excluded) */
+  size_t peakResidentSize;       /*!< Peak resident memory of the process (bytes, 0 if not
+				   available) */
+
+  TrainingStats();
+};
+
+
+/*!
+ * \brief Performance statistics of the predictions performed by a classifier, accumulated
+ * over the predict() calls since the last reset.
+ */
+class PredictionStats
+{
+public:
+  unsigned int nImages;          /*!< Number of predicted images */
+  size_t nPixels;                /*!< Number of predicted pixels */
+  double time;                   /*!< Total predict() time (seconds) */
+  double writeTime;              /*!< Device time of images and masks writes */
+  double computeTime;            /*!< Device time of trees traversal and posteriors */
+  double readTime;               /*!< Device time of results reads */
+  size_t bytesWritten;           /*!< Bytes transferred to the device */
+  size_t bytesRead;              /*!< Bytes transferred from the device */
+
+  PredictionStats();
+};
+
+
+inline TrainingDepthStats::TrainingDepthStats():
+  depth(0), frontierSize(0), nSlices(0), nVisitedImages(0), nSkippedImages(0),
+  time(0), writeTime(0), computeTime(0), readTime(0), histogramUpdateTime(0),
+  reduceTime(0), learnTime(0), bytesWritten(0), bytesRead(0)
+{}
+
+
+inline TrainingStats::TrainingStats():
+  initTime(0), time(0), histogramSize(0), deviceBuffersSize(0), peakResidentSize(0)
+{}
+
+
+inline PredictionStats::PredictionStats():
+  nImages(0), nPixels(0), time(0), writeTime(0), computeTime(0), readTime(0),
+  bytesWritten(0), bytesRead(0)
+{}
+
+
+/*!
+ * Get the peak resident memory of the calling process.
+ *
+ * \return The peak size in bytes, or 0 if not available on this platform
+ */
+inline size_t getPeakResidentSize()
+{
+#ifdef __linux__
+  struct rusage usage;
+  if (!getrusage(RUSAGE_SELF, &usage)) return static_cast<size_t>(usage.ru_maxrss)*1024;
+#endif // __linux__
+  return 0;
+}
+
+#endif // __PERF_STATS_HPP
@@ -20,6 +20,21 @@
 #ifndef __PRNG_HPP
 #define __PRNG_HPP
 
+#include <algorithm>
+
+/*!
+ * Counter-based pseudo-random generators used for features and thresholds sampling.
+ * Each generator maps a 4-words seed (tree ID, node ID, feature ID, counter) to a 4-words
+ * random state. Host and OpenCL implementations must return the same values.
+ */
+enum PRNGType
+{
+  PRNG_MD5,    /*!< MD5 compression function (64 steps) */
+  PRNG_PHILOX  /*!< Philox4x32-10 (10 rounds of multiply/xor) */
+};
+
+typedef void (*PRNGFunc)(const unsigned int seed[], unsigned int state[]);
+
 // Round rotations
 #define S11 7
 #define S12 12
@@ -104,7 +119,7 @@
   }
 
 
-void md5Rand(const unsigned int seed[], unsigned int state[])
+inline void md5Rand(const unsigned int seed[], unsigned int state[])
 {
   // Init state
   state[0] = 0x67452301;
@@ -194,4 +209,96 @@ void md5Rand(const unsigned int seed[], unsigned int state[])
   // Done
 }
 
+
+// Philox4x32-10 multipliers, Weyl sequence key increments and key used for features and
+// thresholds sampling
+static const unsigned int PHILOX_M0 = 0xD2511F53u;
+static const unsigned int PHILOX_M1 = 0xCD9E8D57u;
+static const unsigned int PHILOX_W0 = 0x9E3779B9u;
+static const unsigned int PHILOX_W1 = 0xBB67AE85u;
+static const unsigned int PHILOX_KEY0 = 0x243F6A88u;
+static const unsigned int PHILOX_KEY1 = 0x85A308D3u;
+static const unsigned int PHILOX_ROUNDS = 10;
+
+/*!
+ * Philox4x32-10 bijection of a 4-words counter under a 2-words key.
+ *
+ * \param counter The input counter
+ * \param key The input key
+ * \param state The output random state
+ */
+inline void philox4x32(const unsigned int counter[], const unsigned int key[],
+		       unsigned int state[])
+{
+  unsigned int roundKey[2] = {key[0], key[1]};
+  unsigned long long prod0, prod1;
+  
+  std::copy(counter, counter+4, state);
+  for (unsigned int r=0; r<PHILOX_ROUNDS; r++)
+  {
+    prod0 = (unsigned long long)PHILOX_M0*state[0];
+    prod1 = (unsigned long long)PHILOX_M1*state[2];
+
+    state[0] = (unsigned int)(prod1>>32)^state[1]^roundKey[0];
+    state[1] = (unsigned int)prod1;
+    state[2] = (unsigned int)(prod0>>32)^state[3]^roundKey[1];
+    state[3] = (unsigned int)prod0;
+
+    roundKey[0] += PHILOX_W0;
+    roundKey[1] += PHILOX_W1;
+  }
+
+  // Done
+}
+
+
+inline void philoxRand(const unsigned int seed[], unsigned int state[])
+{
+  static const unsigned int key[2] = {PHILOX_KEY0, PHILOX_KEY1};
+  philox4x32(seed, key, state);
+}
+
+
+/*!
+ * Get the host implementation of a pseudo-random generator.
+ *
+ * \param type The generator type
+ * \return The generator function
+ */
+inline PRNGFunc getPRNGFunc(PRNGType type)
+{
+  return (type==PRNG_PHILOX) ? philoxRand : md5Rand;
+}
+
+// MD5 helper macros are not part of the interface
+#undef S11
+#undef S12
+#undef S13
+#undef S14
+#undef S21
+#undef S22
+#undef S23
+#undef S24
+#undef S31
+#undef S32
+#undef S33
+#undef S34
+#undef S41
+#undef S42
+#undef S43
+#undef S44
+#undef ROTATE_LEFT
+#undef F
+#undef G
+#undef H
+#undef I
+#undef FF
+#undef GG
+#undef HH
+#undef II
+#undef FF_noadd
+#undef GG_noadd
+#undef HH_noadd
+#undef II_noadd
+
 #endif // __PRNG_HPP
@@ -0,0 +1,121 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __SHM_COMMUNICATOR_HPP
+#define __SHM_COMMUNICATOR_HPP
+
+#include <cstddef>
+#include <string>
+
+// Default number of unsigned int counters exchanged by each rank at each all-reduce round
+#define SHM_COMMUNICATOR_CHUNK_SIZE (1lu<<22)
+
+struct ShmCommunicatorHeader;
+
+
+/*!
+ * \brief Collective operations among the processes of a single host, through a POSIX
+ * shared memory segment.
+ *
+ * The segment stores a process-shared barrier and a staging area of chunkSize counters per
+ * rank. Large buffers are exchanged in rounds of chunkSize counters: all-reduces are
+ * performed as a reduce-scatter (each rank sums its own portion of the chunk across all the
+ * ranks, i.e. the reduction is spread over all the processes and their NUMA nodes) followed
+ * by an all-gather.
+ *
+ * All the ranks must create a communicator with the same name and number of ranks, and
+ * must call the collective operations in the same order. The segment is created by rank 0
+ * (the name must be unique among the communicators simultaneously alive on the host), its
+ * name is removed once all the ranks attached. A segment left under the name by a crashed
+ * run is replaced by rank 0; other ranks that attached to it meanwhile detect the
+ * replacement and attach again.
+ *
+ * Note: currently available on Linux only.
+ */
+class ShmCommunicator
+{
+private:
+  std::string m_name;
+  unsigned int m_nRanks;
+  unsigned int m_rank;
+  size_t m_chunkSize;
+  size_t m_segmentSize;
+  ShmCommunicatorHeader *m_header;
+  unsigned int *m_staging;
+
+  ShmCommunicator(const ShmCommunicator &);
+  ShmCommunicator &operator=(const ShmCommunicator &);
+public:
+  /*!
+   * Create (rank 0) or attach to (other ranks) the shared memory segment. Blocks until the
+   * segment has been initialized by rank 0.
+   *
+   * \param name Segment name, shared by all the ranks
+   * \param nRanks Number of processes
+   * \param rank Index of the calling process, in [0, nRanks)
+   * \param chunkSize Number of counters exchanged by each rank at each round
+   */
+  ShmCommunicator(const std::string &name, unsigned int nRanks, unsigned int rank,
+		  size_t chunkSize=SHM_COMMUNICATOR_CHUNK_SIZE);
+
+  /*!
+   * Wait for all the ranks and release the segment.
+   */
+  ~ShmCommunicator();
+
+  /*!
+   * Get the rank of the calling process.
+   *
+   * \return The process rank
+   */
+  unsigned int getRank() const;
+
+  /*!
+   * Get the number of processes.
+   *
+   * \return The number of ranks
+   */
+  unsigned int getNRanks() const;
+
+  /*!
+   * Block until all the ranks reach the barrier.
+   */
+  void barrier();
+
+  /*!
+   * Sum the counters of all the ranks. On return, each rank data stores the sums.
+   *
+   * \param data The rank counters
+   * \param size Number of counters
+   */
+  void allReduceSum(unsigned int *data, size_t size);
+
+  /*!
+   * Copy a buffer of the root rank to all the other ranks.
+   *
+   * \param data The buffer: read on the root rank, written on the others
+   * \param bytes Buffer size in bytes
+   * \param root Index of the rank owning the data
+   */
+  void broadcast(void *data, size_t bytes, unsigned int root=0);
+};
+
+#include <padenti/shm_communicator_impl.hpp>
+
+#endif // __SHM_COMMUNICATOR_HPP
@@ -0,0 +1,276 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <boost/atomic.hpp>
+#include <padenti/shm_communicator.hpp>
+#include <padenti/histogram_update.hpp>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // __linux__
+
+// Staging area offset inside the segment (i.e. header size rounded to a page)
+#define SHM_COMMUNICATOR_HEADER_SIZE (4096lu)
+
+// Maximum time (in milliseconds) waited by the ranks for the segment initialization
+#define SHM_COMMUNICATOR_ATTACH_TIMEOUT (60000)
+
+// Period (in milliseconds) of the stale segment check performed by non-zero ranks while
+// waiting for rank 0
+#define SHM_COMMUNICATOR_CHECK_PERIOD (10)
+
+
+#ifdef __linux__
+// Note: a segment left by a crashed run is still linked under the communicator name (the
+// name is removed once all the ranks attached, before starting), hence other ranks may open
+// it before rank 0 replaces it. Ranks register in the attached counter and wait for the
+// started flag of rank 0, checking meanwhile that the mapped segment is not replaced
+struct ShmCommunicatorHeader
+{
+  pthread_barrier_t barrier;
+  unsigned int nRanks;
+  boost::atomic<unsigned int> ready;
+  boost::atomic<unsigned int> attached;
+  boost::atomic<unsigned int> started;
+};
+
+
+// Check whether the name refers to a segment other than the given one, i.e. whether the
+// latter has been replaced by a new run rank 0
+inline bool _isReplacedShmSegment(const std::string &name, const struct stat &segmentStat)
+{
+  struct stat nameStat;
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd<0) return false;
+  bool replaced = !fstat(fd, &nameStat) && (nameStat.st_dev!=segmentStat.st_dev ||
+					    nameStat.st_ino!=segmentStat.st_ino);
+  close(fd);
+  return replaced;
+}
+#else
+struct ShmCommunicatorHeader {};
+#endif // __linux__
+
+
+inline ShmCommunicator::ShmCommunicator(const std::string &name, unsigned int nRanks,
+					unsigned int rank, size_t chunkSize):
+  m_name((name[0]=='/') ? name : "/"+name), m_nRanks(nRanks), m_rank(rank),
+  m_chunkSize(chunkSize), m_header(NULL), m_staging(NULL)
+{
+  if (!nRanks || rank>=nRanks) throw "Rank must be lower than the number of ranks";
+  if (!chunkSize) throw "Chunk size must be greater than 0";
+
+  m_segmentSize = SHM_COMMUNICATOR_HEADER_SIZE+nRanks*chunkSize*sizeof(unsigned int);
+
+#ifdef __linux__
+  void *segment;
+  if (!rank)
+  {
+    // Remove the segment left by a crashed run, if any, and create a new one
+    shm_unlink(m_name.c_str());
+    int fd = shm_open(m_name.c_str(), O_CREAT|O_EXCL|O_RDWR, S_IRUSR|S_IWUSR);
+    if (fd<0) throw "Unable to create the shared memory segment";
+    if (ftruncate(fd, m_segmentSize))
+    {
+      close(fd);
+      shm_unlink(m_name.c_str());
+      throw "Unable to size the shared memory segment";
+    }
+    segment = mmap(NULL, m_segmentSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment==MAP_FAILED)
+    {
+      shm_unlink(m_name.c_str());
+      throw "Unable to map the shared memory segment";
+    }
+    m_header = static_cast<ShmCommunicatorHeader*>(segment);
+
+    pthread_barrierattr_t barrierAttr;
+    pthread_barrierattr_init(&barrierAttr);
+    pthread_barrierattr_setpshared(&barrierAttr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&m_header->barrier, &barrierAttr, nRanks);
+    pthread_barrierattr_destroy(&barrierAttr);
+    m_header->nRanks = nRanks;
+    new (&m_header->attached) boost::atomic<unsigned int>(0);
+    new (&m_header->started) boost::atomic<unsigned int>(0);
+    new (&m_header->ready) boost::atomic<unsigned int>(0);
+    m_header->ready.store(1, boost::memory_order_release);
+
+    // Wait for the other ranks, then remove the name (not needed anymore) and let them go
+    for (unsigned int t=0; m_header->attached.load(boost::memory_order_acquire)!=nRanks-1; t++)
+    {
+      if (t>=SHM_COMMUNICATOR_ATTACH_TIMEOUT)
+      {
+	munmap(segment, m_segmentSize);
+	shm_unlink(m_name.c_str());
+	m_header = NULL;
+	throw "Not all the ranks attached to the shared memory segment";
+      }
+      usleep(1000);
+    }
+    shm_unlink(m_name.c_str());
+    m_header->started.store(1, boost::memory_order_release);
+  }
+  else
+  {
+    // Attach to the segment created by rank 0, again if it was a stale one
+    bool started = false;
+    for (unsigned int t=0; !started; )
+    {
+      struct stat segmentStat;
+      int fd;
+      for (; ; t++)
+      {
+	fd = shm_open(m_name.c_str(), O_RDWR, S_IRUSR|S_IWUSR);
+	if (fd>=0 && !fstat(fd, &segmentStat) && (size_t)segmentStat.st_size>=m_segmentSize) break;
+	if (fd>=0) close(fd);
+	if (t>=SHM_COMMUNICATOR_ATTACH_TIMEOUT) throw "Unable to open the shared memory segment";
+	usleep(1000);
+      }
+      segment = mmap(NULL, m_segmentSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (segment==MAP_FAILED) throw "Unable to map the shared memory segment";
+      m_header = static_cast<ShmCommunicatorHeader*>(segment);
+
+      // Wait for rank 0 to initialize the segment and to start the communicator, unless
+      // the segment is replaced meanwhile
+      bool registered = false;
+      for (; ; t++)
+      {
+	if (!registered && m_header->ready.load(boost::memory_order_acquire)==1)
+	{
+	  if (m_header->nRanks!=nRanks)
+	  {
+	    munmap(segment, m_segmentSize);
+	    m_header = NULL;
+	    throw "Number of ranks does not match the shared memory segment one";
+	  }
+	  m_header->attached.fetch_add(1, boost::memory_order_acq_rel);
+	  registered = true;
+	}
+	if (registered && m_header->started.load(boost::memory_order_acquire)==1)
+	{
+	  started = true;
+	  break;
+	}
+	if (t>=SHM_COMMUNICATOR_ATTACH_TIMEOUT)
+	{
+	  munmap(segment, m_segmentSize);
+	  m_header = NULL;
+	  throw "Shared memory segment not initialized";
+	}
+	usleep(1000);
+
+	if (t%SHM_COMMUNICATOR_CHECK_PERIOD==0 && _isReplacedShmSegment(m_name, segmentStat))
+	{
+	  munmap(segment, m_segmentSize);
+	  m_header = NULL;
+	  break;
+	}
+      }
+    }
+  }
+  m_staging = reinterpret_cast<unsigned int*>(static_cast<char*>(segment)+
+					      SHM_COMMUNICATOR_HEADER_SIZE);
+#else
+  throw "Shared memory communicator not supported on this platform";
+#endif // __linux__
+}
+
+
+inline ShmCommunicator::~ShmCommunicator()
+{
+#ifdef __linux__
+  // Note: the barrier is not destroyed, other ranks may still be returning from it. The
+  // segment is released when the last rank unmaps it
+  if (m_header)
+  {
+    barrier();
+    munmap(m_header, m_segmentSize);
+  }
+#endif // __linux__
+}
+
+
+inline unsigned int ShmCommunicator::getRank() const
+{
+  return m_rank;
+}
+
+
+inline unsigned int ShmCommunicator::getNRanks() const
+{
+  return m_nRanks;
+}
+
+
+inline void ShmCommunicator::barrier()
+{
+#ifdef __linux__
+  pthread_barrier_wait(&m_header->barrier);
+#endif // __linux__
+}
+
+
+inline void ShmCommunicator::allReduceSum(unsigned int *data, size_t size)
+{
+  HistogramAccumulateFunc accumulate = getHistogramAccumulateFunc();
+
+  for (size_t offset=0; offset<size; offset+=m_chunkSize)
+  {
+    size_t n = std::min(m_chunkSize, size-offset);
+    std::copy(data+offset, data+offset+n, m_staging+m_rank*m_chunkSize);
+    barrier();
+
+    // Reduce-scatter: each rank sums its portion of the chunk into the rank 0 area
+    size_t begin = n*m_rank/m_nRanks, end = n*(m_rank+1)/m_nRanks;
+    for (unsigned int r=1; r<m_nRanks && begin<end; r++)
+    {
+      accumulate(m_staging+begin, m_staging+r*m_chunkSize+begin, end-begin);
+    }
+    barrier();
+
+    // All-gather: the staging area is overwritten only after all ranks read the sums
+    std::copy(m_staging, m_staging+n, data+offset);
+    barrier();
+  }
+}
+
+
+inline void ShmCommunicator::broadcast(void *data, size_t bytes, unsigned int root)
+{
+  size_t stagingBytes = m_nRanks*m_chunkSize*sizeof(unsigned int);
+  char *bytesData = static_cast<char*>(data);
+
+  for (size_t offset=0; offset<bytes; offset+=stagingBytes)
+  {
+    size_t n = std::min(stagingBytes, bytes-offset);
+    if (m_rank==root) std::memcpy(m_staging, bytesData+offset, n);
+    barrier();
+    if (m_rank!=root) std::memcpy(bytesData+offset, m_staging, n);
+    barrier();
+  }
+}
@@ -0,0 +1,488 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __SPLIT_SEARCH_HPP
+#define __SPLIT_SEARCH_HPP
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cmath>
+#include <utility>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif // _OPENMP
+#include <padenti/tree_trainer.hpp>
+#include <padenti/histogram_update.hpp>
+
+// Split information below which a split is considered degenerate (gain ratio criterion),
+// relative to the number of node samples
+#define SPLIT_SEARCH_EPS (1.e-6f)
+
+
+/*!
+ * Fill a table with the n*log2(n) values for n in [0, maxN], used to compute entropy based
+ * split scores without logarithms. Given a node with N samples and per-class counts c_l:
+ * N*H = N*log2(N) - sum_l c_l*log2(c_l)
+ *
+ * \param table The table to fill (resized to maxN+1 elements)
+ * \param maxN Maximum number of samples reaching a node
+ */
+inline void fillNLog2NTable(std::vector<float> &table, unsigned int maxN)
+{
+  table.resize(maxN+1);
+  table[0] = 0.0f;
+  for (unsigned int n=1; n<=maxN; n++)
+  {
+    table[n] = (float)(n*std::log((double)n)/std::log(2.0));
+  }
+}
+
+
+/*!
+ * Signature of the functions computing the split scores (see SplitCriterion) of a row of
+ * splits sharing the same parent node, e.g. the splits of all the features for a given
+ * threshold.
+ *
+ * \param leftRows Per-class rows of left child counters, i.e. leftRows[l][i] is the number
+ *        of samples of class l going left for the i-th split
+ * \param totHistogram Parent node per-class number of samples
+ * \param nClasses Number of classes
+ * \param nSamples Parent node number of samples
+ * \param nLog2n Table of n*log2(n) values, with at least nSamples+1 elements
+ * \param nLeft Output left child number of samples, n elements
+ * \param gains Output split scores, n elements
+ * \param n Number of splits in the row
+ */
+typedef void (*SplitGainRowFunc)(const unsigned int *const *leftRows,
+				 const unsigned int *totHistogram, unsigned int nClasses,
+				 unsigned int nSamples, const float *nLog2n,
+				 unsigned int *nLeft, float *gains, size_t n);
+
+
+// Parent node term, i.e. N*H(parent) for entropy based criteria and sum_l c_l^2/N for the
+// Gini one
+template <SplitCriterion criterion>
+inline float _splitParentTerm(const unsigned int *totHistogram, unsigned int nClasses,
+			      unsigned int nSamples, const float *nLog2n)
+{
+  float hN = (criterion==SPLIT_CRITERION_GINI) ? 0.0f : nLog2n[nSamples];
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    if (criterion==SPLIT_CRITERION_GINI) hN += (float)totHistogram[l]*totHistogram[l];
+    else hN -= nLog2n[totHistogram[l]];
+  }
+  return (criterion==SPLIT_CRITERION_GINI) ? ((nSamples) ? hN/nSamples : 0.0f) : hN;
+}
+
+
+// Final split score from N*(information gain) (entropy based criteria) or
+// sum_l cL_l^2/nL + sum_l cR_l^2/nR - sum_l c_l^2/N (Gini criterion)
+template <SplitCriterion criterion>
+inline float _splitScore(float gainN, unsigned int nL, unsigned int nSamples,
+			 const float *nLog2n)
+{
+  if (!nSamples) return 0.0f;
+  if (criterion==SPLIT_CRITERION_GAIN_RATIO)
+  {
+    float splitInfoN = nLog2n[nSamples] - nLog2n[nL] - nLog2n[nSamples-nL];
+    return (splitInfoN<=SPLIT_SEARCH_EPS*nSamples) ? 0.0f : gainN/splitInfoN;
+  }
+  return gainN/nSamples;
+}
+
+
+template <SplitCriterion criterion>
+inline void splitGainRowScalar(const unsigned int *const *leftRows,
+			       const unsigned int *totHistogram, unsigned int nClasses,
+			       unsigned int nSamples, const float *nLog2n,
+			       unsigned int *nLeft, float *gains, size_t n)
+{
+  float hN = _splitParentTerm<criterion>(totHistogram, nClasses, nSamples, nLog2n);
+
+  // Accumulate per-class terms of both children one class row at a time, so that each
+  // loop streams over contiguous counters
+  for (size_t i=0; i<n; i++)
+  {
+    nLeft[i] = 0;
+    gains[i] = (criterion==SPLIT_CRITERION_GINI) ? -hN : hN;
+  }
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    const unsigned int *row = leftRows[l];
+    for (size_t i=0; i<n; i++) nLeft[i] += row[i];
+  }
+  for (unsigned int l=0; l<nClasses; l++)
+  {
+    const unsigned int *row = leftRows[l];
+    unsigned int tot = totHistogram[l];
+    for (size_t i=0; i<n; i++)
+    {
+      if (criterion==SPLIT_CRITERION_GINI)
+      {
+	float cL = (float)row[i], cR = (float)(tot-row[i]);
+	unsigned int nR = nSamples-nLeft[i];
+	gains[i] += ((nLeft[i]) ? cL*cL/nLeft[i] : 0.0f) + ((nR) ? cR*cR/nR : 0.0f);
+      }
+      else gains[i] += nLog2n[row[i]] + nLog2n[tot-row[i]];
+    }
+  }
+  for (size_t i=0; i<n; i++)
+  {
+    if (criterion!=SPLIT_CRITERION_GINI)
+    {
+      gains[i] -= nLog2n[nLeft[i]] + nLog2n[nSamples-nLeft[i]];
+    }
+    gains[i] = _splitScore<criterion>(gains[i], nLeft[i], nSamples, nLog2n);
+  }
+}
+
+
+#ifdef HISTOGRAM_UPDATE_AVX2
+template <SplitCriterion criterion>
+HISTOGRAM_UPDATE_TARGET_AVX2
+inline void splitGainRowAVX2(const unsigned int *const *leftRows,
+			     const unsigned int *totHistogram, unsigned int nClasses,
+			     unsigned int nSamples, const float *nLog2n,
+			     unsigned int *nLeft, float *gains, size_t n)
+{
+  float hN = _splitParentTerm<criterion>(totHistogram, nClasses, nSamples, nLog2n);
+  size_t i=0;
+
+  // Table lookups are performed by gathers, 8 splits at a time
+  for (; i+8<=n; i+=8)
+  {
+    __m256i nL = _mm256_setzero_si256();
+    for (unsigned int l=0; l<nClasses; l++)
+    {
+      nL = _mm256_add_epi32(nL,
+			    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(leftRows[l]+i)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(nLeft+i), nL);
+    __m256i nR = _mm256_sub_epi32(_mm256_set1_epi32((int)nSamples), nL);
+
+    __m256 g;
+    if (criterion==SPLIT_CRITERION_GINI)
+    {
+      // Empty children contribute with zero counts, hence a unit divisor is safe
+      __m256 one = _mm256_set1_ps(1.0f);
+      __m256 invL = _mm256_div_ps(one, _mm256_max_ps(_mm256_cvtepi32_ps(nL), one));
+      __m256 invR = _mm256_div_ps(one, _mm256_max_ps(_mm256_cvtepi32_ps(nR), one));
+      __m256 sqL = _mm256_setzero_ps(), sqR = _mm256_setzero_ps();
+      for (unsigned int l=0; l<nClasses; l++)
+      {
+	__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(leftRows[l]+i));
+	__m256 cL = _mm256_cvtepi32_ps(c);
+	__m256 cR = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_set1_epi32((int)totHistogram[l]), c));
+	sqL = _mm256_add_ps(sqL, _mm256_mul_ps(cL, cL));
+	sqR = _mm256_add_ps(sqR, _mm256_mul_ps(cR, cR));
+      }
+      g = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(sqL, invL), _mm256_mul_ps(sqR, invR)),
+			_mm256_set1_ps(hN));
+      _mm256_storeu_ps(gains+i, _mm256_mul_ps(g, _mm256_set1_ps(nSamples ? 1.0f/nSamples : 0.0f)));
+    }
+    else
+    {
+      g = _mm256_set1_ps(hN);
+      for (unsigned int l=0; l<nClasses; l++)
+      {
+	__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(leftRows[l]+i));
+	__m256i cR = _mm256_sub_epi32(_mm256_set1_epi32((int)totHistogram[l]), c);
+	g = _mm256_add_ps(g, _mm256_i32gather_ps(nLog2n, c, 4));
+	g = _mm256_add_ps(g, _mm256_i32gather_ps(nLog2n, cR, 4));
+      }
+      __m256 nLogNL = _mm256_i32gather_ps(nLog2n, nL, 4);
+      __m256 nLogNR = _mm256_i32gather_ps(nLog2n, nR, 4);
+      g = _mm256_sub_ps(g, _mm256_add_ps(nLogNL, nLogNR));
+      if (criterion==SPLIT_CRITERION_GAIN_RATIO)
+      {
+	// Split information is (almost) zero only when a child is empty, i.e. for zero gains
+	__m256 splitInfoN = _mm256_sub_ps(_mm256_set1_ps(nLog2n[nSamples]),
+					  _mm256_add_ps(nLogNL, nLogNR));
+	__m256 valid = _mm256_cmp_ps(splitInfoN, _mm256_set1_ps(SPLIT_SEARCH_EPS*nSamples),
+				     _CMP_GT_OQ);
+	g = _mm256_and_ps(_mm256_div_ps(g, splitInfoN), valid);
+      }
+      else g = _mm256_mul_ps(g, _mm256_set1_ps(nSamples ? 1.0f/nSamples : 0.0f));
+      _mm256_storeu_ps(gains+i, g);
+    }
+  }
+
+  if (i<n)
+  {
+    // Note: labels are unsigned char, hence there are at most 256 classes
+    const unsigned int *tailRows[256];
+    for (unsigned int l=0; l<nClasses; l++) tailRows[l] = leftRows[l]+i;
+    splitGainRowScalar<criterion>(tailRows, totHistogram, nClasses, nSamples, nLog2n,
+				  nLeft+i, gains+i, n-i);
+  }
+}
+#endif // HISTOGRAM_UPDATE_AVX2
+
+
+template <SplitCriterion criterion>
+inline SplitGainRowFunc _selectSplitGainRowFunc(const char **name)
+{
+  SplitGainRowFunc selFunc = splitGainRowScalar<criterion>;
+  *name = "Scalar";
+
+#if defined(__GNUC__) && defined(HISTOGRAM_UPDATE_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    selFunc = splitGainRowAVX2<criterion>;
+    *name = "AVX2";
+  }
+#elif defined(_MSC_VER) && defined(HISTOGRAM_UPDATE_AVX2)
+  if (_msvcCPUSupports(7, 1, 5, 0x6))
+  {
+    selFunc = splitGainRowAVX2<criterion>;
+    *name = "AVX2";
+  }
+#endif
+
+  return selFunc;
+}
+
+
+/*!
+ * Select the fastest split scores function supported by the host CPU, specialized for the
+ * given criterion. The selection is performed once per criterion, on first call.
+ *
+ * \param criterion The split criterion
+ * \param name If not NULL, filled with the name of the selected implementation
+ * \return The selected split scores function
+ */
+inline SplitGainRowFunc getSplitGainRowFunc(SplitCriterion criterion,
+					    const char **name=NULL)
+{
+  static SplitGainRowFunc funcs[3] = {NULL, NULL, NULL};
+  static const char *funcNames[3] = {NULL, NULL, NULL};
+
+  if (!funcs[criterion])
+  {
+    const char *selFuncName;
+    SplitGainRowFunc selFunc;
+    switch (criterion)
+    {
+    case SPLIT_CRITERION_GINI:
+      selFunc = _selectSplitGainRowFunc<SPLIT_CRITERION_GINI>(&selFuncName);
+      break;
+    case SPLIT_CRITERION_GAIN_RATIO:
+      selFunc = _selectSplitGainRowFunc<SPLIT_CRITERION_GAIN_RATIO>(&selFuncName);
+      break;
+    default:
+      selFunc = _selectSplitGainRowFunc<SPLIT_CRITERION_ENTROPY>(&selFuncName);
+      break;
+    }
+
+    funcNames[criterion] = selFuncName;
+    funcs[criterion] = selFunc;
+  }
+
+  if (name) *name = funcNames[criterion];
+  return funcs[criterion];
+}
+
+
+/*!
+ * Compute the split score of a single split, e.g. while sweeping the sorted feature
+ * responses of a node.
+ *
+ * \tparam criterion The split criterion
+ * \param totHistogram Parent node per-class number of samples
+ * \param leftHistogram Left child per-class number of samples
+ * \param nClasses Number of classes
+ * \param nSamples Parent node number of samples
+ * \param nLog2n Table of n*log2(n) values, with at least nSamples+1 elements
+ * \return The split score
+ */
+template <SplitCriterion criterion>
+inline float splitGain(const unsigned int *totHistogram, const unsigned int *leftHistogram,
+		       unsigned int nClasses, unsigned int nSamples, const float *nLog2n)
+{
+  unsigned int nLeft;
+  float gain;
+  const unsigned int *leftRows[256];
+  for (unsigned int l=0; l<nClasses; l++) leftRows[l] = leftHistogram+l;
+  splitGainRowScalar<criterion>(leftRows, totHistogram, nClasses, nSamples, nLog2n,
+				&nLeft, &gain, 1);
+  return gain;
+}
+
+
+/*!
+ * Exclude from a split search the splits leaving less than minChildSamples samples (and at
+ * least one) to a child, by giving them the lowest possible score: a node having no valid
+ * split is then kept as a leaf by the stop criteria.
+ *
+ * \param nLeft Left child number of samples of each split
+ * \param nSamples Parent node number of samples
+ * \param minChildSamples Minimum number of samples of each child
+ * \param gains Split scores, updated
+ * \param n Number of splits
+ */
+inline void maskSmallChildSplits(const unsigned int *nLeft, unsigned int nSamples,
+				 unsigned int minChildSamples, float *gains, size_t n)
+{
+  minChildSamples = std::max(minChildSamples, 1u);
+  for (size_t i=0; i<n; i++)
+  {
+    if (nLeft[i]<minChildSamples || nSamples-nLeft[i]<minChildSamples) gains[i] = -FLT_MAX;
+  }
+}
+
+
+/*!
+ * Search the best feature/threshold pair of a set of nodes from their histograms of left
+ * child counters ([class][threshold][feature] layout). Work items are (node, threshold)
+ * pairs, i.e. a row of features sharing the same counters layout, so that small sets of
+ * nodes are parallelized as well. As in the learnBestFeature kernel, ties are broken in
+ * favour of the lowest pair index (i.e. threshold ID*number of features + feature ID).
+ * Pairs leaving less than minChildSamples samples to a child are excluded from the search
+ * (see maskSmallChildSplits()).
+ *
+ * \param splitGainRow The split scores function
+ * \param histograms Per-node histograms
+ * \param nodes Per-node ID, used to index the per-node statistics
+ * \param nNodes Number of nodes
+ * \param nFeatures Number of features
+ * \param nThresholds Number of thresholds
+ * \param nClasses Number of classes
+ * \param perNodeTotSamples Number of samples of each node, indexed by node ID
+ * \param perClassTotSamples Per-class number of samples of each node, indexed by node ID
+ * \param nLog2n Table of n*log2(n) values
+ * \param minChildSamples Minimum number of samples of each child
+ * \param nThreads Number of search threads. If 0, the OpenMP default is used
+ * \param bestFeatures Output per-node best feature index
+ * \param bestThresholds Output per-node best threshold index
+ * \param bestGains Output per-node best split score
+ */
+inline void searchHistogramSplits(SplitGainRowFunc splitGainRow,
+				  const unsigned int *const *histograms, const int *nodes,
+				  unsigned int nNodes, unsigned int nFeatures,
+				  unsigned int nThresholds, unsigned int nClasses,
+				  const unsigned int *perNodeTotSamples,
+				  const unsigned int *perClassTotSamples, const float *nLog2n,
+				  unsigned int minChildSamples, unsigned int nThreads,
+				  unsigned int *bestFeatures,
+				  unsigned int *bestThresholds, float *bestGains)
+{
+  unsigned int nRows = nNodes*nThresholds;
+  std::vector<float> rowBestGains(nRows);
+  std::vector<unsigned int> rowBestFeatures(nRows);
+#ifdef _OPENMP
+  if (!nThreads) nThreads = omp_get_max_threads();
+#endif // _OPENMP
+
+  #pragma omp parallel num_threads(nThreads)
+  {
+    std::vector<unsigned int> nLeft(nFeatures);
+    std::vector<float> gains(nFeatures);
+    // Note: labels are unsigned char, hence there are at most 256 classes
+    const unsigned int *leftRows[256];
+
+    #pragma omp for schedule(dynamic, 16)
+    for (int r=0; r<(int)nRows; r++)
+    {
+      unsigned int n = r/nThresholds, t = r%nThresholds;
+      for (unsigned int l=0; l<nClasses; l++)
+      {
+	leftRows[l] = histograms[n] + l*(nThresholds*nFeatures) + t*nFeatures;
+      }
+      splitGainRow(leftRows, &perClassTotSamples[nodes[n]*nClasses], nClasses,
+		   perNodeTotSamples[nodes[n]], nLog2n, &nLeft[0], &gains[0], nFeatures);
+      maskSmallChildSplits(&nLeft[0], perNodeTotSamples[nodes[n]], minChildSamples, &gains[0],
+			   nFeatures);
+
+      unsigned int bestF = 0;
+      for (unsigned int f=1; f<nFeatures; f++)
+      {
+	if (gains[f]>gains[bestF]) bestF = f;
+      }
+      rowBestGains[r] = gains[bestF];
+      rowBestFeatures[r] = bestF;
+    }
+  }
+
+  for (unsigned int n=0; n<nNodes; n++)
+  {
+    unsigned int bestRow = n*nThresholds;
+    for (unsigned int r=bestRow+1; r<(n+1)*nThresholds; r++)
+    {
+      if (rowBestGains[r]>rowBestGains[bestRow]) bestRow = r;
+    }
+    bestFeatures[n] = rowBestFeatures[bestRow];
+    bestThresholds[n] = bestRow-n*nThresholds;
+    bestGains[n] = rowBestGains[bestRow];
+  }
+}
+
+
+/*!
+ * Sort the responses of a node feature and update the best split of the node with the
+ * cuts between two distinct responses (i.e. threshold equal to the smaller one). Cuts
+ * leaving less than minChildSamples samples to a child are skipped, the best split is
+ * replaced only by strictly greater scores.
+ *
+ * \tparam criterion The split criterion
+ * \param responses Per-sample (response, 0-based label) pairs, sorted on return
+ * \param totHistogram Node per-class number of samples
+ * \param nClasses Number of classes
+ * \param nLog2n Table of n*log2(n) values, with at least responses.size()+1 elements
+ * \param minChildSamples Minimum number of samples of each child
+ * \param featureID Index of the feature
+ * \param bestGain Best split score so far, updated
+ * \param bestFeature Best split feature index so far, updated
+ * \param bestThreshold Best split threshold so far, updated
+ * \param bestLeftHistogram Best split left child per-class number of samples so far,
+ *        updated
+ */
+template <SplitCriterion criterion, typename FeatType>
+inline void searchExactSplit(std::vector<std::pair<FeatType, unsigned char> > &responses,
+			     const unsigned int *totHistogram, unsigned int nClasses,
+			     const float *nLog2n, unsigned int minChildSamples,
+			     unsigned int featureID, float &bestGain, unsigned int &bestFeature,
+			     FeatType &bestThreshold, unsigned int *bestLeftHistogram)
+{
+  unsigned int nSamples = responses.size();
+  unsigned int leftHistogram[256];
+
+  std::sort(responses.begin(), responses.end());
+  std::fill_n(leftHistogram, nClasses, 0);
+  for (unsigned int s=0; s+1<nSamples; s++)
+  {
+    leftHistogram[responses[s].second]++;
+    if (!(responses[s].first<responses[s+1].first)) continue;
+    if (s+1<minChildSamples || nSamples-s-1<minChildSamples) continue;
+
+    float gain = splitGain<criterion>(totHistogram, leftHistogram, nClasses, nSamples, nLog2n);
+    if (gain>bestGain)
+    {
+      bestGain = gain;
+      bestFeature = featureID;
+      bestThreshold = responses[s].first;
+      std::copy(leftHistogram, leftHistogram+nClasses, bestLeftHistogram);
+    }
+  }
+}
+
+
+#endif // __SPLIT_SEARCH_HPP
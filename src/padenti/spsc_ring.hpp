@@ -0,0 +1,96 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __SPSC_RING_HPP
+#define __SPSC_RING_HPP
+
+#include <boost/atomic.hpp>
+
+/*!
+ *  \brief Lock-free single-producer/single-consumer ring of slot indices.
+ *
+ *  The ring does not store data itself: it hands out indices in [0, size) of slots
+ *  stored elsewhere (e.g. pinned OpenCL buffers). The producer reserves a free slot,
+ *  fills it and commits it; the consumer acquires the oldest committed slot, processes
+ *  it and releases it. Slots are handed out in FIFO order. The producer may keep more
+ *  reserved slots at once (e.g. slots being asynchronously filled): they are published
+ *  by commit() in reservation order.
+ *
+ *  Waiting on a full (producer) or empty (consumer) ring is performed with a short
+ *  spin, followed by yielding and, finally, short sleeps.
+ */
+class SPSCRing
+{
+private:
+  unsigned int m_size;
+  // Note: head and tail are placed on separate cache lines to avoid false sharing
+  char m_pad0[64];
+  boost::atomic<unsigned int> m_head; // Next slot to be consumed
+  char m_pad1[64];
+  boost::atomic<unsigned int> m_tail; // Next slot to be produced
+  unsigned int m_reserved;            // Next slot to be reserved (producer only)
+  char m_pad2[64];
+
+  static void _backoff(unsigned int &iter);
+
+  SPSCRing(const SPSCRing &);
+  SPSCRing &operator=(const SPSCRing &);
+public:
+  /*!
+   * Create a new empty ring.
+   *
+   * \param size Number of slots (i.e. ring depth)
+   */
+  SPSCRing(unsigned int size);
+
+  /*!
+   * Producer side: wait for a free slot and reserve it.
+   *
+   * \return The index of the reserved slot
+   */
+  unsigned int reserve();
+
+  /*!
+   * Producer side: publish the oldest reserved, not yet committed, slot.
+   */
+  void commit();
+
+  /*!
+   * Consumer side: wait for a committed slot.
+   *
+   * \return The index of the oldest committed slot
+   */
+  unsigned int acquire();
+
+  /*!
+   * Consumer side: give back the slot returned by the last acquire() call.
+   */
+  void release();
+
+  /*!
+   * Get the ring size.
+   *
+   * \return The number of slots
+   */
+  unsigned int getSize() const;
+};
+
+#include <padenti/spsc_ring_impl.hpp>
+
+#endif // __SPSC_RING_HPP
@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <sched.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif // WIN32
+#include <emmintrin.h>
+#include <padenti/spsc_ring.hpp>
+
+// Backoff policy used while waiting on a full/empty ring
+#define SPSC_RING_SPIN_ITERS (256)
+#define SPSC_RING_YIELD_ITERS (SPSC_RING_SPIN_ITERS+64)
+#define SPSC_RING_SLEEP_US (50)
+
+
+inline SPSCRing::SPSCRing(unsigned int size):
+  m_size(size), m_head(0), m_tail(0), m_reserved(0)
+{}
+
+
+inline void SPSCRing::_backoff(unsigned int &iter)
+{
+  if (iter<SPSC_RING_SPIN_ITERS) _mm_pause();
+  else if (iter<SPSC_RING_YIELD_ITERS) sched_yield();
+  else
+  {
+#ifdef WIN32
+    Sleep(0);
+#else
+    usleep(SPSC_RING_SLEEP_US);
+#endif // WIN32
+  }
+  if (iter<SPSC_RING_YIELD_ITERS) iter++;
+}
+
+
+inline unsigned int SPSCRing::reserve()
+{
+  unsigned int iter = 0;
+  while (m_reserved-m_head.load(boost::memory_order_acquire)>=m_size) _backoff(iter);
+
+  return (m_reserved++)%m_size;
+}
+
+
+inline void SPSCRing::commit()
+{
+  m_tail.store(m_tail.load(boost::memory_order_relaxed)+1, boost::memory_order_release);
+}
+
+
+inline unsigned int SPSCRing::acquire()
+{
+  // Note: head is only modified by the consumer
+  unsigned int head = m_head.load(boost::memory_order_relaxed);
+  unsigned int iter = 0;
+  while (m_tail.load(boost::memory_order_acquire)==head) _backoff(iter);
+
+  return head%m_size;
+}
+
+
+inline void SPSCRing::release()
+{
+  m_head.store(m_head.load(boost::memory_order_relaxed)+1, boost::memory_order_release);
+}
+
+
+inline unsigned int SPSCRing::getSize() const
+{
+  return m_size;
+}
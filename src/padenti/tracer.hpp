@@ -0,0 +1,184 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __TRACER_HPP
+#define __TRACER_HPP
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <boost/chrono/chrono.hpp>
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+
+/*!
+ * \brief Timeline of host pipeline stages and OpenCL commands, exported in the Chrome
+ * trace-event JSON format (i.e. loadable by chrome://tracing or Perfetto).
+ *
+ * Host events are recorded with their thread; OpenCL commands with the index of their
+ * queue and are resolved (i.e. their profiling info is read) when the trace is saved,
+ * hence the commands must be complete and their queue created with profiling enabled.
+ * Device timestamps are mapped on the host timeline through the time the command was
+ * recorded, taken right after its enqueue.
+ *
+ * Recording is thread safe. Disabled tracers (and NULL ones, see TraceScope) only cost a
+ * branch per instrumented stage.
+ *
+ * Note: event names and categories must be string literals (they are not copied).
+ */
+class Tracer
+{
+private:
+  struct HostEvent
+  {
+    const char *name;
+    const char *category;
+    unsigned int thread;
+    double start, end;
+  };
+  struct DeviceEvent
+  {
+    const char *name;
+    unsigned int queue;
+    double recorded;
+    cl::Event event;
+  };
+
+  bool m_enabled;
+  boost::chrono::steady_clock::time_point m_origin;
+  mutable pthread_mutex_t m_mutex;
+  std::vector<pthread_t> m_threads;
+  std::vector<std::string> m_threadNames;
+  std::vector<HostEvent> m_hostEvents;
+  std::vector<DeviceEvent> m_deviceEvents;
+
+  unsigned int _threadIndex();
+
+  Tracer(const Tracer &);
+  Tracer &operator=(const Tracer &);
+public:
+  /*!
+   * Create an enabled tracer. Timestamps are relative to the creation time.
+   */
+  Tracer();
+  ~Tracer();
+
+  /*!
+   * Enable or disable the recording.
+   *
+   * \param enabled Recording flag
+   */
+  void setEnabled(bool enabled);
+
+  /*!
+   * Check if the recording is enabled.
+   *
+   * \return The recording flag
+   */
+  bool isEnabled() const { return m_enabled; }
+
+  /*!
+   * Get the current time on the trace timeline.
+   *
+   * \return Microseconds elapsed from the tracer creation
+   */
+  double now() const;
+
+  /*!
+   * Name the calling thread on the timeline.
+   *
+   * \param name Thread name
+   */
+  void setThreadName(const std::string &name);
+
+  /*!
+   * Record a host stage of the calling thread.
+   *
+   * \param name Stage name
+   * \param category Stage category
+   * \param start Stage start, see now()
+   * \param end Stage end, see now()
+   */
+  void addHostEvent(const char *name, const char *category, double start, double end);
+
+  /*!
+   * Record an OpenCL command, to be called right after its enqueue.
+   *
+   * \param name Command name
+   * \param event The command event
+   * \param queue Index of the command queue on the timeline
+   */
+  void addDeviceEvent(const char *name, const cl::Event &event, unsigned int queue);
+
+  /*!
+   * Drop all the recorded events.
+   */
+  void clear();
+
+  /*!
+   * Write the recorded events to a Chrome trace-event JSON file. Commands whose profiling
+   * info is not available are skipped.
+   *
+   * \param path Output file path
+   */
+  void save(const std::string &path) const;
+};
+
+
+/*!
+ * \brief Record a host stage spanning the lifetime of the object.
+ */
+class TraceScope
+{
+private:
+  Tracer *m_tracer;
+  const char *m_name;
+  const char *m_category;
+  double m_start;
+
+  TraceScope(const TraceScope &);
+  TraceScope &operator=(const TraceScope &);
+public:
+  /*!
+   * Start the stage.
+   *
+   * \param tracer The tracer: if NULL or disabled, nothing is recorded
+   * \param name Stage name
+   * \param category Stage category
+   */
+  TraceScope(Tracer *tracer, const char *name, const char *category):
+    m_tracer((tracer && tracer->isEnabled()) ? tracer : NULL), m_name(name),
+    m_category(category), m_start(0)
+  {
+    if (m_tracer) m_start = m_tracer->now();
+  }
+
+  /*!
+   * End the stage and record it.
+   */
+  ~TraceScope()
+  {
+    if (m_tracer) m_tracer->addHostEvent(m_name, m_category, m_start, m_tracer->now());
+  }
+};
+
+#include <padenti/tracer_impl.hpp>
+
+#endif // __TRACER_HPP
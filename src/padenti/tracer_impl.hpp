@@ -0,0 +1,175 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <fstream>
+#include <padenti/tracer.hpp>
+
+
+inline Tracer::Tracer():
+  m_enabled(true), m_origin(boost::chrono::steady_clock::now())
+{
+  pthread_mutex_init(&m_mutex, NULL);
+}
+
+
+inline Tracer::~Tracer()
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+inline void Tracer::setEnabled(bool enabled)
+{
+  m_enabled = enabled;
+}
+
+
+inline double Tracer::now() const
+{
+  return boost::chrono::duration_cast<boost::chrono::duration<double, boost::micro> >(
+    boost::chrono::steady_clock::now()-m_origin).count();
+}
+
+
+// Note: must be called with the mutex locked
+inline unsigned int Tracer::_threadIndex()
+{
+  pthread_t self = pthread_self();
+  for (unsigned int t=0; t<m_threads.size(); t++)
+  {
+    if (pthread_equal(m_threads[t], self)) return t;
+  }
+  m_threads.push_back(self);
+  m_threadNames.push_back(std::string());
+  return m_threads.size()-1;
+}
+
+
+inline void Tracer::setThreadName(const std::string &name)
+{
+  pthread_mutex_lock(&m_mutex);
+  m_threadNames[_threadIndex()] = name;
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+inline void Tracer::addHostEvent(const char *name, const char *category, double start,
+				 double end)
+{
+  if (!m_enabled) return;
+
+  HostEvent event;
+  event.name = name;
+  event.category = category;
+  event.start = start;
+  event.end = end;
+  pthread_mutex_lock(&m_mutex);
+  event.thread = _threadIndex();
+  m_hostEvents.push_back(event);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+inline void Tracer::addDeviceEvent(const char *name, const cl::Event &event,
+				   unsigned int queue)
+{
+  if (!m_enabled) return;
+
+  DeviceEvent deviceEvent;
+  deviceEvent.name = name;
+  deviceEvent.queue = queue;
+  deviceEvent.recorded = now();
+  deviceEvent.event = event;
+  pthread_mutex_lock(&m_mutex);
+  m_deviceEvents.push_back(deviceEvent);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+inline void Tracer::clear()
+{
+  pthread_mutex_lock(&m_mutex);
+  m_hostEvents.clear();
+  m_deviceEvents.clear();
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+inline void Tracer::save(const std::string &path) const
+{
+  std::ofstream traceFile(path.c_str());
+  if (!traceFile.is_open()) throw "Unable to open the trace file";
+  traceFile.setf(std::ios::fixed);
+  traceFile.precision(3);
+
+  pthread_mutex_lock(&m_mutex);
+
+  // Host threads are shown as process 0 threads, command queues as process 1 ones
+  traceFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  traceFile << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"Host\"}},\n";
+  traceFile << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"OpenCL\"}}";
+  for (unsigned int t=0; t<m_threads.size(); t++)
+  {
+    if (m_threadNames[t].empty()) continue;
+    traceFile << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t
+	      << ",\"args\":{\"name\":\"" << m_threadNames[t] << "\"}}";
+  }
+
+  for (unsigned int e=0; e<m_hostEvents.size(); e++)
+  {
+    const HostEvent &event = m_hostEvents[e];
+    traceFile << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+	      << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+	      << ",\"ts\":" << event.start << ",\"dur\":" << event.end-event.start << "}";
+  }
+
+  std::vector<bool> namedQueues;
+  for (unsigned int e=0; e<m_deviceEvents.size(); e++)
+  {
+    const DeviceEvent &event = m_deviceEvents[e];
+    cl_ulong queued, start, end;
+    try
+    {
+      queued = event.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+      start = event.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+      end = event.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    }
+    catch (cl::Error err)
+    {
+      continue;
+    }
+
+    if (event.queue>=namedQueues.size()) namedQueues.resize(event.queue+1, false);
+    if (!namedQueues[event.queue])
+    {
+      traceFile << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << event.queue
+		<< ",\"args\":{\"name\":\"Queue " << event.queue << "\"}}";
+      namedQueues[event.queue] = true;
+    }
+
+    // Device clock to host timeline: the command was queued when it was recorded
+    traceFile << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"opencl\",\"ph\":\"X\",\"pid\":1"
+	      << ",\"tid\":" << event.queue
+	      << ",\"ts\":" << event.recorded+static_cast<double>(start-queued)*1.e-3
+	      << ",\"dur\":" << static_cast<double>(end-start)*1.e-3 << "}";
+  }
+  traceFile << "\n]}\n";
+
+  pthread_mutex_unlock(&m_mutex);
+}
@@ -167,6 +167,8 @@ TrainingSet<type, nChannels>& TrainingSet<type, nChannels>::operator<<(const Tra
 				     pCImg/(m_nImages+1));
   }
   m_nImages++;
+
+  return *this;
 }
 
 
@@ -114,6 +114,14 @@ public:
    */
   unsigned int getDepth() const;
 
+  /*!
+   * Increase the tree depth, e.g. to further train an already trained tree. Current nodes
+   * are kept, new nodes are left uninitialized.
+   *
+   * \param depth the new tree depth, must not be lower than the current one
+   */
+  void setDepth(unsigned int depth);
+
   /*!
    * Get the node with index idx.
    *
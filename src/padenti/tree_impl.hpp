@@ -62,6 +62,38 @@ unsigned int Tree<FeatType, FeatDim, nClasses>::getDepth() const
   return m_depth;
 }
 
+template <typename FeatType, unsigned int FeatDim,
+	  unsigned int nClasses>
+void Tree<FeatType, FeatDim, nClasses>::setDepth(unsigned int depth)
+{
+  if (depth<m_depth) throw "Tree depth can not be decreased";
+  if (depth==m_depth) return;
+
+  unsigned int nNodes = m_depth ? (2<<(m_depth-1))-1 : 0;
+  TreeNode<FeatType, FeatDim> *nodes = m_nodes;
+  int *leftChildren = m_leftChildren;
+  FeatType *features = m_features;
+  FeatType *thresholds = m_thresholds;
+  float *posteriors = m_posteriors;
+
+  // Note: nodes are stored breadth-first, hence the current ones keep their index
+  m_depth = depth;
+  _init();
+  if (nNodes)
+  {
+    std::copy(leftChildren, leftChildren+nNodes, m_leftChildren);
+    std::copy(features, features+nNodes*FeatDim, m_features);
+    std::copy(thresholds, thresholds+nNodes, m_thresholds);
+    std::copy(posteriors, posteriors+nNodes*nClasses, m_posteriors);
+  }
+
+  delete []nodes;
+  delete []posteriors;
+  delete []thresholds;
+  delete []features;
+  delete []leftChildren;
+}
+
 template <typename FeatType, unsigned int FeatDim,
 	  unsigned int nClasses>
 const TreeNode<FeatType, FeatDim>& Tree<FeatType, FeatDim, nClasses>::getNode(unsigned int idx) const
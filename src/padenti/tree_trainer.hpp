@@ -26,6 +26,17 @@
 #include <padenti/training_set.hpp>
 
 
+/*!
+ * \brief Score used to rank candidate feature/threshold pairs
+ */
+enum SplitCriterion
+{
+  SPLIT_CRITERION_ENTROPY,   /*!< Information gain (Shannon entropy) */
+  SPLIT_CRITERION_GINI,      /*!< Gini impurity decrease */
+  SPLIT_CRITERION_GAIN_RATIO /*!< Information gain normalized by the split information */
+};
+
+
 /*!
  * \brief Class representing training parameters
  *
@@ -45,9 +56,38 @@ public:
 				     for each feature entry */
   FeatType thrLowBound;            /*!< Minimum valid threshold value */
   FeatType thrUpBound;             /*!< Maximum valid threshold value */
-  bool randomThrSampling;          /*!< Number of pixels sampled from each image */
+  bool randomThrSampling;          /*!< If true, nThresholds random thresholds are sampled for
+				     each feature. Otherwise, the optimal threshold is
+				     searched among all the distinct feature responses
+				     (true by default) */
   unsigned int perLeafSamplesThr;  /*!< Mininum number of pixels at each leaf node
 				     to allow further splitting */
+  SplitCriterion splitCriterion;   /*!< Score used to select the best feature/threshold pair
+				     (SPLIT_CRITERION_ENTROPY by default) */
+  float minGain;                   /*!< Minimum score (in the splitCriterion units) of the
+				     best feature/threshold pair to split a node
+				     (0 by default, i.e. disabled) */
+  unsigned int minChildSamples;    /*!< Minimum number of pixels reaching each child to split
+				     a node (1 by default) */
+  unsigned int maxFrontierNodes;   /*!< Maximum number of nodes trained at each depth: the
+				     ones reached by more pixels are selected
+				     (0 by default, i.e. unlimited) */
+  float purityThr;                 /*!< Nodes whose most frequent class accounts for at least
+				     this fraction of the pixels are not split
+				     (0 by default, i.e. disabled) */
+
+  /*!
+   * Set parameters with a sensible default value, i.e. the thresholds sampling mode, the
+   * split criterion and the stop criteria. The remaining ones must be set by the caller.
+   */
+  TreeTrainerParameters():
+    randomThrSampling(true),
+    splitCriterion(SPLIT_CRITERION_ENTROPY),
+    minGain(0.0f),
+    minChildSamples(1),
+    maxFrontierNodes(0),
+    purityThr(0.0f)
+  {}
 };
 
 
@@ -69,6 +109,8 @@ template <typename ImgType, unsigned int nChannels, typename FeatType, unsigned
 class TreeTrainer
 {
 public:
+  virtual ~TreeTrainer() {}
+
   /*!
    * Train a single tree of the Random Forests ensemble up to depth endDepth on the trainintSet
    * training set
@@ -76,7 +118,8 @@ public:
    * \param tree the tree to be trained
    * \param trainingSet the input training set
    * \param params the training parameters
-   * \param startDepth must be 1
+   * \param startDepth the depth at which training starts: if greater than 1, the tree
+   * must be already trained up to depth startDepth-1
    * \param endDepth the maximum depth at which training stops
    */
   virtual void train(Tree<FeatType, FeatDim, nClasses> &tree,
@@ -0,0 +1,132 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#ifndef __WORK_STEALING_POOL_HPP
+#define __WORK_STEALING_POOL_HPP
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <boost/atomic.hpp>
+
+class WorkStealingPool;
+
+
+/*!
+ * \brief Interface of the tasks executed by a WorkStealingPool
+ */
+class WorkStealingTask
+{
+public:
+  virtual ~WorkStealingTask() {}
+
+  /*!
+   * Execute the task. New tasks may be submitted to the pool from here.
+   *
+   * \param pool The pool executing the task
+   * \param workerID Index of the worker executing the task
+   */
+  virtual void run(WorkStealingPool &pool, unsigned int workerID)=0;
+};
+
+
+/*!
+ * \brief Fixed-size pool of pthread workers with per-worker task deques.
+ *
+ * Each worker pops its own tasks in LIFO order (i.e. depth-first for recursively
+ * submitted tasks, keeping the working set small) and, when its deque is empty, steals
+ * the oldest task of another worker (i.e. the largest one for recursive workloads).
+ * Idle workers sleep until new tasks are submitted.
+ */
+class WorkStealingPool
+{
+private:
+  struct Worker
+  {
+    WorkStealingPool *pool;
+    unsigned int id;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    std::deque<WorkStealingTask*> tasks;
+  };
+
+  std::vector<Worker*> m_workers;
+  // Note: a task may be stolen before being counted, hence the counter may be transiently
+  // negative
+  boost::atomic<int> m_queuedTasks;
+  boost::atomic<unsigned int> m_pendingTasks;
+  boost::atomic<unsigned int> m_nextWorker;
+  bool m_stop;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_taskCond;
+  pthread_cond_t m_doneCond;
+
+  WorkStealingPool(const WorkStealingPool &);
+  WorkStealingPool &operator=(const WorkStealingPool &);
+
+  static void *_workerThread(void *arg);
+  WorkStealingTask *_popTask(unsigned int workerID);
+  void _pushTask(WorkStealingTask *task, unsigned int workerID);
+public:
+  /*!
+   * Start the pool workers.
+   *
+   * \param nWorkers Number of worker threads. If 0, one worker per online CPU is started
+   */
+  WorkStealingPool(unsigned int nWorkers=0);
+
+  /*!
+   * Wait for all the submitted tasks and stop the workers.
+   */
+  ~WorkStealingPool();
+
+  /*!
+   * Submit a task from outside the pool. Tasks are distributed round-robin among workers.
+   * The pool takes the ownership of the task, which is deleted once executed.
+   *
+   * \param task The task to execute
+   */
+  void submit(WorkStealingTask *task);
+
+  /*!
+   * Submit a task from a running task, i.e. to the deque of the calling worker.
+   * The pool takes the ownership of the task, which is deleted once executed.
+   *
+   * \param task The task to execute
+   * \param workerID Index of the calling worker
+   */
+  void submit(WorkStealingTask *task, unsigned int workerID);
+
+  /*!
+   * Block until all the submitted tasks, including the ones submitted by running tasks,
+   * have been executed.
+   */
+  void wait();
+
+  /*!
+   * Get the number of workers.
+   *
+   * \return The number of pool workers
+   */
+  unsigned int getNWorkers() const;
+};
+
+#include <padenti/work_stealing_pool_impl.hpp>
+
+#endif // __WORK_STEALING_POOL_HPP
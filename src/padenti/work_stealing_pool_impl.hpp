@@ -0,0 +1,195 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+#include <padenti/work_stealing_pool.hpp>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif // _WIN32
+
+
+inline WorkStealingPool::WorkStealingPool(unsigned int nWorkers):
+  m_queuedTasks(0), m_pendingTasks(0), m_nextWorker(0), m_stop(false)
+{
+  if (!nWorkers)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    nWorkers = sysInfo.dwNumberOfProcessors;
+#else
+    long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    nWorkers = (nCPUs>0) ? nCPUs : 1;
+#endif // _WIN32
+  }
+
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_taskCond, NULL);
+  pthread_cond_init(&m_doneCond, NULL);
+
+  // Deques must exist before any worker starts stealing
+  for (unsigned int w=0; w<nWorkers; w++)
+  {
+    Worker *worker = new Worker;
+    worker->pool = this;
+    worker->id = w;
+    pthread_mutex_init(&worker->mutex, NULL);
+    m_workers.push_back(worker);
+  }
+  for (unsigned int w=0; w<nWorkers; w++)
+  {
+    pthread_create(&m_workers[w]->thread, NULL, _workerThread, m_workers[w]);
+  }
+}
+
+
+inline WorkStealingPool::~WorkStealingPool()
+{
+  wait();
+
+  pthread_mutex_lock(&m_mutex);
+  m_stop = true;
+  pthread_cond_broadcast(&m_taskCond);
+  pthread_mutex_unlock(&m_mutex);
+
+  for (unsigned int w=0; w<m_workers.size(); w++)
+  {
+    pthread_join(m_workers[w]->thread, NULL);
+    pthread_mutex_destroy(&m_workers[w]->mutex);
+    delete m_workers[w];
+  }
+
+  pthread_cond_destroy(&m_doneCond);
+  pthread_cond_destroy(&m_taskCond);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+
+inline void WorkStealingPool::_pushTask(WorkStealingTask *task, unsigned int workerID)
+{
+  Worker *worker = m_workers[workerID];
+
+  m_pendingTasks++;
+  pthread_mutex_lock(&worker->mutex);
+  worker->tasks.push_back(task);
+  pthread_mutex_unlock(&worker->mutex);
+
+  // Note: the queued tasks counter is updated under the pool mutex, so that a worker
+  // about to sleep cannot miss the wake-up
+  pthread_mutex_lock(&m_mutex);
+  m_queuedTasks++;
+  pthread_cond_signal(&m_taskCond);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+inline WorkStealingTask *WorkStealingPool::_popTask(unsigned int workerID)
+{
+  WorkStealingTask *task = NULL;
+
+  // First, pop the most recent task of the worker own deque
+  Worker *worker = m_workers[workerID];
+  pthread_mutex_lock(&worker->mutex);
+  if (!worker->tasks.empty())
+  {
+    task = worker->tasks.back();
+    worker->tasks.pop_back();
+  }
+  pthread_mutex_unlock(&worker->mutex);
+
+  // Otherwise, steal the oldest task of the other workers
+  for (unsigned int i=1; !task && i<m_workers.size(); i++)
+  {
+    Worker *victim = m_workers[(workerID+i)%m_workers.size()];
+    pthread_mutex_lock(&victim->mutex);
+    if (!victim->tasks.empty())
+    {
+      task = victim->tasks.front();
+      victim->tasks.pop_front();
+    }
+    pthread_mutex_unlock(&victim->mutex);
+  }
+
+  if (task) m_queuedTasks--;
+  return task;
+}
+
+
+inline void *WorkStealingPool::_workerThread(void *arg)
+{
+  Worker *worker = static_cast<Worker*>(arg);
+  WorkStealingPool *pool = worker->pool;
+
+  while (true)
+  {
+    WorkStealingTask *task = pool->_popTask(worker->id);
+    if (task)
+    {
+      task->run(*pool, worker->id);
+      delete task;
+
+      if (!(--pool->m_pendingTasks))
+      {
+	pthread_mutex_lock(&pool->m_mutex);
+	pthread_cond_broadcast(&pool->m_doneCond);
+	pthread_mutex_unlock(&pool->m_mutex);
+      }
+      continue;
+    }
+
+    // No task available: sleep until a new one is queued or the pool is stopped
+    pthread_mutex_lock(&pool->m_mutex);
+    while (!pool->m_stop && pool->m_queuedTasks<=0)
+    {
+      pthread_cond_wait(&pool->m_taskCond, &pool->m_mutex);
+    }
+    bool stop = pool->m_stop && pool->m_queuedTasks<=0;
+    pthread_mutex_unlock(&pool->m_mutex);
+    if (stop) break;
+  }
+
+  return NULL;
+}
+
+
+inline void WorkStealingPool::submit(WorkStealingTask *task)
+{
+  _pushTask(task, (m_nextWorker++)%m_workers.size());
+}
+
+
+inline void WorkStealingPool::submit(WorkStealingTask *task, unsigned int workerID)
+{
+  _pushTask(task, workerID);
+}
+
+
+inline void WorkStealingPool::wait()
+{
+  pthread_mutex_lock(&m_mutex);
+  while (m_pendingTasks) pthread_cond_wait(&m_doneCond, &m_mutex);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+inline unsigned int WorkStealingPool::getNWorkers() const
+{
+  return m_workers.size();
+}
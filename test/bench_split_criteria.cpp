@@ -0,0 +1,256 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+// Learning phase benchmark: time spent searching the best feature/threshold pairs of a
+// batch of nodes for each split criterion, both on the OpenCL device (learnBestFeature and
+// reduceBestFeature kernels) and on the host (split_search.hpp), on synthetic histograms.
+// Without an OpenCL device of the requested type, host times only are reported.
+//
+// Usage: bench_split_criteria [device=cpu|gpu]
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/chrono/chrono.hpp>
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+#include <padenti/split_search.hpp>
+
+#include <padenti/learn_best_feature.cl.inc>
+
+#define N_NODES (8)
+#define N_FEATURES (2048)
+#define N_THRESHOLDS (20)
+#define N_CLASSES (5)
+#define N_NODE_SAMPLES (100000)
+#define N_REPETITIONS (10)
+
+#define PER_THREAD_FEAT_THR_PAIRS (64)
+#define WG_LEARN_BEST_FEAT (32)
+
+static const char *CRITERIA_NAMES[] = {"entropy", "gini", "gain ratio"};
+
+
+// Build synthetic node histograms ([node][class][threshold][feature], cumulative over
+// thresholds) and per-node per-class total number of samples
+static void buildHistograms(std::vector<unsigned int> &histogram,
+			    std::vector<unsigned int> &perClassTotSamples)
+{
+  histogram.resize(N_NODES*N_CLASSES*N_THRESHOLDS*N_FEATURES);
+  perClassTotSamples.resize(N_NODES*N_CLASSES);
+
+  for (unsigned int n=0; n<N_NODES; n++)
+  {
+    for (unsigned int l=0; l<N_CLASSES; l++)
+    {
+      unsigned int tot = N_NODE_SAMPLES/N_CLASSES;
+      unsigned int *classHistogram =
+	&histogram[(n*N_CLASSES+l)*N_THRESHOLDS*N_FEATURES];
+      perClassTotSamples[n*N_CLASSES+l] = tot;
+
+      for (unsigned int f=0; f<N_FEATURES; f++)
+      {
+	unsigned int count = 0;
+	for (unsigned int t=0; t<N_THRESHOLDS; t++)
+	{
+	  count += rand()%(tot/N_THRESHOLDS+1);
+	  classHistogram[t*N_FEATURES+f] = count;
+	}
+      }
+    }
+  }
+}
+
+
+static double benchHost(SplitCriterion criterion, const std::vector<unsigned int> &histogram,
+			const std::vector<unsigned int> &perClassTotSamples,
+			const std::vector<float> &nLog2n)
+{
+  SplitGainRowFunc splitGainRow = getSplitGainRowFunc(criterion);
+  boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+
+  for (unsigned int r=0; r<N_REPETITIONS; r++)
+  {
+    #pragma omp parallel
+    {
+      std::vector<unsigned int> nLeft(N_FEATURES);
+      std::vector<float> gains(N_FEATURES);
+      const unsigned int *leftRows[N_CLASSES];
+
+      #pragma omp for
+      for (int row=0; row<N_NODES*N_THRESHOLDS; row++)
+      {
+	unsigned int n = row/N_THRESHOLDS, t = row%N_THRESHOLDS;
+	for (unsigned int l=0; l<N_CLASSES; l++)
+	{
+	  leftRows[l] = &histogram[((n*N_CLASSES+l)*N_THRESHOLDS+t)*N_FEATURES];
+	}
+	splitGainRow(leftRows, &perClassTotSamples[n*N_CLASSES], N_CLASSES, N_NODE_SAMPLES,
+		     &nLog2n[0], &nLeft[0], &gains[0], N_FEATURES);
+      }
+    }
+  }
+
+  return boost::chrono::duration_cast<boost::chrono::duration<double> >(
+    boost::chrono::steady_clock::now()-start).count()/N_REPETITIONS;
+}
+
+
+static double benchDevice(SplitCriterion criterion, cl::Context &context, cl::Device &device,
+			  const std::vector<unsigned int> &histogram,
+			  const std::vector<unsigned int> &perClassTotSamples)
+{
+  std::string src(reinterpret_cast<const char*>(learn_best_feature_cl), learn_best_feature_cl_len);
+  cl::Program::Sources sources(1, std::make_pair(src.c_str(), src.length()+1));
+  cl::Program program(context, sources);
+
+  std::stringstream opts;
+  if (criterion==SPLIT_CRITERION_GINI) opts << "-DSPLIT_CRITERION_GINI";
+  else if (criterion==SPLIT_CRITERION_GAIN_RATIO) opts << "-DSPLIT_CRITERION_GAIN_RATIO";
+  program.build(opts.str().c_str());
+
+  cl::Kernel learnKern(program, "learnBestFeature");
+  cl::Kernel reduceKern(program, "reduceBestFeature");
+  cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+  unsigned int perNodeThreads =
+    (N_FEATURES*N_THRESHOLDS+PER_THREAD_FEAT_THR_PAIRS-1)/PER_THREAD_FEAT_THR_PAIRS;
+  unsigned int nGroups = (perNodeThreads+WG_LEARN_BEST_FEAT-1)/WG_LEARN_BEST_FEAT;
+
+  cl::Buffer histogramBuff(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			   histogram.size()*sizeof(cl_uint), (void*)&histogram[0]);
+  cl::Buffer perClassTotBuff(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			     perClassTotSamples.size()*sizeof(cl_uint),
+			     (void*)&perClassTotSamples[0]);
+  cl::Buffer groupPairsBuff(context, CL_MEM_READ_WRITE, N_NODES*nGroups*sizeof(cl_uint));
+  cl::Buffer groupEntropiesBuff(context, CL_MEM_READ_WRITE, N_NODES*nGroups*sizeof(cl_float));
+  cl::Buffer bestFeaturesBuff(context, CL_MEM_WRITE_ONLY, N_NODES*sizeof(cl_uint));
+  cl::Buffer bestThresholdsBuff(context, CL_MEM_WRITE_ONLY, N_NODES*sizeof(cl_uint));
+  cl::Buffer bestEntropiesBuff(context, CL_MEM_WRITE_ONLY, N_NODES*sizeof(cl_float));
+
+  learnKern.setArg(0, histogramBuff);
+  learnKern.setArg(1, perClassTotBuff);
+  learnKern.setArg(2, N_FEATURES);
+  learnKern.setArg(3, N_THRESHOLDS);
+  learnKern.setArg(4, N_CLASSES);
+  learnKern.setArg(5, PER_THREAD_FEAT_THR_PAIRS);
+  learnKern.setArg(6, groupPairsBuff);
+  learnKern.setArg(7, groupEntropiesBuff);
+  learnKern.setArg(8, cl::Local(sizeof(cl_uint)*WG_LEARN_BEST_FEAT));
+  learnKern.setArg(9, cl::Local(sizeof(cl_float)*WG_LEARN_BEST_FEAT));
+  learnKern.setArg(10, 1u);
+
+  reduceKern.setArg(0, groupPairsBuff);
+  reduceKern.setArg(1, groupEntropiesBuff);
+  reduceKern.setArg(2, nGroups);
+  reduceKern.setArg(3, N_FEATURES);
+  reduceKern.setArg(4, bestFeaturesBuff);
+  reduceKern.setArg(5, bestThresholdsBuff);
+  reduceKern.setArg(6, bestEntropiesBuff);
+  reduceKern.setArg(7, cl::Local(sizeof(cl_uint)*WG_LEARN_BEST_FEAT));
+  reduceKern.setArg(8, cl::Local(sizeof(cl_float)*WG_LEARN_BEST_FEAT));
+
+  double elapsed = 0.0;
+  for (unsigned int r=0; r<N_REPETITIONS; r++)
+  {
+    cl::Event learnEvent, reduceEvent;
+    queue.enqueueNDRangeKernel(learnKern, cl::NullRange,
+			       cl::NDRange(nGroups*WG_LEARN_BEST_FEAT, N_NODES),
+			       cl::NDRange(WG_LEARN_BEST_FEAT, 1), NULL, &learnEvent);
+    queue.enqueueNDRangeKernel(reduceKern, cl::NullRange,
+			       cl::NDRange(N_NODES*WG_LEARN_BEST_FEAT),
+			       cl::NDRange(WG_LEARN_BEST_FEAT), NULL, &reduceEvent);
+    queue.finish();
+
+    elapsed += (reduceEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>()-
+		learnEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>())*1.e-9;
+  }
+
+  return elapsed/N_REPETITIONS;
+}
+
+
+int main(int argc, const char *argv[])
+{
+  bool useCPU = true;
+  for (int i=1; i<argc; i++)
+  {
+    std::string arg(argv[i]);
+    if (arg=="device=gpu") useCPU = false;
+    else if (arg!="device=cpu")
+    {
+      std::cerr << "Usage: " << argv[0] << " [device=cpu|gpu]" << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<unsigned int> histogram, perClassTotSamples;
+  std::vector<float> nLog2n;
+  buildHistograms(histogram, perClassTotSamples);
+  fillNLog2NTable(nLog2n, N_NODE_SAMPLES);
+
+  // Host times are reported even without an OpenCL device
+  cl::Context context;
+  cl::Device device;
+  bool deviceAvailable = false;
+  try
+  {
+    context = cl::Context(useCPU ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU);
+    device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+    deviceAvailable = true;
+  }
+  catch (cl::Error err)
+  {
+    std::cerr << "No OpenCL device: " << err.what() << ": " << err.err() << std::endl;
+  }
+
+  const char *hostImpl;
+  getSplitGainRowFunc(SPLIT_CRITERION_ENTROPY, &hostImpl);
+  std::cout << "Nodes: " << N_NODES << ", features: " << N_FEATURES
+	    << ", thresholds: " << N_THRESHOLDS << ", classes: " << N_CLASSES << std::endl;
+  std::cout << "Device: " << ((deviceAvailable) ? device.getInfo<CL_DEVICE_NAME>() : "none")
+	    << ", host implementation: " << hostImpl << std::endl;
+
+  for (unsigned int c=SPLIT_CRITERION_ENTROPY; c<=SPLIT_CRITERION_GAIN_RATIO; c++)
+  {
+    SplitCriterion criterion = static_cast<SplitCriterion>(c);
+    std::stringstream deviceTime;
+    if (!deviceAvailable) deviceTime << "no device";
+    else
+    {
+      try
+      {
+	deviceTime << benchDevice(criterion, context, device, histogram,
+				  perClassTotSamples)*1000.0 << " ms";
+      }
+      catch (cl::Error err)
+      {
+	deviceTime << "error (" << err.what() << ": " << err.err() << ")";
+      }
+    }
+    double hostTime = benchHost(criterion, histogram, perClassTotSamples, nLog2n);
+
+    std::cout << CRITERIA_NAMES[c] << ": device " << deviceTime.str() << ", host "
+	      << hostTime*1000.0 << " ms" << std::endl;
+  }
+
+  return 0;
+}
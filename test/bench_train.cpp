@@ -0,0 +1,279 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+// End-to-end training benchmark on a synthetic dataset (see synthetic_dataset.hpp). Each
+// trainer is run on the whole depth/features/thresholds/samples grid and per-stage times
+// are printed as CSV lines on the standard output:
+//
+//   trainer,images,width,height,classes,depth,features,thresholds,samples,stage,seconds,msamples_per_second
+//
+// where the throughput is the number of training set samples times the number of trained
+// levels (depth-1), per stage second. The same work is accounted for both trainers, i.e.
+// samples of images skipped by the OpenCL trainer (all their samples reached a leaf) are
+// counted as well. The OpenCL trainer reports its per-stage statistics (see
+// TrainingStats), the native one its total time only.
+//
+// Usage: bench_train [key=value ...], e.g.
+//   bench_train images=100 width=320 height=240 classes=3 depths=8,12 features=256,1024
+//               thresholds=10,20 samples=1024 trainers=cl,cpu device=cpu kernels=.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/chrono/chrono.hpp>
+#include <padenti/training_set.hpp>
+#include <padenti/tree.hpp>
+#include <padenti/cl_tree_trainer.hpp>
+#include <padenti/cpu_tree_trainer.hpp>
+#include "synthetic_dataset.hpp"
+
+
+struct BenchConfig
+{
+  unsigned int nImages;
+  unsigned int width;
+  unsigned int height;
+  unsigned int nClasses;
+  std::vector<unsigned int> depths;
+  std::vector<unsigned int> nFeatures;
+  std::vector<unsigned int> nThresholds;
+  std::vector<unsigned int> nSamples;
+  std::vector<std::string> trainers;
+  bool useCPU;
+  std::string kernelsPath;
+};
+
+
+static std::vector<unsigned int> parseList(const std::string &value)
+{
+  std::vector<unsigned int> list;
+  std::stringstream valueSS(value);
+  std::string item;
+  while (std::getline(valueSS, item, ',')) list.push_back(atoi(item.c_str()));
+  return list;
+}
+
+
+static bool parseArgs(int argc, const char *argv[], BenchConfig &config)
+{
+  config.nImages = 50;
+  config.width = 320;
+  config.height = 240;
+  config.nClasses = 3;
+  config.depths = parseList("8,12");
+  config.nFeatures = parseList("256,1024");
+  config.nThresholds = parseList("10,20");
+  config.nSamples = parseList("1024");
+  config.trainers.push_back("cl");
+  config.trainers.push_back("cpu");
+  config.useCPU = true;
+  config.kernelsPath = ".";
+
+  for (int a=1; a<argc; a++)
+  {
+    std::string arg(argv[a]);
+    size_t eq = arg.find('=');
+    if (eq==std::string::npos) return false;
+    std::string key = arg.substr(0, eq), value = arg.substr(eq+1);
+
+    if (key=="images") config.nImages = atoi(value.c_str());
+    else if (key=="width") config.width = atoi(value.c_str());
+    else if (key=="height") config.height = atoi(value.c_str());
+    else if (key=="classes") config.nClasses = atoi(value.c_str());
+    else if (key=="depths") config.depths = parseList(value);
+    else if (key=="features") config.nFeatures = parseList(value);
+    else if (key=="thresholds") config.nThresholds = parseList(value);
+    else if (key=="samples") config.nSamples = parseList(value);
+    else if (key=="device") config.useCPU = (value!="gpu");
+    else if (key=="kernels") config.kernelsPath = value;
+    else if (key=="trainers")
+    {
+      config.trainers.clear();
+      std::stringstream valueSS(value);
+      std::string item;
+      while (std::getline(valueSS, item, ',')) config.trainers.push_back(item);
+    }
+    else return false;
+  }
+
+  return config.nImages && config.width && config.height;
+}
+
+
+static void printLine(const std::string &prefix, const char *stage, double seconds,
+		      double nSamples)
+{
+  std::cout << prefix << stage << "," << seconds << ","
+	    << ((seconds>0) ? nSamples/seconds*1.e-6 : 0) << std::endl;
+}
+
+
+template <unsigned int nClasses>
+static void runBench(const BenchConfig &config)
+{
+  typedef Tree<short int, 2, nClasses> TreeT;
+  DepthFeature hostFeature;
+
+  for (unsigned int s=0; s<config.nSamples.size(); s++)
+  {
+    TrainingSet<unsigned short, 1> trainingSet(nClasses);
+    buildSyntheticTrainingSet<nClasses>(config.nImages, config.width, config.height,
+					config.nSamples[s], trainingSet);
+    unsigned int imgSamples = trainingSet.getImages()[0].getNSamples();
+
+    for (unsigned int t=0; t<config.trainers.size(); t++)
+    {
+      const std::string &trainerName = config.trainers[t];
+      TreeTrainer<unsigned short, 1, short int, 2, nClasses> *trainer;
+      try
+      {
+	if (trainerName=="cl")
+	{
+	  trainer = new CLTreeTrainer<unsigned short, 1, short int, 2, nClasses>(
+	    config.kernelsPath, CLDeviceSelector(config.useCPU ? CL_DEVICE_TYPE_CPU :
+						 CL_DEVICE_TYPE_GPU));
+	}
+	else if (trainerName=="cpu")
+	{
+	  trainer = new CPUTreeTrainer<unsigned short, 1, short int, 2, nClasses>(&hostFeature);
+	}
+	else
+	{
+	  std::cerr << "Unknown trainer " << trainerName << std::endl;
+	  continue;
+	}
+      }
+      catch (cl::Error err)
+      {
+	std::cerr << "Trainer " << trainerName << " not available: " << err.what() << ": "
+		  << err.err() << std::endl;
+	continue;
+      }
+      catch (const char *err)
+      {
+	std::cerr << "Trainer " << trainerName << " not available: " << err << std::endl;
+	continue;
+      }
+
+      for (unsigned int d=0; d<config.depths.size(); d++)
+      for (unsigned int f=0; f<config.nFeatures.size(); f++)
+      for (unsigned int h=0; h<config.nThresholds.size(); h++)
+      {
+	TreeTrainerParameters<short int, 2> params;
+	initSyntheticParameters(params, config.nFeatures[f], config.nThresholds[h]);
+	params.perLeafSamplesThr = static_cast<float>(imgSamples)/nClasses;
+
+	std::stringstream prefix;
+	prefix << trainerName << "," << config.nImages << "," << config.width << ","
+	       << config.height << "," << nClasses << "," << config.depths[d] << ","
+	       << params.nFeatures << "," << params.nThresholds << "," << imgSamples << ",";
+
+	// A failing grid point (e.g. out of device memory) is skipped, the others still run
+	TreeT tree(0, config.depths[d]);
+	boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+	try
+	{
+	  trainer->train(tree, trainingSet, params, 1, config.depths[d]);
+	}
+	catch (cl::Error err)
+	{
+	  std::cerr << "Trainer " << trainerName << " failed on " << prefix.str() << " "
+		    << err.what() << ": " << err.err() << std::endl;
+	  continue;
+	}
+	catch (const char *err)
+	{
+	  std::cerr << "Trainer " << trainerName << " failed on " << prefix.str() << " "
+		    << err << std::endl;
+	  continue;
+	}
+	double seconds = boost::chrono::duration_cast<boost::chrono::duration<double> >(
+	  boost::chrono::steady_clock::now()-start).count();
+	double nRouted = (double)config.nImages*imgSamples*(config.depths[d]-1);
+
+	CLTreeTrainer<unsigned short, 1, short int, 2, nClasses> *clTrainer =
+	  dynamic_cast<CLTreeTrainer<unsigned short, 1, short int, 2, nClasses>*>(trainer);
+	if (!clTrainer)
+	{
+	  printLine(prefix.str(), "total", seconds, nRouted);
+	  continue;
+	}
+
+	// Sum the per-depth statistics
+	const TrainingStats &stats = clTrainer->getStats();
+	TrainingDepthStats tot;
+	for (unsigned int l=0; l<stats.depths.size(); l++)
+	{
+	  const TrainingDepthStats &depthStats = stats.depths[l];
+	  tot.writeTime += depthStats.writeTime;
+	  tot.computeTime += depthStats.computeTime;
+	  tot.readTime += depthStats.readTime;
+	  tot.histogramUpdateTime += depthStats.histogramUpdateTime;
+	  tot.reduceTime += depthStats.reduceTime;
+	  tot.learnTime += depthStats.learnTime;
+	}
+	printLine(prefix.str(), "init", stats.initTime, nRouted);
+	printLine(prefix.str(), "write", tot.writeTime, nRouted);
+	printLine(prefix.str(), "compute", tot.computeTime, nRouted);
+	printLine(prefix.str(), "read", tot.readTime, nRouted);
+	printLine(prefix.str(), "histogram_update", tot.histogramUpdateTime, nRouted);
+	printLine(prefix.str(), "reduce", tot.reduceTime, nRouted);
+	printLine(prefix.str(), "learn", tot.learnTime, nRouted);
+	printLine(prefix.str(), "total", stats.time, nRouted);
+      }
+
+      delete trainer;
+    }
+  }
+}
+
+
+int main(int argc, const char *argv[])
+{
+  BenchConfig config;
+  if (!parseArgs(argc, argv, config))
+  {
+    std::cerr << "Usage: " << argv[0] << " [images=N] [width=N] [height=N] [classes=N]"
+	      << " [depths=N,..] [features=N,..] [thresholds=N,..] [samples=N,..]"
+	      << " [trainers=cl,cpu] [device=cpu|gpu] [kernels=PATH]" << std::endl;
+    return 1;
+  }
+
+  std::cout << "trainer,images,width,height,classes,depth,features,thresholds,samples,"
+	    << "stage,seconds,msamples_per_second" << std::endl;
+
+  // The number of classes is a template parameter: dispatch on the supported ones
+  switch (config.nClasses)
+  {
+  case 2: runBench<2>(config); break;
+  case 3: runBench<3>(config); break;
+  case 4: runBench<4>(config); break;
+  case 5: runBench<5>(config); break;
+  case 8: runBench<8>(config); break;
+  default:
+    std::cerr << "Unsupported number of classes (2, 3, 4, 5 or 8)" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,184 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+// Synthetic dataset shared by the benchmarks and the tests: depth maps (a background plane
+// and one ellipsoidal blob per foreground class) and their labels are generated in memory
+// from a fixed seed, hence runs are reproducible without any dataset on disk.
+
+#ifndef __SYNTHETIC_DATASET_HPP
+#define __SYNTHETIC_DATASET_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <padenti/host_feature.hpp>
+#include <padenti/image.hpp>
+#include <padenti/training_set.hpp>
+#include <padenti/tree.hpp>
+#include <padenti/tree_trainer.hpp>
+
+#define SYNTHETIC_SEED (1234)
+
+// Same constants of the feature.cl OpenCL feature
+#define TARGET_DEPTH (500.0f)
+#define BG_RESPONSE (10000.0f)
+
+
+// Host version of the feature.cl feature (depth-normalized pixel offset, depth difference)
+class DepthFeature: public HostFeature<unsigned short, 1, short int, 2>
+{
+public:
+  short int compute(const Image<unsigned short, 1> &image, unsigned int x, unsigned int y,
+		    const short int *feature) const
+  {
+    float depth = image.getData()[y*image.getWidth()+x];
+    float response = depth;
+    int offX = (int)x+(int)round(feature[0]*TARGET_DEPTH/depth);
+    int offY = (int)y+(int)round(feature[1]*TARGET_DEPTH/depth);
+
+    bool outOfBorder = offX<0 || offX>=(int)image.getWidth() ||
+      offY<0 || offY>=(int)image.getHeight();
+    depth = (outOfBorder) ? BG_RESPONSE : image.getData()[offY*image.getWidth()+offX];
+    response -= (depth) ? depth : BG_RESPONSE;
+
+    return (short int)response;
+  }
+};
+
+
+// Generate the synthetic training set: the background plane (last class) is slanted,
+// each foreground class c is an ellipsoidal blob closer to the camera. Samples are
+// uniformly drawn without replacement
+template <unsigned int nClasses>
+inline void buildSyntheticTrainingSet(unsigned int nImages, unsigned int width,
+				      unsigned int height, unsigned int nSamples,
+				      TrainingSet<unsigned short, 1> &trainingSet)
+{
+  boost::random::mt19937 gen(SYNTHETIC_SEED);
+  unsigned int nPixels = width*height;
+  if (nSamples>nPixels) nSamples = nPixels;
+
+  std::vector<unsigned short> depth(nPixels);
+  std::vector<unsigned char> labels(nPixels);
+  std::vector<unsigned int> pixels(nPixels), samples(nSamples);
+
+  for (unsigned int i=0; i<nImages; i++)
+  {
+    boost::random::uniform_int_distribution<int> bgDist(2000, 3000), slopeDist(-3, 3);
+    int bgDepth = bgDist(gen), slope = slopeDist(gen);
+    for (unsigned int v=0; v<height; v++)
+    {
+      for (unsigned int u=0; u<width; u++)
+      {
+	depth[v*width+u] = (unsigned short)(bgDepth+slope*(int)v);
+	labels[v*width+u] = nClasses;
+      }
+    }
+
+    for (unsigned int c=1; c<nClasses; c++)
+    {
+      boost::random::uniform_int_distribution<int> uDist(0, width-1), vDist(0, height-1),
+	rDist(width/20+1, width/5+2), dDist(500, 1500);
+      int cu = uDist(gen), cv = vDist(gen), ru = rDist(gen), rv = rDist(gen), d = dDist(gen);
+      for (int v=std::max(cv-rv, 0); v<std::min(cv+rv+1, (int)height); v++)
+      {
+	for (int u=std::max(cu-ru, 0); u<std::min(cu+ru+1, (int)width); u++)
+	{
+	  float du = (float)(u-cu)/ru, dv = (float)(v-cv)/rv, r2 = du*du+dv*dv;
+	  if (r2>1.f) continue;
+	  depth[v*width+u] = (unsigned short)(d-100.f*std::sqrt(1.f-r2));
+	  labels[v*width+u] = c;
+	}
+      }
+    }
+
+    for (unsigned int p=0; p<nPixels; p++) pixels[p] = p;
+    for (unsigned int s=0; s<nSamples; s++)
+    {
+      boost::random::uniform_int_distribution<unsigned int> pDist(s, nPixels-1);
+      std::swap(pixels[s], pixels[pDist(gen)]);
+      samples[s] = pixels[s];
+    }
+
+    trainingSet << TrainingSetImage<unsigned short, 1>(&depth[0], width, height, &labels[0],
+							nClasses, &samples[0], nSamples);
+  }
+}
+
+
+// Training parameters matching the synthetic depth maps range
+inline void initSyntheticParameters(TreeTrainerParameters<short int, 2> &params,
+				    unsigned int nFeatures, unsigned int nThresholds)
+{
+  params.nFeatures = nFeatures;
+  params.nThresholds = nThresholds;
+  params.computeFRange = false;
+  params.featLowBounds[0] = -60;
+  params.featLowBounds[1] = -60;
+  params.featUpBounds[0] = 60;
+  params.featUpBounds[1] = 60;
+  params.thrLowBound = -200;
+  params.thrUpBound = 200;
+  params.randomThrSampling = true;
+}
+
+
+// Compare the nodes reachable from the root of two trees: structure, features, thresholds
+// and posteriors must be equal. Return the number of differing nodes
+template <unsigned int nClasses>
+inline unsigned int compareTrees(const Tree<short int, 2, nClasses> &tree1,
+				 const Tree<short int, 2, nClasses> &tree2)
+{
+  unsigned int nDiffNodes = 0;
+  std::vector<int> toVisit(1, 0);
+  while (!toVisit.empty())
+  {
+    int nodeID = toVisit.back();
+    toVisit.pop_back();
+    const TreeNode<short int, 2> &node1 = tree1.getNode(nodeID);
+    const TreeNode<short int, 2> &node2 = tree2.getNode(nodeID);
+
+    bool split1 = *node1.m_leftChild>0, split2 = *node2.m_leftChild>0;
+    bool equal = split1==split2 &&
+      std::equal(node1.m_posterior, node1.m_posterior+nClasses, node2.m_posterior);
+    if (equal && split1)
+    {
+      equal = *node1.m_leftChild==*node2.m_leftChild &&
+	std::equal(node1.m_feature, node1.m_feature+2, node2.m_feature) &&
+	*node1.m_threshold==*node2.m_threshold;
+    }
+    if (!equal)
+    {
+      nDiffNodes++;
+      continue;
+    }
+    if (split1)
+    {
+      toVisit.push_back(*node1.m_leftChild);
+      toVisit.push_back(*node1.m_leftChild+1);
+    }
+  }
+
+  return nDiffNodes;
+}
+
+
+#endif // __SYNTHETIC_DATASET_HPP
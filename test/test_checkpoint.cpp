@@ -0,0 +1,108 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+// Checkpoint round-trip test: a tree trained up to RESUME_DEPTH-1 with per-level
+// checkpoints, then resumed from the checkpoint in a new train() call, must be equal to
+// the same tree trained in a single call. Both split searches are checked, with all the
+// nodes trained on the OpenCL CPU device and with small subtrees handed off to CPU
+// threads (i.e. subtrees still pending when the checkpoints are saved).
+//
+// Usage: test_checkpoint [kernels path]
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <padenti/training_set.hpp>
+#include <padenti/tree.hpp>
+#include <padenti/cl_tree_trainer.hpp>
+#include "synthetic_dataset.hpp"
+
+#define N_CLASSES (3)
+#define N_IMAGES (20)
+#define IMG_WIDTH (160)
+#define IMG_HEIGHT (120)
+#define N_SAMPLES (1000)
+#define N_FEATURES (64)
+#define N_THRESHOLDS (16)
+#define TREE_DEPTH (12)
+#define RESUME_DEPTH (7)
+#define CPU_SUBTREE_MAX_SAMPLES (1000)
+
+#define CHECKPOINT_PATH "test_checkpoint.ckpt"
+
+typedef Tree<short int, 2, N_CLASSES> TreeT;
+typedef CLTreeTrainer<unsigned short, 1, short int, 2, N_CLASSES> TreeTrainerT;
+
+
+int main(int argc, const char *argv[])
+{
+  std::string kernelsPath = (argc>1) ? argv[1] : ".";
+  TrainingSet<unsigned short, 1> trainingSet(N_CLASSES);
+  buildSyntheticTrainingSet<N_CLASSES>(N_IMAGES, IMG_WIDTH, IMG_HEIGHT, N_SAMPLES, trainingSet);
+  DepthFeature hostFeature;
+  unsigned int errors = 0;
+
+  try
+  {
+    for (unsigned int exact=0; exact<2; exact++)
+    for (unsigned int cpuSubtrees=0; cpuSubtrees<2; cpuSubtrees++)
+    {
+      TreeTrainerParameters<short int, 2> params;
+      initSyntheticParameters(params, N_FEATURES, N_THRESHOLDS);
+      params.randomThrSampling = !exact;
+      params.perLeafSamplesThr = 10;
+
+      CLTreeTrainerInternalParameters internalParams;
+      internalParams.cpuSubtreeMaxSamples = (cpuSubtrees) ? CPU_SUBTREE_MAX_SAMPLES : 0;
+      TreeTrainerT trainer(kernelsPath, true, internalParams);
+      trainer.setHostFeature(&hostFeature);
+
+      TreeT refTree(0, TREE_DEPTH);
+      trainer.train(refTree, trainingSet, params, 1, TREE_DEPTH);
+
+      std::remove(CHECKPOINT_PATH);
+      trainer.setCheckpointPath(CHECKPOINT_PATH);
+      TreeT partialTree(0, TREE_DEPTH), resumedTree(0, TREE_DEPTH);
+      trainer.train(partialTree, trainingSet, params, 1, RESUME_DEPTH);
+      trainer.train(resumedTree, trainingSet, params, RESUME_DEPTH, TREE_DEPTH);
+      std::remove(CHECKPOINT_PATH);
+
+      unsigned int nDiffNodes = compareTrees<N_CLASSES>(refTree, resumedTree);
+      std::cout << ((exact) ? "Exact" : "Random thresholds") << " split search, "
+		<< ((cpuSubtrees) ? "with" : "without") << " CPU subtrees: ";
+      if (nDiffNodes) std::cout << nDiffNodes << " nodes differ" << std::endl;
+      else std::cout << "OK" << std::endl;
+      if (nDiffNodes) errors++;
+    }
+  }
+  catch (cl::Error err)
+  {
+    std::cerr << "Error: " << err.what() << ": " << err.err() << std::endl;
+    return 1;
+  }
+  catch (const char *err)
+  {
+    std::cerr << "Error: " << err << std::endl;
+    return 1;
+  }
+
+  std::cout << ((errors) ? "FAILED" : "PASSED") << std::endl;
+
+  return (errors) ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+// CLTreeTrainer/CPUTreeTrainer equivalence test: a tree trained on the OpenCL CPU device
+// with host split search (random thresholds) or with exact thresholds must be equal to
+// the same tree trained by the CPU trainer, for both the pseudo-random generators.
+//
+// Usage: test_cl_vs_cpu [kernels path]
+
+#include <iostream>
+#include <string>
+#include <padenti/training_set.hpp>
+#include <padenti/tree.hpp>
+#include <padenti/cl_tree_trainer.hpp>
+#include <padenti/cpu_tree_trainer.hpp>
+#include "synthetic_dataset.hpp"
+
+#define N_CLASSES (3)
+#define N_IMAGES (20)
+#define IMG_WIDTH (160)
+#define IMG_HEIGHT (120)
+#define N_SAMPLES (1000)
+#define N_FEATURES (64)
+#define N_THRESHOLDS (16)
+#define TREE_DEPTH (10)
+
+typedef Tree<short int, 2, N_CLASSES> TreeT;
+typedef CLTreeTrainer<unsigned short, 1, short int, 2, N_CLASSES> CLTreeTrainerT;
+typedef CPUTreeTrainer<unsigned short, 1, short int, 2, N_CLASSES> CPUTreeTrainerT;
+
+
+int main(int argc, const char *argv[])
+{
+  std::string kernelsPath = (argc>1) ? argv[1] : ".";
+  TrainingSet<unsigned short, 1> trainingSet(N_CLASSES);
+  buildSyntheticTrainingSet<N_CLASSES>(N_IMAGES, IMG_WIDTH, IMG_HEIGHT, N_SAMPLES, trainingSet);
+  DepthFeature hostFeature;
+  unsigned int errors = 0;
+
+  try
+  {
+    for (unsigned int exact=0; exact<2; exact++)
+    for (unsigned int p=0; p<2; p++)
+    {
+      PRNGType prng = (p) ? PRNG_PHILOX : PRNG_MD5;
+      TreeTrainerParameters<short int, 2> params;
+      initSyntheticParameters(params, N_FEATURES, N_THRESHOLDS);
+      params.randomThrSampling = !exact;
+      params.perLeafSamplesThr = 10;
+
+      CLTreeTrainerInternalParameters internalParams;
+      internalParams.prng = prng;
+      internalParams.splitSearch = SPLIT_SEARCH_HOST;
+      CLTreeTrainerT clTrainer(kernelsPath, true, internalParams);
+      TreeT clTree(0, TREE_DEPTH);
+      clTrainer.train(clTree, trainingSet, params, 1, TREE_DEPTH);
+
+      CPUTreeTrainerT cpuTrainer(&hostFeature, 0, prng);
+      TreeT cpuTree(0, TREE_DEPTH);
+      cpuTrainer.train(cpuTree, trainingSet, params, 1, TREE_DEPTH);
+
+      unsigned int nDiffNodes = compareTrees<N_CLASSES>(clTree, cpuTree);
+      std::cout << ((exact) ? "Exact" : "Random thresholds") << " split search, "
+		<< ((p) ? "Philox" : "MD5") << " generator: ";
+      if (nDiffNodes) std::cout << nDiffNodes << " nodes differ" << std::endl;
+      else std::cout << "OK" << std::endl;
+      if (nDiffNodes) errors++;
+    }
+  }
+  catch (cl::Error err)
+  {
+    std::cerr << "Error: " << err.what() << ": " << err.err() << std::endl;
+    return 1;
+  }
+  catch (const char *err)
+  {
+    std::cerr << "Error: " << err << std::endl;
+    return 1;
+  }
+
+  std::cout << ((errors) ? "FAILED" : "PASSED") << std::endl;
+
+  return (errors) ? 1 : 0;
+}
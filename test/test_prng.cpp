@@ -0,0 +1,97 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+// Host pseudo-random generators known-answer test. The Philox4x32-10 bijection is checked
+// against the Random123 philox4x32_10 vectors, the MD5 generator against the MD5 digest of
+// the 16 bytes message made of the (little-endian) seed words.
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <padenti/prng.hpp>
+
+struct PhiloxKAT
+{
+  unsigned int counter[4];
+  unsigned int key[2];
+  unsigned int expected[4];
+};
+
+struct MD5KAT
+{
+  unsigned int seed[4];
+  unsigned int expected[4];
+};
+
+static const PhiloxKAT philoxKATs[] = {
+  {{0x00000000, 0x00000000, 0x00000000, 0x00000000}, {0x00000000, 0x00000000},
+   {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+  {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff},
+   {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+  {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0},
+   {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}
+};
+
+// MD5 digests of the 16 zero bytes message and of the "0123456789abcdef" one
+static const MD5KAT md5KATs[] = {
+  {{0x00000000, 0x00000000, 0x00000000, 0x00000000},
+   {0x3613e74a, 0xbff94be4, 0x2e75d279, 0xa5184823}},
+  {{0x33323130, 0x37363534, 0x62613938, 0x66656463},
+   {0x8daf3240, 0x23510361, 0xe0586e90, 0xc50c1467}}
+};
+
+
+static bool check(const char *name, unsigned int i, const unsigned int state[],
+		  const unsigned int expected[])
+{
+  bool passed = std::equal(state, state+4, expected);
+  std::cout << name << " " << i << ": " << std::hex << std::setfill('0');
+  for (unsigned int w=0; w<4; w++) std::cout << std::setw(8) << state[w] << " ";
+  std::cout << std::dec << ((passed) ? "ok" : "WRONG") << std::endl;
+  return passed;
+}
+
+
+int main(int argc, char *argv[])
+{
+  unsigned int errors = 0;
+  unsigned int state[4];
+
+  for (unsigned int i=0; i<sizeof(philoxKATs)/sizeof(PhiloxKAT); i++)
+  {
+    philox4x32(philoxKATs[i].counter, philoxKATs[i].key, state);
+    if (!check("philox4x32", i, state, philoxKATs[i].expected)) errors++;
+  }
+
+  // philoxRand is the bijection under the fixed sampling key: the value is pinned, the
+  // hist_update.cl kernel generator must return the same one
+  const unsigned int philoxRandExpected[4] = {0x86c6ee2a, 0xa1a6a49d, 0xf44ee725, 0x40e64324};
+  philoxRand(philoxKATs[2].counter, state);
+  if (!check("philoxRand", 0, state, philoxRandExpected)) errors++;
+
+  for (unsigned int i=0; i<sizeof(md5KATs)/sizeof(MD5KAT); i++)
+  {
+    md5Rand(md5KATs[i].seed, state);
+    if (!check("md5Rand", i, state, md5KATs[i].expected)) errors++;
+  }
+
+  std::cout << ((errors) ? "FAILED" : "PASSED") << std::endl;
+
+  return (errors) ? 1 : 0;
+}
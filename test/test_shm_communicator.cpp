@@ -0,0 +1,129 @@
+/******************************************************************************
+ * Padenti Library
+ *
+ * Copyright (C) 2015  Daniele Pianu <daniele.pianu@ieiit.cnr.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ ******************************************************************************/
+
+// Shared memory communicator test: N_RANKS forked processes all-reduce a buffer larger
+// than the staging area (i.e. reduced in several rounds) and broadcast a buffer from a
+// non-zero rank. Each rank checks the results, the test fails if any rank does. The ranks
+// start after a crashed run left a stale segment, which must be replaced by rank 0.
+
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <padenti/shm_communicator.hpp>
+
+#define N_RANKS (4)
+#define CHUNK_SIZE (1000)
+#define REDUCE_SIZE (1000003)
+#define BROADCAST_SIZE (12345)
+#define BROADCAST_ROOT (2)
+#define SHM_NAME "padenti_test_shm_communicator"
+#define STARTUP_DELAY (200000)
+
+
+// Run the collective operations on a rank and return the number of wrong values
+static unsigned int runRank(unsigned int rank)
+{
+  ShmCommunicator communicator(SHM_NAME, N_RANKS, rank, CHUNK_SIZE);
+  unsigned int errors = 0;
+
+  std::vector<unsigned int> counters(REDUCE_SIZE);
+  for (unsigned int i=0; i<REDUCE_SIZE; i++) counters[i] = i%7+rank;
+  communicator.allReduceSum(&counters[0], counters.size());
+  for (unsigned int i=0; i<REDUCE_SIZE; i++)
+  {
+    // Sum of i%7+r for r in [0, N_RANKS)
+    if (counters[i]!=N_RANKS*(i%7)+N_RANKS*(N_RANKS-1)/2) errors++;
+  }
+
+  std::vector<char> data(BROADCAST_SIZE, (rank==BROADCAST_ROOT) ? 'r' : 'x');
+  communicator.broadcast(&data[0], data.size(), BROADCAST_ROOT);
+  for (unsigned int i=0; i<BROADCAST_SIZE; i++)
+  {
+    if (data[i]!='r') errors++;
+  }
+
+  return errors;
+}
+
+
+int main(int argc, char *argv[])
+{
+  // Simulate a crashed run: rank 0 is killed while waiting for the other ranks, leaving a
+  // stale segment under the communicator name
+  pid_t crashedPid = fork();
+  if (crashedPid<0)
+  {
+    std::cerr << "Unable to fork the crashed rank" << std::endl;
+    return 1;
+  }
+  if (!crashedPid)
+  {
+    try
+    {
+      ShmCommunicator communicator(SHM_NAME, N_RANKS, 0, CHUNK_SIZE);
+    }
+    catch (const char *e) {}
+    _exit(0);
+  }
+  usleep(STARTUP_DELAY);
+  kill(crashedPid, SIGKILL);
+  waitpid(crashedPid, NULL, 0);
+
+  // Rank 0 is started last, hence the other ranks attach to the stale segment first
+  for (unsigned int i=0; i<N_RANKS; i++)
+  {
+    unsigned int r = N_RANKS-1-i;
+    if (!r) usleep(STARTUP_DELAY);
+    pid_t pid = fork();
+    if (pid<0)
+    {
+      std::cerr << "Unable to fork rank " << r << std::endl;
+      return 1;
+    }
+    if (!pid)
+    {
+      unsigned int errors = 0;
+      try
+      {
+	errors = runRank(r);
+      }
+      catch (const char *e)
+      {
+	std::cerr << "Rank " << r << ": " << e << std::endl;
+	errors = 1;
+      }
+      std::cout << "Rank " << r << ": " << errors << " errors" << std::endl;
+      _exit((errors) ? 1 : 0);
+    }
+  }
+
+  unsigned int failedRanks = 0;
+  for (unsigned int r=0; r<N_RANKS; r++)
+  {
+    int status;
+    wait(&status);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) failedRanks++;
+  }
+  std::cout << ((failedRanks) ? "FAILED" : "PASSED") << std::endl;
+
+  return (failedRanks) ? 1 : 0;
+}
@@ -80,6 +80,16 @@ int main(int argc, const char *argv[])
     try
     {
       trainer.train(tree, trainingSet, params, 1, TRAIN_DEPTH);
+
+      const TrainingStats &stats = trainer.getStats();
+      for (unsigned int d=0; d<stats.depths.size(); d++)
+      {
+	std::cout << "Depth " << stats.depths[d].depth << ": "
+		  << stats.depths[d].frontierSize << " nodes, "
+		  << stats.depths[d].nSkippedImages << " skipped images, "
+		  << stats.depths[d].time << " seconds" << std::endl;
+      }
+      std::cout << "Tree trained in " << stats.time << " seconds" << std::endl;
       
       std::stringstream treeName;
       treeName << "tree" << argv[1] << ".xml";